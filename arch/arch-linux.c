@@ -3,6 +3,9 @@
 #include "libscsicmd/include/ata.h"
 #include "libscsicmd/include/ata_parse.h"
 #include "verbose.h"
+#include "error_policy.h"
+#include "probes.h"
+#include "cost.h"
 
 #include <linux/fs.h>
 #include <sys/ioctl.h>
@@ -19,10 +22,18 @@
 #include <net/if.h>
 #include <netinet/in.h>
 #include <mntent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <sys/sysmacros.h>
 
 #define LONG_TIMEOUT (60*1000) // 1 minutes
 #define SHORT_TIMEOUT (5*1000) // 5 seconds
 
+#ifndef SG_FLAG_Q_AT_TAIL
+#define SG_FLAG_Q_AT_TAIL 0x10
+#endif
+
 static void strtrim(char *s)
 {
 	char *t;
@@ -44,40 +55,25 @@ static void strtrim(char *s)
 	}
 }
 
-static enum result_error_e sense_to_error(sense_info_t *info)
+static enum result_transport_e host_status_to_transport(int host_status)
 {
-	// TODO: May need a more granular decision based on asc/ascq
-
-	switch (info->sense_key) {
-		case SENSE_KEY_NO_SENSE:
-			return ERROR_NONE;
-
-		case SENSE_KEY_RECOVERED_ERROR:
-			return ERROR_CORRECTED;
-
-        case SENSE_KEY_MEDIUM_ERROR:
-			return ERROR_UNCORRECTED;
-
-        case SENSE_KEY_UNIT_ATTENTION:
-        case SENSE_KEY_NOT_READY:
-        case SENSE_KEY_ABORTED_COMMAND:
-			return ERROR_NEED_RETRY;
-
-        case SENSE_KEY_HARDWARE_ERROR:
-        case SENSE_KEY_ILLEGAL_REQUEST:
-        case SENSE_KEY_DATA_PROTECT:
-        case SENSE_KEY_BLANK_CHECK:
-        case SENSE_KEY_VENDOR_SPECIFIC:
-        case SENSE_KEY_COPY_ABORTED:
-        case SENSE_KEY_RESERVED_C:
-        case SENSE_KEY_VOLUME_OVERFLOW:
-        case SENSE_KEY_MISCOMPARE:
-        case SENSE_KEY_COMPLETED:
-			return ERROR_FATAL;
+	switch (host_status) {
+		case 0x00: return TRANSPORT_OK;
+		case 0x01: return TRANSPORT_NO_CONNECT; // DID_NO_CONNECT
+		case 0x02: return TRANSPORT_BUSY;       // DID_BUS_BUSY
+		case 0x03: return TRANSPORT_TIMEOUT;    // DID_TIME_OUT
+		case 0x04: return TRANSPORT_NO_CONNECT; // DID_BAD_TARGET
+		case 0x05: return TRANSPORT_TIMEOUT;    // DID_ABORT, the command timed out and was aborted
+		case 0x08: return TRANSPORT_RESET;      // DID_RESET
+		case 0x0B: return TRANSPORT_BUSY;       // DID_SOFT_ERROR
+		case 0x0C: return TRANSPORT_BUSY;       // DID_IMM_RETRY
+		case 0x0D: return TRANSPORT_BUSY;       // DID_REQUEUE
+		case 0x0E: return TRANSPORT_DISRUPTED;  // DID_TRANSPORT_DISRUPTED
+		case 0x0F: return TRANSPORT_NO_CONNECT; // DID_TRANSPORT_FAILFAST
+		case 0x10: return TRANSPORT_NO_CONNECT; // DID_TARGET_FAILURE
+		case 0x11: return TRANSPORT_NO_CONNECT; // DID_NEXUS_FAILURE
+		default: return TRANSPORT_ERROR;
 	}
-
-	ERROR("BUG: Cannot translate sense 0x%02X to error code", info->sense_key);
-	return ERROR_UNKNOWN;
 }
 
 static const char *host_status_to_str(int host_status)
@@ -93,6 +89,10 @@ static const char *host_status_to_str(int host_status)
 		case 0x07: return "DID_ERROR: internal error";
 		case 0x08: return "DID_RESET: Reset by somebody";
 		case 0x09: return "DID_BAD_INTR: Got an interrupt we weren't expecting";
+		case 0x0B: return "DID_SOFT_ERROR: The low level driver wants a retry";
+		case 0x0D: return "DID_REQUEUE: Requeue the command";
+		case 0x0E: return "DID_TRANSPORT_DISRUPTED: Transport error disrupted the IO";
+		case 0x0F: return "DID_TRANSPORT_FAILFAST: Transport class fastfailed the IO";
 		default: return "Unknown host status";
 	}
 }
@@ -141,17 +141,15 @@ static const char *status_code_to_str(int status)
 	}
 }
 
-static const char *driver_status_to_str(int driver_status)
+static const char *driver_status_to_str(int driver_status, char *buf, int buf_len)
 {
-	static char buf[256];
-
-	snprintf(buf, sizeof(buf), "%s %s",
+	snprintf(buf, buf_len, "%s %s",
 			driver_status_low_to_str(driver_status & 0x0F),
 			driver_status_high_to_str(driver_status & 0xF0));
 	return buf;
 }
 
-static int sg_ioctl(int fd, unsigned char *cdb, unsigned cdb_len,
+static int sg_ioctl(disk_dev_t *dev, unsigned char *cdb, unsigned cdb_len,
 		unsigned char *buf, unsigned buf_len,
 		int dxfer_direction, unsigned timeout,
 		unsigned char *sense, unsigned sense_len,
@@ -176,11 +174,16 @@ static int sg_ioctl(int fd, unsigned char *cdb, unsigned cdb_len,
 	hdr.cmdp = cdb;
 	hdr.sbp = sense;
 	hdr.timeout = timeout; /* timeout in milliseconds */
-	hdr.flags = SG_FLAG_LUN_INHIBIT;
+	// Queue behind the commands already in flight, as the block layer does, so the duration is not skewed by jumping the queue
+	hdr.flags = SG_FLAG_LUN_INHIBIT | SG_FLAG_Q_AT_TAIL;
 	hdr.pack_id = 0;
 	hdr.usr_ptr = 0;
 
-	ret = ioctl(fd, SG_IO, &hdr);
+	PROBE3(sg__ioctl__entry, dev->fd, cdb[0], buf_len);
+	const uint64_t cost_start = cost_ticks();
+	ret = ioctl(dev->fd, SG_IO, &hdr);
+	cost_add(COST_DEVICE, cost_start);
+	PROBE5(sg__ioctl__exit, dev->fd, cdb[0], ret, hdr.status, hdr.duration);
 	if (ret < 0) {
 		ERROR("Failed to issue ioctl to device errno=%d: %s", errno, strerror(errno));
 		io_res->error = ERROR_FATAL;
@@ -191,15 +194,21 @@ static int sg_ioctl(int fd, unsigned char *cdb, unsigned cdb_len,
 #if 0
 	if (hdr.status || hdr.driver_status || hdr.msg_status || hdr.host_status || hdr.sb_len_wr)
 	{
+		char driver_str[128];
 		printf("status: %d %s\n", hdr.status, status_code_to_str(hdr.status));
 		printf("masked status: %d\n", hdr.masked_status);
-		printf("driver status: %d %s\n", hdr.driver_status, driver_status_to_str(hdr.driver_status));
+		printf("driver status: %d %s\n", hdr.driver_status, driver_status_to_str(hdr.driver_status, driver_str, sizeof(driver_str)));
 		printf("msg status: %d\n", hdr.msg_status);
 		printf("host status: %d = %s\n", hdr.host_status, host_status_to_str(hdr.host_status));
 		printf("sense len: %d\n", hdr.sb_len_wr);
 	}
 #endif
 
+	// The time from the dispatch to the device until the completion, without the syscall and scheduling of this thread.
+	// In milliseconds every fast read takes 0, the end-to-end time is closer to the truth then.
+	io_res->device_nsec = (uint64_t)hdr.duration * dev->duration_nsec;
+	io_res->device_nsec_valid = dev->duration_nsec == 1;
+
 	*buf_read = hdr.dxfer_len - hdr.resid;
 
 	if (*buf_read == buf_len)
@@ -217,7 +226,8 @@ static int sg_ioctl(int fd, unsigned char *cdb, unsigned cdb_len,
 
 		// Error with sense, parse the sense
 		if (scsi_parse_sense(sense, hdr.sb_len_wr, &io_res->info)) {
-			io_res->error = sense_to_error(&io_res->info);
+			io_res->error = error_policy_sense(&io_res->info)->error;
+			PROBE4(sense__decode, io_res->info.sense_key, io_res->info.asc, io_res->info.ascq, io_res->error);
 		} else {
 			// Parsing of the sense failed, assume the worst
 			io_res->error = ERROR_UNKNOWN;
@@ -225,16 +235,21 @@ static int sg_ioctl(int fd, unsigned char *cdb, unsigned cdb_len,
 		return 0;
 	}
 
-	if (hdr.status != 0) {
-		// No sense but we have an error, consider it fatal if no data returned
+	// The host status tells of commands that timed out or were lost on the way even when the status is good
+	io_res->transport = host_status_to_transport(hdr.host_status);
+	if (hdr.status != 0 || io_res->transport != TRANSPORT_OK) {
+		char driver_str[128];
+
 		ERROR("IO failed with no sense: status=%d (%s) mask=%d driver=%d (%s) msg=%d host=%d (%s)",
 				hdr.status, status_code_to_str(hdr.status),
 				hdr.masked_status,
-				hdr.driver_status, driver_status_to_str(hdr.driver_status),
+				hdr.driver_status, driver_status_to_str(hdr.driver_status, driver_str, sizeof(driver_str)),
 				hdr.msg_status,
 				hdr.host_status, host_status_to_str(hdr.host_status));
 
-		if (*buf_read == 0)
+		if (io_res->transport != TRANSPORT_OK)
+			io_res->error = error_policy_transport(io_res->transport)->error;
+		else if (*buf_read == 0)
 			io_res->error = ERROR_UNKNOWN;
 		return 0;
 	}
@@ -316,10 +331,39 @@ Exit:
 	return state;
 }
 
+/* Newer sg drivers can report the command duration in nanoseconds instead of milliseconds, only the sg devices take
+ * the request and a block device such as /dev/sdX stays in milliseconds.
+ */
+static void sg_duration_setup(disk_dev_t *dev)
+{
+	dev->duration_nsec = 1000000;
+
+#if defined(SG_SET_GET_EXTENDED) && defined(SG_CTL_FLAGM_TIME_IN_NS)
+	struct sg_extended_info sei;
+
+	memset(&sei, 0, sizeof(sei));
+	sei.sei_wr_mask = SG_SEIM_CTL_FLAGS;
+	sei.ctl_flags_wr_mask = SG_CTL_FLAGM_TIME_IN_NS;
+	sei.ctl_flags = SG_CTL_FLAGM_TIME_IN_NS;
+	if (ioctl(dev->fd, SG_SET_GET_EXTENDED, &sei) == 0)
+		dev->duration_nsec = 1;
+#endif
+
+	if (dev->duration_nsec == 1) {
+		VERBOSE("Device command duration is measured in nsec");
+	} else {
+		VERBOSE("Device command duration is only in msec, the end-to-end latency stands in for it");
+	}
+}
+
 bool disk_dev_open(disk_dev_t *dev, const char *path)
 {
 	dev->fd = open(path, O_RDWR|O_DIRECT);
-	return dev->fd >= 0;
+	if (dev->fd < 0)
+		return false;
+
+	sg_duration_setup(dev);
+	return true;
 }
 
 void disk_dev_close(disk_dev_t *dev)
@@ -330,12 +374,12 @@ void disk_dev_close(disk_dev_t *dev)
 
 void disk_dev_cdb_out(disk_dev_t *dev, unsigned char *cdb, unsigned cdb_len, unsigned char *buf, unsigned buf_size, unsigned *buf_read, unsigned char *sense, unsigned sense_size, unsigned *sense_read, io_result_t *io_res)
 {
-	sg_ioctl(dev->fd, cdb, cdb_len, buf, buf_size, SG_DXFER_TO_DEV, LONG_TIMEOUT, sense, sense_size, buf_read, sense_read, io_res);
+	sg_ioctl(dev, cdb, cdb_len, buf, buf_size, SG_DXFER_TO_DEV, LONG_TIMEOUT, sense, sense_size, buf_read, sense_read, io_res);
 }
 
 void disk_dev_cdb_in(disk_dev_t *dev, unsigned char *cdb, unsigned cdb_len, unsigned char *buf, unsigned buf_size, unsigned *buf_read, unsigned char *sense, unsigned sense_size, unsigned *sense_read, io_result_t *io_res)
 {
-	sg_ioctl(dev->fd, cdb, cdb_len, buf, buf_size, SG_DXFER_FROM_DEV, LONG_TIMEOUT, sense, sense_size, buf_read, sense_read, io_res);
+	sg_ioctl(dev, cdb, cdb_len, buf, buf_size, SG_DXFER_FROM_DEV, LONG_TIMEOUT, sense, sense_size, buf_read, sense_read, io_res);
 }
 
 ssize_t disk_dev_read(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_bytes, void *buf, io_result_t *io_res)
@@ -346,12 +390,15 @@ ssize_t disk_dev_read(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_bytes
 	unsigned buf_read = 0;
 	unsigned sense_read = 0;
 	int ret;
+	uint64_t cost_start;
 
+	cost_start = cost_ticks();
 	memset(buf, 0, len_bytes);
+	cost_add(COST_BUFFER_CLEAR, cost_start);
 	memset(io_res, 0, sizeof(*io_res));
 
 	cdb_len = cdb_read_10(cdb, false, offset_bytes / dev->sector_size, len_bytes / dev->sector_size);
-	ret = sg_ioctl(dev->fd, cdb, cdb_len, buf, len_bytes, SG_DXFER_FROM_DEV, LONG_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, io_res);
+	ret = sg_ioctl(dev, cdb, cdb_len, buf, len_bytes, SG_DXFER_FROM_DEV, LONG_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, io_res);
 	if (ret < 0) {
 		return -1;
 	}
@@ -377,7 +424,7 @@ ssize_t disk_dev_write(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_byte
 	memset(io_res, 0, sizeof(*io_res));
 
 	cdb_len = cdb_write_10(cdb, false, offset_bytes / dev->sector_size, len_bytes / dev->sector_size);
-	ret = sg_ioctl(dev->fd, cdb, cdb_len, buf, len_bytes, SG_DXFER_TO_DEV, LONG_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, io_res);
+	ret = sg_ioctl(dev, cdb, cdb_len, buf, len_bytes, SG_DXFER_TO_DEV, LONG_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, io_res);
 	if (ret < 0) {
 		return -1;
 	}
@@ -404,7 +451,7 @@ int disk_dev_read_cap(disk_dev_t *dev, uint64_t *size_bytes, uint64_t *sector_si
 	memset(buf, 0, sizeof(buf));
 
 	cdb_len = cdb_read_capacity_10(cdb);
-	ret = sg_ioctl(dev->fd, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
+	ret = sg_ioctl(dev, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
 	if (ret < 0)
 		return -1;
 
@@ -424,7 +471,7 @@ int disk_dev_read_cap(disk_dev_t *dev, uint64_t *size_bytes, uint64_t *sector_si
 
 	// disk size is too large for READ CAPACITY 10, need to use READ CAPACITY 16
 	cdb_len = cdb_read_capacity_16(cdb, sizeof(buf));
-	ret = sg_ioctl(dev->fd, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
+	ret = sg_ioctl(dev, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
 	if (ret < 0)
 		return -1;
 
@@ -456,7 +503,7 @@ int disk_dev_identify(disk_dev_t *dev, char *vendor, char *model, char *fw_rev,
 	memset(buf, 0, sizeof(buf));
 
 	cdb_len = cdb_inquiry_simple(cdb, 96);
-	ret = sg_ioctl(dev->fd, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
+	ret = sg_ioctl(dev, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
 	if (ret < 0)
 		return -1;
 
@@ -480,7 +527,7 @@ int disk_dev_identify(disk_dev_t *dev, char *vendor, char *model, char *fw_rev,
 	// For an ATA disk we need to get the proper ATA IDENTIFY response
 	memset(buf, 0, sizeof(buf));
 	cdb_len = cdb_ata_identify(cdb);
-	ret = sg_ioctl(dev->fd, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
+	ret = sg_ioctl(dev, cdb, cdb_len, buf, sizeof(buf), SG_DXFER_FROM_DEV, SHORT_TIMEOUT, sense, sizeof(sense), &buf_read, &sense_read, &io_res);
 	if (ret < 0)
 		return -1;
 
@@ -499,6 +546,85 @@ int disk_dev_identify(disk_dev_t *dev, char *vendor, char *model, char *fw_rev,
 	return 0;
 }
 
+static bool sysfs_read_line(const char *path, char *buf, int buf_len)
+{
+	FILE *f = fopen(path, "r");
+	bool result;
+
+	if (f == NULL)
+		return false;
+	result = fgets(buf, buf_len, f) != NULL;
+	fclose(f);
+	return result;
+}
+
+int disk_dev_numa_node(disk_dev_t *dev)
+{
+	struct stat st;
+	char path[PATH_MAX];
+	char dev_path[PATH_MAX];
+	char node_path[PATH_MAX + 16];
+	char line[32];
+	char *slash;
+
+	if (fstat(dev->fd, &st) < 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "/sys/dev/%s/%u:%u", S_ISBLK(st.st_mode) ? "block" : "char", major(st.st_rdev), minor(st.st_rdev));
+	if (realpath(path, dev_path) == NULL)
+		return -1;
+
+	// Walk up the device tree to the first device that knows its node, that is the PCI function of the HBA
+	while (strcmp(dev_path, "/sys/devices") != 0 && (slash = strrchr(dev_path, '/')) != NULL && slash != dev_path) {
+		snprintf(node_path, sizeof(node_path), "%s/numa_node", dev_path);
+		if (sysfs_read_line(node_path, line, sizeof(line)))
+			return atoi(line);
+		*slash = 0;
+	}
+
+	return -1;
+}
+
+bool numa_node_bind(int node)
+{
+	char path[128];
+	char cpulist[1024];
+	char *cur = cpulist;
+	cpu_set_t cpus;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	if (!sysfs_read_line(path, cpulist, sizeof(cpulist)))
+		return false;
+
+	// The cpu list is in the format 0-11,24-35
+	CPU_ZERO(&cpus);
+	while (*cur && *cur != '\n') {
+		char *end;
+		long first = strtol(cur, &end, 10);
+		long last = first;
+
+		if (end == cur)
+			return false;
+		if (*end == '-') {
+			cur = end + 1;
+			last = strtol(cur, &end, 10);
+			if (end == cur)
+				return false;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, &cpus);
+
+		cur = end;
+		if (*cur == ',')
+			cur++;
+	}
+
+	if (CPU_COUNT(&cpus) == 0)
+		return false;
+
+	return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
 void mac_read(unsigned char *buf, int len)
 {
 	struct ifreq ifr;
@@ -4,6 +4,7 @@
 struct disk_dev_t {
 	int fd;
 	uint32_t sector_size;
+	uint32_t duration_nsec; /* Unit of the sg command duration, milliseconds unless the driver can do better */
 };
 
 #endif
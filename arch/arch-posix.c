@@ -8,6 +8,19 @@
 
 #include "verbose.h"
 #include "arch.h"
+#include "cost.h"
+
+int disk_dev_numa_node(disk_dev_t *dev)
+{
+	(void)dev;
+	return -1;
+}
+
+bool numa_node_bind(int node)
+{
+	(void)node;
+	return false;
+}
 
 bool disk_dev_open(disk_dev_t *dev, const char *path)
 {
@@ -27,7 +40,12 @@ void disk_dev_close(disk_dev_t *dev)
 
 ssize_t disk_dev_read(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_bytes, void *buf, io_result_t *io_res)
 {
+	const uint64_t cost_start = cost_ticks();
 	ssize_t ret = pread(dev->fd, buf, len_bytes, offset_bytes);
+	cost_add(COST_DEVICE, cost_start);
+	io_res->device_nsec_valid = false; // Only the end-to-end time is known for a plain read
+	io_res->transport = TRANSPORT_OK;
+	io_res->sense_len = 0;
 	if (ret == len_bytes) {
 		io_res->data = DATA_FULL;
 		io_res->error = ERROR_NONE;
@@ -57,6 +75,8 @@ ssize_t disk_dev_read(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_bytes
 ssize_t disk_dev_write(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_bytes, void *buf, io_result_t *io_res)
 {
 	ssize_t ret = pwrite(dev->fd, buf, len_bytes, offset_bytes);
+	io_res->transport = TRANSPORT_OK;
+	io_res->sense_len = 0;
 	if (ret == len_bytes) {
 		io_res->data = DATA_FULL;
 		io_res->error = ERROR_NONE;
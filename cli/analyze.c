@@ -0,0 +1,637 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cli.h"
+#include "verbose.h"
+#include "compiler.h"
+
+#include "hdrhistogram/src/hdr_histogram.h"
+#include "hdrhistogram/src/hdr_histogram_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define ANALYZE_MAX_THREADS 64
+#define ANALYZE_CURVE_LEN 32 /* The latency graph of every disk is resampled to this many points along the disk */
+#define ANALYZE_FLOOR_USEC 1000 /* Added to both sides of a ratio, sub-msec differences are noise */
+
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+static const double percentiles[] = {50.0, 99.0, 99.99};
+static const char *percentile_names[] = {"p50", "p99", "p99.99"};
+#define ANALYZE_NUM_PERCENTILES ARRAY_SIZE(percentiles)
+
+typedef struct model_key_t {
+	char vendor[64];
+	char model[64];
+	char fw_rev[64];
+} model_key_t;
+
+/* Only the summary of a disk is kept, the histograms are merged into the model as soon as a file is parsed */
+typedef struct analyze_disk_t {
+	const char *path;
+	model_key_t key;
+	char serial[64];
+	bool valid;
+	bool has_curve;
+	int64_t percentiles[ANALYZE_NUM_PERCENTILES]; /* usec */
+	uint32_t curve[ANALYZE_CURVE_LEN]; /* Median latency in msec */
+	struct analyze_model_t *model;
+	double score;
+	const char *worst;
+	char worst_buf[32];
+} analyze_disk_t;
+
+typedef struct analyze_model_t {
+	model_key_t key;
+	unsigned num_disks;
+	struct hdr_histogram *histogram;
+	uint64_t curve_sum[ANALYZE_CURVE_LEN];
+	uint64_t curve_count[ANALYZE_CURVE_LEN];
+	int64_t percentiles[ANALYZE_NUM_PERCENTILES];
+	double curve[ANALYZE_CURVE_LEN]; /* Reference curve, mean of the disk curves */
+} analyze_model_t;
+
+/* Each thread merges into its own models and they are merged together at the end, the threads never contend */
+typedef struct model_table_t {
+	analyze_model_t *models;
+	unsigned num_models;
+	unsigned size;
+} model_table_t;
+
+static analyze_disk_t *disks;
+static unsigned num_disks;
+static unsigned disk_next;
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int usage(void)
+{
+	printf("diskscan-analyze version %s\n\n", VERSION);
+	printf("diskscan-analyze [options] <scan output or directory>...\n");
+	printf("    Merge the latency of many scan outputs (diskscan -o) by vendor, model and firmware and rank the disks\n");
+	printf("    by how far they are from their model. Directories are searched for *.json files.\n");
+	printf("Options:\n");
+	printf("    -v, --verbose        - Increase verbosity, multiple uses for higher levels\n");
+	printf("    -j, --threads <num>  - Number of threads (default to the number of CPUs)\n");
+	printf("    -n, --top <num>      - Number of disks to list in the ranking (default 20)\n");
+	printf("    -o, --output <file>  - Output the model references and full ranking (json)\n");
+	printf("\n");
+	printf("diskscan-analyze --correlate [options] <raw log or directory>...\n");
+	printf("    Find latency spikes that hit several disks at once in raw logs (diskscan -r) and the host, expander\n");
+	printf("    or enclosure the disks share\n");
+	printf("\n");
+	return 1;
+}
+
+static int model_key_cmp(const model_key_t *a, const model_key_t *b)
+{
+	int ret = strcmp(a->vendor, b->vendor);
+	if (ret == 0)
+		ret = strcmp(a->model, b->model);
+	if (ret == 0)
+		ret = strcmp(a->fw_rev, b->fw_rev);
+	return ret;
+}
+
+static analyze_model_t *model_get(model_table_t *table, const model_key_t *key)
+{
+	analyze_model_t *model;
+	unsigned i;
+
+	// A fleet has few models, a linear search is cheaper than parsing a single file
+	for (i = 0; i < table->num_models; i++) {
+		if (model_key_cmp(&table->models[i].key, key) == 0)
+			return &table->models[i];
+	}
+
+	if (table->num_models == table->size) {
+		unsigned new_size = table->size ? table->size * 2 : 16;
+		analyze_model_t *new_models = realloc(table->models, new_size * sizeof(analyze_model_t));
+		if (new_models == NULL)
+			return NULL;
+		table->models = new_models;
+		table->size = new_size;
+	}
+
+	model = &table->models[table->num_models];
+	memset(model, 0, sizeof(*model));
+	model->key = *key;
+	if (hdr_init(1, 60*1000*1000, 3, &model->histogram) != 0)
+		return NULL;
+	table->num_models++;
+	return model;
+}
+
+static void analyze_parse_disk(const char *line, analyze_disk_t *disk, uint64_t *num_sectors)
+{
+	const char *s = line + strspn(line, " \t");
+
+	sscanf(s, "\"Vendor\": \"%63[^\"]\"", disk->key.vendor);
+	sscanf(s, "\"Model\": \"%63[^\"]\"", disk->key.model);
+	sscanf(s, "\"FwRev\": \"%63[^\"]\"", disk->key.fw_rev);
+	sscanf(s, "\"Serial\": \"%63[^\"]\"", disk->serial);
+	sscanf(s, "\"NumSectors\": %"SCNu64, num_sectors);
+}
+
+/* Returns the encoded histogram in the line, which is cut at its end */
+static char *analyze_parse_histogram(char *line, const char *name)
+{
+	char *s = line + strspn(line, " \t");
+	size_t name_len = strlen(name);
+	char *end;
+
+	if (s[0] != '"' || strncmp(s + 1, name, name_len) != 0 || strncmp(s + 1 + name_len, "\": \"", 4) != 0)
+		return NULL;
+
+	s += name_len + 5;
+	end = strchr(s, '"');
+	if (end == NULL)
+		return NULL;
+	*end = 0;
+	return s;
+}
+
+static void analyze_file(analyze_disk_t *disk, model_table_t *table)
+{
+	uint64_t curve_sum[ANALYZE_CURVE_LEN];
+	uint32_t curve_count[ANALYZE_CURVE_LEN];
+	struct hdr_histogram *h = NULL;
+	char *encoded_histogram = NULL;
+	analyze_model_t *model;
+	uint64_t num_sectors = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	bool in_disk = false;
+	unsigned i;
+	FILE *f;
+
+	memset(curve_sum, 0, sizeof(curve_sum));
+	memset(curve_count, 0, sizeof(curve_count));
+
+	f = fopen(disk->path, "r");
+	if (f == NULL) {
+		ERROR("Failed to open %s, errno=%d: %s", disk->path, errno, strerror(errno));
+		return;
+	}
+
+	while (getline(&line, &line_size, f) > 0) {
+		uint64_t start_sector;
+		uint64_t end_sector;
+		uint32_t min_msec;
+		uint32_t max_msec;
+		uint32_t median_msec;
+		char *encoded;
+
+		if (strstr(line, "\"Disk\": {")) {
+			in_disk = true;
+		} else if (in_disk) {
+			if (line[strspn(line, " \t")] == '}')
+				in_disk = false;
+			else
+				analyze_parse_disk(line, disk, &num_sectors);
+		} else if (sscanf(line, " {\"StartSector\": %"SCNu64", \"EndSector\": %"SCNu64", \"LatencyMinMsec\": %"SCNu32", \"LatencyMaxMsec\": %"SCNu32", \"LatencyMedianMsec\": %"SCNu32,
+					&start_sector, &end_sector, &min_msec, &max_msec, &median_msec) == 5) {
+			if (num_sectors > 0 && start_sector < num_sectors) {
+				unsigned bucket = start_sector * ANALYZE_CURVE_LEN / num_sectors;
+				curve_sum[bucket] += median_msec;
+				curve_count[bucket]++;
+			}
+		} else if (encoded_histogram == NULL && (encoded = analyze_parse_histogram(line, "Histogram")) != NULL) {
+			// Decoding is most of the work, the end-to-end latency is only decoded if there is no device latency
+			encoded_histogram = strdup(encoded);
+		} else if (h == NULL && (encoded = analyze_parse_histogram(line, "DeviceHistogram")) != NULL) {
+			if (hdr_log_decode(&h, encoded, strlen(encoded)) != 0)
+				h = NULL;
+		}
+	}
+	free(line);
+	fclose(f);
+
+	// Outputs from before the device latency was measured only have the end-to-end latency
+	if (h == NULL && encoded_histogram != NULL && hdr_log_decode(&h, encoded_histogram, strlen(encoded_histogram)) != 0)
+		h = NULL;
+	if (h == NULL || h->total_count == 0 || disk->key.model[0] == 0) {
+		VERBOSE("No latency histogram in %s, skipped", disk->path);
+		goto Exit;
+	}
+
+	model = model_get(table, &disk->key);
+	if (model == NULL) {
+		ERROR("Failed to allocate memory for model %s", disk->key.model);
+		goto Exit;
+	}
+
+	hdr_add(model->histogram, h);
+	model->num_disks++;
+	for (i = 0; i < ANALYZE_NUM_PERCENTILES; i++)
+		disk->percentiles[i] = hdr_value_at_percentile(h, percentiles[i]);
+
+	disk->has_curve = true;
+	for (i = 0; i < ANALYZE_CURVE_LEN; i++) {
+		if (curve_count[i] == 0) {
+			disk->has_curve = false;
+			break;
+		}
+		disk->curve[i] = curve_sum[i] / curve_count[i];
+	}
+	if (disk->has_curve) {
+		for (i = 0; i < ANALYZE_CURVE_LEN; i++) {
+			model->curve_sum[i] += disk->curve[i];
+			model->curve_count[i]++;
+		}
+	}
+
+	disk->valid = true;
+
+Exit:
+	free(encoded_histogram);
+	free(h);
+}
+
+static void *analyze_thread(void *arg)
+{
+	model_table_t *table = arg;
+
+	while (1) {
+		analyze_disk_t *disk = NULL;
+
+		pthread_mutex_lock(&disk_lock);
+		if (disk_next < num_disks)
+			disk = &disks[disk_next++];
+		pthread_mutex_unlock(&disk_lock);
+		if (disk == NULL)
+			break;
+
+		analyze_file(disk, table);
+	}
+
+	return NULL;
+}
+
+static bool model_merge(model_table_t *dst, model_table_t *src)
+{
+	unsigned i;
+	unsigned j;
+
+	for (i = 0; i < src->num_models; i++) {
+		analyze_model_t *from = &src->models[i];
+		analyze_model_t *model = model_get(dst, &from->key);
+
+		if (model == NULL)
+			return false;
+
+		hdr_add(model->histogram, from->histogram);
+		model->num_disks += from->num_disks;
+		for (j = 0; j < ANALYZE_CURVE_LEN; j++) {
+			model->curve_sum[j] += from->curve_sum[j];
+			model->curve_count[j] += from->curve_count[j];
+		}
+	}
+
+	return true;
+}
+
+static void model_table_free(model_table_t *table)
+{
+	unsigned i;
+
+	for (i = 0; i < table->num_models; i++)
+		free(table->models[i].histogram);
+	free(table->models);
+	memset(table, 0, sizeof(*table));
+}
+
+static int model_cmp(const void *a, const void *b)
+{
+	return model_key_cmp(&((const analyze_model_t *)a)->key, &((const analyze_model_t *)b)->key);
+}
+
+static int model_key_search(const void *key, const void *model)
+{
+	return model_key_cmp(key, &((const analyze_model_t *)model)->key);
+}
+
+static void model_reference(analyze_model_t *model)
+{
+	unsigned i;
+
+	for (i = 0; i < ANALYZE_NUM_PERCENTILES; i++)
+		model->percentiles[i] = hdr_value_at_percentile(model->histogram, percentiles[i]);
+	for (i = 0; i < ANALYZE_CURVE_LEN; i++)
+		model->curve[i] = model->curve_count[i] ? (double)model->curve_sum[i] / model->curve_count[i] : 0.0;
+}
+
+/* The score is the worst ratio of the disk to its model, over the percentiles and the points of the latency curve */
+static void disk_score(analyze_disk_t *disk)
+{
+	analyze_model_t *model = disk->model;
+	unsigned i;
+
+	disk->score = 0.0;
+	for (i = 0; i < ANALYZE_NUM_PERCENTILES; i++) {
+		double ratio = (double)(disk->percentiles[i] + ANALYZE_FLOOR_USEC) / (model->percentiles[i] + ANALYZE_FLOOR_USEC);
+		if (ratio > disk->score) {
+			disk->score = ratio;
+			disk->worst = percentile_names[i];
+		}
+	}
+
+	if (!disk->has_curve || model->curve_count[0] == 0)
+		return;
+
+	for (i = 0; i < ANALYZE_CURVE_LEN; i++) {
+		double ratio = (disk->curve[i] * 1000.0 + ANALYZE_FLOOR_USEC) / (model->curve[i] * 1000.0 + ANALYZE_FLOOR_USEC);
+		if (ratio > disk->score) {
+			disk->score = ratio;
+			snprintf(disk->worst_buf, sizeof(disk->worst_buf), "curve at %u%%", i * 100 / ANALYZE_CURVE_LEN);
+			disk->worst = disk->worst_buf;
+		}
+	}
+}
+
+static int disk_score_cmp(const void *a, const void *b)
+{
+	const analyze_disk_t *da = *(analyze_disk_t * const *)a;
+	const analyze_disk_t *db = *(analyze_disk_t * const *)b;
+
+	if (da->score > db->score)
+		return -1;
+	if (da->score < db->score)
+		return 1;
+	return 0;
+}
+
+static void analyze_output(FILE *f, model_table_t *table, analyze_disk_t **ranked, unsigned num_ranked)
+{
+	unsigned i;
+	unsigned j;
+
+	fprintf(f, "{\n");
+	fprintf(f, "    \"Models\": [\n");
+	for (i = 0; i < table->num_models; i++) {
+		analyze_model_t *model = &table->models[i];
+		char *encoded_histogram = NULL;
+
+		if (hdr_log_encode(model->histogram, &encoded_histogram) != 0)
+			encoded_histogram = NULL;
+
+		fprintf(f, "        {\"Vendor\": \"%s\", \"Model\": \"%s\", \"FwRev\": \"%s\", \"NumDisks\": %u, ",
+				model->key.vendor, model->key.model, model->key.fw_rev, model->num_disks);
+		fprintf(f, "\"Histogram\": \"%s\", \"CurveMsec\": [", encoded_histogram ? encoded_histogram : "");
+		for (j = 0; j < ANALYZE_CURVE_LEN; j++)
+			fprintf(f, "%s%.2f", j ? ", " : "", model->curve[j]);
+		fprintf(f, "]}%s\n", i < table->num_models - 1 ? "," : "");
+		free(encoded_histogram);
+	}
+	fprintf(f, "    ],\n");
+	fprintf(f, "    \"Ranking\": [\n");
+	for (i = 0; i < num_ranked; i++) {
+		analyze_disk_t *disk = ranked[i];
+
+		fprintf(f, "        {\"Path\": \"%s\", \"Vendor\": \"%s\", \"Model\": \"%s\", \"FwRev\": \"%s\", \"Serial\": \"%s\", ",
+				disk->path, disk->key.vendor, disk->key.model, disk->key.fw_rev, disk->serial);
+		fprintf(f, "\"Score\": %.3f, \"Worst\": \"%s\"}%s\n", disk->score, disk->worst, i < num_ranked - 1 ? "," : "");
+	}
+	fprintf(f, "    ]\n");
+	fprintf(f, "}\n");
+}
+
+static void analyze_print(model_table_t *table, analyze_disk_t **ranked, unsigned num_ranked, unsigned top)
+{
+	unsigned i;
+
+	printf("\nModel latency (msec):\n");
+	printf("%-10s %-24s %-10s %8s %10s %10s %10s %10s\n", "Vendor", "Model", "FwRev", "Disks", "p50", "p99", "p99.99", "max");
+	for (i = 0; i < table->num_models; i++) {
+		analyze_model_t *model = &table->models[i];
+		printf("%-10s %-24s %-10s %8u %10.1f %10.1f %10.1f %10.1f\n", model->key.vendor, model->key.model,
+				model->key.fw_rev, model->num_disks, model->percentiles[0] / 1000.0, model->percentiles[1] / 1000.0,
+				model->percentiles[2] / 1000.0, hdr_max(model->histogram) / 1000.0);
+	}
+
+	if (top > num_ranked)
+		top = num_ranked;
+	printf("\nDisks furthest from their model:\n");
+	printf("%8s %-14s %-24s %-20s %s\n", "Score", "Worst", "Model", "Serial", "Path");
+	for (i = 0; i < top; i++) {
+		analyze_disk_t *disk = ranked[i];
+		printf("%8.2f %-14s %-24s %-20s %s\n", disk->score, disk->worst, disk->key.model, disk->serial, disk->path);
+	}
+}
+
+static bool path_add(const char *path, char ***paths, unsigned *num_paths, unsigned *size)
+{
+	if (*num_paths == *size) {
+		unsigned new_size = *size ? *size * 2 : 1024;
+		char **new_paths = realloc(*paths, new_size * sizeof(char *));
+		if (new_paths == NULL)
+			return false;
+		*paths = new_paths;
+		*size = new_size;
+	}
+
+	(*paths)[*num_paths] = strdup(path);
+	if ((*paths)[*num_paths] == NULL)
+		return false;
+	(*num_paths)++;
+	return true;
+}
+
+static bool paths_collect(const char *arg, char ***paths, unsigned *num_paths, unsigned *size)
+{
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+	bool ret = true;
+
+	if (stat(arg, &st) != 0) {
+		ERROR("Failed to access %s, errno=%d: %s", arg, errno, strerror(errno));
+		return false;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return path_add(arg, paths, num_paths, size);
+
+	dir = opendir(arg);
+	if (dir == NULL) {
+		ERROR("Failed to open directory %s, errno=%d: %s", arg, errno, strerror(errno));
+		return false;
+	}
+
+	while (ret && (entry = readdir(dir)) != NULL) {
+		char path[PATH_MAX];
+		size_t len = strlen(entry->d_name);
+
+		if (len < 5 || strcmp(entry->d_name + len - 5, ".json") != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", arg, entry->d_name);
+		ret = path_add(path, paths, num_paths, size);
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+int diskscan_analyze(int argc, char **argv)
+{
+	static model_table_t thread_tables[ANALYZE_MAX_THREADS];
+	pthread_t threads[ANALYZE_MAX_THREADS];
+	model_table_t table = {NULL, 0, 0};
+	analyze_disk_t **ranked = NULL;
+	unsigned num_ranked = 0;
+	char **paths = NULL;
+	unsigned num_paths = 0;
+	unsigned paths_size = 0;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned top = 20;
+	const char *output = NULL;
+	int correlate = 0;
+	struct timespec start;
+	struct timespec end;
+	int ret = 1;
+	long i;
+	int c;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"verbose", no_argument,       0, 'v'},
+			{"threads", required_argument, 0, 'j'},
+			{"top",     required_argument, 0, 'n'},
+			{"output",  required_argument, 0, 'o'},
+			{"correlate", no_argument,     0, 'c'},
+			{0,         0,                 0,  0}
+		};
+
+		c = getopt_long(argc, argv, "vj:n:o:c", long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'v': verbose++; break;
+			case 'j': num_threads = atoi(optarg); break;
+			case 'n': top = atoi(optarg); break;
+			case 'o': output = optarg; break;
+			case 'c': correlate = 1; break;
+			default: return usage();
+		}
+	}
+
+	if (optind == argc) {
+		printf("No scan outputs provided to analyze!\n");
+		return usage();
+	}
+	if (num_threads <= 0 || num_threads > ANALYZE_MAX_THREADS)
+		num_threads = ANALYZE_MAX_THREADS;
+
+	for (; optind < argc; optind++) {
+		if (!paths_collect(argv[optind], &paths, &num_paths, &paths_size))
+			goto Exit;
+	}
+
+	if (correlate) {
+		ret = num_paths ? diskscan_correlate(paths, num_paths, num_threads) : 1;
+		goto Exit;
+	}
+
+	disks = calloc(num_paths, sizeof(analyze_disk_t));
+	ranked = calloc(num_paths, sizeof(analyze_disk_t *));
+	if (num_paths == 0 || disks == NULL || ranked == NULL) {
+		ERROR("No scan outputs found or out of memory for %u of them", num_paths);
+		goto Exit;
+	}
+	num_disks = num_paths;
+	for (i = 0; i < (long)num_disks; i++)
+		disks[i].path = paths[i];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (num_threads > (long)num_disks)
+		num_threads = num_disks;
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, analyze_thread, &thread_tables[i]) != 0) {
+			ERROR("Failed to start an analyze thread, errno=%d: %s", errno, strerror(errno));
+			break;
+		}
+	}
+	num_threads = i;
+	// Analyze here as well, this also covers the case no thread could be started
+	analyze_thread(&table);
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+		if (!model_merge(&table, &thread_tables[i])) {
+			ERROR("Failed to allocate memory to merge the models");
+			goto Exit;
+		}
+		model_table_free(&thread_tables[i]);
+	}
+
+	qsort(table.models, table.num_models, sizeof(analyze_model_t), model_cmp);
+	for (i = 0; i < (long)table.num_models; i++)
+		model_reference(&table.models[i]);
+
+	for (i = 0; i < (long)num_disks; i++) {
+		analyze_disk_t *disk = &disks[i];
+
+		if (!disk->valid)
+			continue;
+		disk->model = bsearch(&disk->key, table.models, table.num_models, sizeof(analyze_model_t), model_key_search);
+		disk_score(disk);
+		ranked[num_ranked++] = disk;
+	}
+	qsort(ranked, num_ranked, sizeof(analyze_disk_t *), disk_score_cmp);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("Analyzed %u scan outputs of %u models in %.1f seconds, %u skipped\n", num_ranked, table.num_models,
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, num_disks - num_ranked);
+	analyze_print(&table, ranked, num_ranked, top);
+
+	ret = 0;
+	if (output) {
+		FILE *f = fopen(output, "w");
+		if (f == NULL) {
+			ERROR("Failed to open output %s, errno=%d: %s", output, errno, strerror(errno));
+			ret = 1;
+			goto Exit;
+		}
+		analyze_output(f, &table, ranked, num_ranked);
+		if (fclose(f) != 0) {
+			ERROR("Failed to write output %s, errno=%d: %s", output, errno, strerror(errno));
+			ret = 1;
+		}
+	}
+
+Exit:
+	model_table_free(&table);
+	for (i = 0; i < (long)num_paths; i++)
+		free(paths[i]);
+	free(paths);
+	free(ranked);
+	free(disks);
+	return ret;
+}
@@ -22,6 +22,9 @@
 #include "diskscan.h"
 #include "compiler.h"
 #include "cli.h"
+#include "history.h"
+#include "heatmap.h"
+#include "median.h"
 
 #include "progressbar/include/progressbar.h"
 #include "hdrhistogram/src/hdr_histogram.h"
@@ -34,6 +37,12 @@
 #include <memory.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define REPLAY_MAX_THREADS 16
+#define HEATMAP_DEFAULT_BUCKET (1024ULL*1024*1024)
+#define HEATMAP_WORST_BUCKETS 10
 
 static disk_t disk;
 static progressbar *bar;
@@ -48,6 +57,22 @@ struct options_t {
 	char *data_log_name;
 	char *data_log_raw_name;
 	disk_mount_e allowed_mount;
+	int scan_unmapped;
+	int defer_standby;
+	char *spinup_lock;
+	int inventory;
+	char *inventory_cache;
+	int replay;
+	char **replay_logs;
+	int num_replay_logs;
+	char *history_dir;
+	char *history_query;
+	unsigned passes;
+	int write_verify;
+	int content_map;
+	char *heatmap;
+	uint64_t heatmap_bucket;
+	char *heatmap_query;
 };
 
 static void print_header(void)
@@ -70,25 +95,34 @@ static int usage(void) {
 	printf("    -r, --raw-log <file> - Raw log of all scan results (json)\n");
 	printf("    --force-mounted      - Allow checking a read-only mounted disk\n");
 	printf("    --force-mounted-rw   - Allow checking a read-write mounted disk\n");
+	printf("    --scan-unmapped      - Read also blocks that a thin provisioned disk reports as unmapped\n");
+	printf("    --defer-standby      - Do not spin up a disk in standby, exit with status 2 instead\n");
+	printf("    --spinup-lock <file> - Lock file to spin up disks one at a time across scans\n");
+	printf("    --history <dir>      - Add the scan to the history of the disk and compare it with the earlier scans\n");
+	printf("    --passes <n>         - Burn-in, scan up to n times and stop early when the results converge or the disk fails\n");
+	printf("    --write-verify       - Alternate the burn-in passes with write and verify passes, DESTROYS ALL DATA ON THE DISK\n");
+	printf("    --content-map        - Classify the data read as zeros, fill pattern or data and save the map with the output\n");
+	printf("    --heatmap <file>     - Record the latency of every bucket of the disk in a binary heatmap file\n");
+	printf("    --heatmap-bucket <size> - Size of a heatmap bucket (default 1G, K, M, G and T suffixes)\n");
+	printf("\n");
+	printf("diskscan --history-query <history file>\n");
+	printf("    Compare the last scan in a disk history against the baseline and previous scans\n");
+	printf("\n");
+	printf("diskscan --heatmap-query <heatmap file>\n");
+	printf("    Show the latency graph of a heatmap file and its worst buckets, also while the scan is running\n");
+	printf("\n");
+	printf("diskscan --replay <raw log>...\n");
+	printf("    Account the IOs of json raw logs (-r) as a scan would have, to try other conclusion and graph settings\n");
+	printf("\n");
+	printf("diskscan --inventory [-o <file>] [--inventory-cache <dir>]\n");
+	printf("    Identify all the disks of the system in parallel and output a single json document\n");
+	printf("\n");
+	printf("diskscan daemon [options] <state dir>\n");
+	printf("    Scan all the disks of the system continuously, see diskscan daemon --help\n");
 	printf("\n");
 	return 1;
 }
 
-void report_progress(disk_t * UNUSED(disk), int progress_part, int progress_full)
-{
-	if (bar == NULL)
-		bar = progressbar_new("Disk scan", progress_full);
-	progressbar_update(bar, progress_part);
-}
-
-void report_scan_success(disk_t *UNUSED(disk), uint64_t UNUSED(offset_bytes), uint64_t UNUSED(data_size), uint64_t UNUSED(time))
-{
-}
-
-void report_scan_error(disk_t *UNUSED(disk), uint64_t UNUSED(offset_bytes), uint64_t UNUSED(data_size), uint64_t UNUSED(time))
-{
-}
-
 static void print_latency(latency_t *latency_graph, unsigned latency_graph_len)
 {
 	unsigned i;
@@ -151,19 +185,166 @@ static void print_latency(latency_t *latency_graph, unsigned latency_graph_len)
 
 }
 
-void report_scan_done(disk_t *pdisk)
+static void print_scan_result(disk_t *pdisk)
 {
-	progressbar_finish(bar);
+	if (pdisk->spinup_nsec > 0)
+		printf("\nSpin-up latency from %s: %"PRIu64" msec, not included below\n",
+				power_state_to_str(pdisk->power_state), pdisk->spinup_nsec / 1000000);
 
 	printf("\nAccess time histogram:\n");
 	hdr_percentiles_print(pdisk->histogram, stdout, 5, 1000.0, CLASSIC); // Print msecs
 
+	printf("\nDevice latency (msec), the conclusion is based on it:\n");
+	printf("%10s %10s %10s %10s\n", "p50", "p99", "p99.99", "max");
+	printf("%10.1f %10.1f %10.1f %10.1f\n",
+			hdr_value_at_percentile(pdisk->device_histogram, 50.0) / 1000.0,
+			hdr_value_at_percentile(pdisk->device_histogram, 99.0) / 1000.0,
+			hdr_value_at_percentile(pdisk->device_histogram, 99.99) / 1000.0,
+			hdr_max(pdisk->device_histogram) / 1000.0);
+
 	printf("\nLatency graph:\n");
 	print_latency(pdisk->latency_graph, pdisk->latency_graph_len);
 
+	if (pdisk->num_zones > 0) {
+		int i;
+
+		printf("\nZone latency (msec), %"PRIu64" MB unwritten and skipped:\n", pdisk->unwritten_bytes / (1024*1024));
+		printf("%28s %10s %10s %10s %10s %10s\n", "Zone type", "Reads", "Median", "99%", "99.99%", "Max");
+		for (i = 0; i < ZONE_TYPE_NUM; i++) {
+			struct hdr_histogram *h = pdisk->zone_histogram[i];
+			if (h == NULL || h->total_count == 0)
+				continue;
+			printf("%28s %10"PRId64" %10.1f %10.1f %10.1f %10.1f\n", zone_type_to_str(i), h->total_count,
+					hdr_value_at_percentile(h, 50.0) / 1000.0,
+					hdr_value_at_percentile(h, 99.0) / 1000.0,
+					hdr_value_at_percentile(h, 99.99) / 1000.0,
+					hdr_max(h) / 1000.0);
+		}
+	}
+
+	if (pdisk->num_ranges > 1) {
+		unsigned i;
+
+		printf("\nActuator latency (msec):\n");
+		printf("%10s %16s %16s %10s %10s %10s %10s\n", "Range", "Start sector", "End sector", "Errors", "Median", "99.99%", "Max");
+		for (i = 0; i < pdisk->num_ranges; i++) {
+			disk_range_t *range = &pdisk->ranges[i];
+			printf("%10u %16"PRIu64" %16"PRIu64" %10"PRIu64" %10.1f %10.1f %10.1f\n", i,
+					range->start_bytes / pdisk->sector_size, range->end_bytes / pdisk->sector_size,
+					range->num_errors,
+					hdr_value_at_percentile(range->histogram, 50.0) / 1000.0,
+					hdr_value_at_percentile(range->histogram, 99.99) / 1000.0,
+					hdr_max(range->histogram) / 1000.0);
+		}
+	}
+
+	if (pdisk->num_slow_regions > 0) {
+		unsigned i;
+
+		printf("\nSlow regions (msec):\n");
+		printf("%16s %16s %10s %10s\n", "Start sector", "End sector", "Median", "Baseline");
+		for (i = 0; i < pdisk->num_slow_regions && i < ANOMALY_MAX_REGIONS; i++) {
+			slow_region_t *r = &pdisk->slow_regions[i];
+			printf("%16"PRIu64" %16"PRIu64" %10.1f %10.1f\n", r->start_sector, r->end_sector,
+					r->median_usec / 1000.0, r->baseline_usec / 1000.0);
+		}
+		if (pdisk->num_slow_regions > ANOMALY_MAX_REGIONS)
+			printf("and %u more slow regions\n", pdisk->num_slow_regions - ANOMALY_MAX_REGIONS);
+	}
+
+	if (pdisk->num_bad_sectors > 0) {
+		unsigned i;
+
+		printf("\nFailing sectors reported by the disk:");
+		for (i = 0; i < pdisk->num_bad_sectors && i < DISK_MAX_BAD_SECTORS; i++)
+			printf("%s%"PRIu64, i % 8 ? " " : "\n", pdisk->bad_sectors[i]);
+		printf("\n");
+		if (pdisk->num_bad_sectors > DISK_MAX_BAD_SECTORS)
+			printf("and %u more failing sectors\n", pdisk->num_bad_sectors - DISK_MAX_BAD_SECTORS);
+	}
+
+	if (pdisk->lbp_supported && !pdisk->scan_unmapped) {
+		const uint64_t total_bytes = pdisk->mapped_bytes + pdisk->unmapped_bytes;
+		printf("\nProvisioning: %"PRIu64" MB mapped, %"PRIu64" MB unmapped and skipped (%.1f%% mapped)\n",
+				pdisk->mapped_bytes / (1024*1024), pdisk->unmapped_bytes / (1024*1024),
+				total_bytes ? 100.0 * pdisk->mapped_bytes / total_bytes : 0.0);
+	}
+
+	if (pdisk->cost.num_ios > 0 && pdisk->cost.wall_nsec > 0) {
+		int phase;
+
+		printf("\nTime per IO (usec), CPU utilization %.1f%%:\n", 100.0 * pdisk->cost.cpu_nsec / pdisk->cost.wall_nsec);
+		for (phase = 0; phase < COST_PHASE_NUM; phase++) {
+			printf("%14s %10.1f\n", cost_phase_to_str(phase),
+					pdisk->cost.ticks[phase] * pdisk->cost.nsec_per_tick / pdisk->cost.num_ios / 1000.0);
+		}
+	}
+
+	if (pdisk->content_map.map) {
+		content_map_t *map = &pdisk->content_map;
+		const uint64_t total_bytes = map->bytes[CONTENT_ZERO] + map->bytes[CONTENT_PATTERN] + map->bytes[CONTENT_DATA];
+
+		if (total_bytes > 0)
+			printf("\nContent: %.1f%% zeros, %.1f%% fill pattern, %.1f%% data\n",
+					100.0 * map->bytes[CONTENT_ZERO] / total_bytes, 100.0 * map->bytes[CONTENT_PATTERN] / total_bytes,
+					100.0 * map->bytes[CONTENT_DATA] / total_bytes);
+	}
+
 	printf("\nConclusion: %s\n", conclusion_to_str(pdisk->conclusion));
 }
 
+static void print_burnin_result(disk_t *pdisk)
+{
+	unsigned i;
+
+	printf("\nBurn-in passes, device latency (msec):\n");
+	printf("%5s %13s %10s %10s %10s %10s %8s %12s %34s\n", "Pass", "Type", "Minutes", "Errors", "p99", "p99.99",
+			"Temp", "Reallocs", "Conclusion");
+	for (i = 0; i < pdisk->num_passes; i++) {
+		disk_pass_t *pass = &pdisk->passes[i];
+		char temp[16] = "-";
+		char reallocs[32] = "-";
+
+		if (pass->has_smart) {
+			snprintf(temp, sizeof(temp), "%d", pass->temp);
+			snprintf(reallocs, sizeof(reallocs), "%d/%d", pass->reallocs, pass->pending_reallocs);
+		}
+		printf("%5u %13s %10.1f %10"PRIu64" %10.1f %10.1f %8s %12s %34s\n", i + 1,
+				pass->write_verify ? "write-verify" : "read", pass->wall_nsec / 60e9, pass->num_errors,
+				hdr_value_at_percentile(pass->device_histogram, 99.0) / 1000.0,
+				hdr_value_at_percentile(pass->device_histogram, 99.99) / 1000.0,
+				temp, reallocs, conclusion_to_str(pass->conclusion));
+	}
+
+	printf("\nBurn-in: %s\n", burnin_result_to_str(pdisk->burnin));
+}
+
+/* Only the disk scanned interactively is reported on the terminal, the daemon scans report in its log */
+static void scan_events(void *ctx, const scan_event_t *events, unsigned num_events)
+{
+	disk_t *pdisk = ctx;
+	unsigned i;
+
+	for (i = 0; i < num_events; i++) {
+		const scan_event_t *event = &events[i];
+
+		switch (event->type) {
+			case SCAN_EVENT_PROGRESS:
+				if (bar == NULL)
+					bar = progressbar_new("Disk scan", event->progress_full);
+				progressbar_update(bar, event->progress_part);
+				break;
+			case SCAN_EVENT_DONE:
+				progressbar_finish(bar);
+				bar = NULL;
+				print_scan_result(pdisk);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
 static unsigned str_to_scan_size(const char *str)
 {
 	char *endptr;
@@ -207,6 +388,12 @@ static int parse_args(int argc, char **argv, options_t *opts)
 	int c;
 	int unknown = 0;
 	static int allowed_mount = DISK_NOT_MOUNTED;
+	static int scan_unmapped = 0;
+	static int defer_standby = 0;
+	static int inventory = 0;
+	static int replay = 0;
+	static int write_verify = 0;
+	static int content_map = 0;
 
 	opts->scan_size = 64*1024;
 
@@ -221,6 +408,20 @@ static int parse_args(int argc, char **argv, options_t *opts)
 			{"output",  required_argument, 0,  'o'},
 			{"force-mounted", no_argument, &allowed_mount, DISK_MOUNTED_RO},
 			{"force-mounted-rw", no_argument, &allowed_mount, DISK_MOUNTED_RW},
+			{"scan-unmapped", no_argument, &scan_unmapped, 1},
+			{"defer-standby", no_argument, &defer_standby, 1},
+			{"spinup-lock", required_argument, 0, 'L'},
+			{"inventory", no_argument, &inventory, 1},
+			{"replay", no_argument, &replay, 1},
+			{"inventory-cache", required_argument, 0, 'C'},
+			{"history", required_argument, 0, 'H'},
+			{"history-query", required_argument, 0, 'Q'},
+			{"passes", required_argument, 0, 'P'},
+			{"write-verify", no_argument, &write_verify, 1},
+			{"content-map", no_argument, &content_map, 1},
+			{"heatmap", required_argument, 0, 'M'},
+			{"heatmap-bucket", required_argument, 0, 'B'},
+			{"heatmap-query", required_argument, 0, 'Y'},
 			{0,         0,                 0,  0}
 		};
 
@@ -255,6 +456,38 @@ static int parse_args(int argc, char **argv, options_t *opts)
 			case 'r':
 				opts->data_log_raw_name = optarg;
 				break;
+			case 'L':
+				opts->spinup_lock = optarg;
+				break;
+			case 'C':
+				opts->inventory_cache = optarg;
+				break;
+			case 'H':
+				opts->history_dir = optarg;
+				break;
+			case 'Q':
+				opts->history_query = optarg;
+				break;
+			case 'M':
+				opts->heatmap = optarg;
+				break;
+			case 'B':
+				opts->heatmap_bucket = heatmap_str_to_bytes(optarg);
+				if (opts->heatmap_bucket == 0) {
+					printf("Invalid heatmap bucket size %s\n", optarg);
+					unknown = 1;
+				}
+				break;
+			case 'Y':
+				opts->heatmap_query = optarg;
+				break;
+			case 'P':
+				opts->passes = strtoul(optarg, NULL, 0);
+				if (opts->passes == 0 || opts->passes > DISK_MAX_PASSES) {
+					printf("Number of passes must be between 1 and %u\n", DISK_MAX_PASSES);
+					unknown = 1;
+				}
+				break;
 
 			default:
 				unknown = 1;
@@ -262,6 +495,48 @@ static int parse_args(int argc, char **argv, options_t *opts)
 		}
 	}
 
+	if (unknown) {
+		printf("Unknown option provided\n");
+		return usage();
+	}
+
+	// The inventory covers all the disks of the system
+	opts->inventory = inventory;
+	if (inventory) {
+		if (optind != argc) {
+			printf("No disk path is needed for the inventory\n");
+			return usage();
+		}
+		return 0;
+	}
+
+	if (opts->history_query) {
+		if (optind != argc) {
+			printf("No disk path is needed to query the history\n");
+			return usage();
+		}
+		return 0;
+	}
+
+	if (opts->heatmap_query) {
+		if (optind != argc) {
+			printf("No disk path is needed to query a heatmap\n");
+			return usage();
+		}
+		return 0;
+	}
+
+	opts->replay = replay;
+	if (replay) {
+		if (optind == argc) {
+			printf("No raw log provided to replay!\n");
+			return usage();
+		}
+		opts->replay_logs = argv + optind;
+		opts->num_replay_logs = argc - optind;
+		return 0;
+	}
+
 	if (optind == argc) {
 		printf("No disk path provided to scan!\n");
 		return usage();
@@ -271,11 +546,6 @@ static int parse_args(int argc, char **argv, options_t *opts)
 		return usage();
 	}
 
-	if (unknown) {
-		printf("Unknown option provided\n");
-		return usage();
-	}
-
 	if (opts->scan_size == 0) {
 		printf("Scan size is invalid, must be a positive number\n");
 		return usage();
@@ -283,6 +553,14 @@ static int parse_args(int argc, char **argv, options_t *opts)
 
 	opts->disk_path = argv[optind];
 	opts->allowed_mount = allowed_mount;
+	opts->scan_unmapped = scan_unmapped;
+	opts->defer_standby = defer_standby;
+	opts->write_verify = write_verify;
+	opts->content_map = content_map;
+	if (write_verify && opts->passes < 2) {
+		printf("Write-verify alternates with read passes, at least two passes are needed\n");
+		return usage();
+	}
 	return 0;
 }
 
@@ -293,20 +571,213 @@ static int print_disk_info(disk_t *UNUSED(disk))
 }
 */
 
+/* Each column of the graph covers a run of buckets: the best minimum, the worst maximum and the median of their medians */
+static void heatmap_downsample(heatmap_t *hm, latency_t *graph, unsigned graph_len, uint32_t *medians)
+{
+	const uint64_t num_buckets = hm->header->num_buckets;
+	const uint64_t sectors_per_bucket = hm->header->bucket_bytes / hm->header->sector_size;
+	unsigned i;
+
+	for (i = 0; i < graph_len; i++) {
+		const uint64_t start = num_buckets * i / graph_len;
+		const uint64_t end = num_buckets * (i + 1) / graph_len;
+		latency_t *l = &graph[i];
+		unsigned num_medians = 0;
+		uint64_t bucket;
+
+		memset(l, 0, sizeof(*l));
+		l->start_sector = start * sectors_per_bucket;
+		l->end_sector = end * sectors_per_bucket;
+		l->latency_min_msec = UINT32_MAX;
+		for (bucket = start; bucket < end; bucket++) {
+			heatmap_record_t *r = &hm->records[bucket];
+			if (!(r->flags & HEATMAP_RECORD_DONE) || r->num_ios == 0)
+				continue;
+			if (r->min_usec / 1000 < l->latency_min_msec)
+				l->latency_min_msec = r->min_usec / 1000;
+			if (r->max_usec / 1000 > l->latency_max_msec)
+				l->latency_max_msec = r->max_usec / 1000;
+			medians[num_medians++] = r->median_usec / 1000;
+		}
+		if (num_medians > 0)
+			l->latency_median_msec = median(medians, num_medians);
+		else
+			l->latency_min_msec = 0;
+	}
+}
+
+static int heatmap_query(const char *path)
+{
+	heatmap_t hm;
+	latency_t graph[LATENCY_GRAPH_LEN];
+	uint64_t worst[HEATMAP_WORST_BUCKETS];
+	unsigned num_worst = 0;
+	uint64_t num_done = 0;
+	uint64_t num_errors = 0;
+	uint64_t num_retries = 0;
+	uint64_t bucket;
+	uint32_t *medians;
+	unsigned graph_len;
+	unsigned i;
+
+	if (!heatmap_open(&hm, path))
+		return 1;
+
+	medians = malloc((hm.header->num_buckets / LATENCY_GRAPH_LEN + 1) * sizeof(uint32_t));
+	if (medians == NULL) {
+		ERROR("Failed to allocate memory for the heatmap of %"PRIu64" buckets", hm.header->num_buckets);
+		heatmap_close(&hm);
+		return 1;
+	}
+
+	// Keep the buckets with the worst p99, sorted worst first
+	for (bucket = 0; bucket < hm.header->num_buckets; bucket++) {
+		heatmap_record_t *r = &hm.records[bucket];
+		if (!(r->flags & HEATMAP_RECORD_DONE))
+			continue;
+		num_done++;
+		num_errors += r->num_errors;
+		num_retries += r->num_retries;
+
+		for (i = num_worst; i > 0 && hm.records[worst[i-1]].p99_usec < r->p99_usec; i--) {
+			if (i < HEATMAP_WORST_BUCKETS)
+				worst[i] = worst[i-1];
+		}
+		if (i < HEATMAP_WORST_BUCKETS) {
+			worst[i] = bucket;
+			if (num_worst < HEATMAP_WORST_BUCKETS)
+				num_worst++;
+		}
+	}
+
+	printf("Heatmap of %s %s %s, %"PRIu64" of %"PRIu64" buckets of %"PRIu64" MB scanned, %"PRIu64" errors, %"PRIu64" retries\n",
+			hm.header->vendor, hm.header->model, hm.header->serial, num_done, hm.header->num_buckets,
+			hm.header->bucket_bytes / (1024*1024), num_errors, num_retries);
+
+	// A small heatmap is shown as it is, not stretched over the whole width
+	graph_len = hm.header->num_buckets < LATENCY_GRAPH_LEN ? hm.header->num_buckets : LATENCY_GRAPH_LEN;
+	heatmap_downsample(&hm, graph, graph_len, medians);
+	printf("\nLatency graph:\n");
+	print_latency(graph, graph_len);
+
+	printf("\nWorst buckets (msec):\n");
+	printf("%10s %16s %16s %8s %8s %10s %10s %10s %10s\n", "Bucket", "Start sector", "End sector", "Errors", "Retries",
+			"Min", "Median", "99%", "Max");
+	for (i = 0; i < num_worst; i++) {
+		heatmap_record_t *r = &hm.records[worst[i]];
+		const uint64_t sectors_per_bucket = hm.header->bucket_bytes / hm.header->sector_size;
+		printf("%10"PRIu64" %16"PRIu64" %16"PRIu64" %8u %8u %10.1f %10.1f %10.1f %10.1f\n", worst[i],
+				worst[i] * sectors_per_bucket, (worst[i] + 1) * sectors_per_bucket, r->num_errors, r->num_retries,
+				r->min_usec / 1000.0, r->median_usec / 1000.0, r->p99_usec / 1000.0, r->max_usec / 1000.0);
+	}
+
+	free(medians);
+	heatmap_close(&hm);
+	return 0;
+}
+
+typedef struct replay_t {
+	const char *raw_log;
+	disk_t disk;
+	int result;
+} replay_t;
+
+static replay_t *replays;
+static int num_replays;
+static int replay_next;
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *replay_thread(void *UNUSED(arg))
+{
+	while (1) {
+		replay_t *r = NULL;
+
+		pthread_mutex_lock(&replay_lock);
+		if (replay_next < num_replays)
+			r = &replays[replay_next++];
+		pthread_mutex_unlock(&replay_lock);
+		if (r == NULL)
+			break;
+
+		r->result = disk_replay(&r->disk, r->raw_log, LATENCY_GRAPH_LEN);
+	}
+
+	return NULL;
+}
+
+/* Logs are replayed in parallel and reported in the order given once all are done */
+static int diskscan_replay(char **raw_logs, int num_logs)
+{
+	pthread_t threads[REPLAY_MAX_THREADS];
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int num_threads;
+	int ret = 0;
+	int i;
+
+	replays = calloc(num_logs, sizeof(replay_t));
+	if (replays == NULL) {
+		ERROR("Failed to allocate memory for %d replays", num_logs);
+		return 1;
+	}
+	num_replays = num_logs;
+	for (i = 0; i < num_logs; i++)
+		replays[i].raw_log = raw_logs[i];
+
+	num_threads = num_cpus > 0 && num_cpus < REPLAY_MAX_THREADS ? num_cpus : REPLAY_MAX_THREADS;
+	if (num_threads > num_logs)
+		num_threads = num_logs;
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, replay_thread, NULL) != 0) {
+			ERROR("Failed to start a replay thread, errno=%d: %s", errno, strerror(errno));
+			break;
+		}
+	}
+	num_threads = i;
+	// Replay here as well, this also covers the case no thread could be started
+	replay_thread(NULL);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < num_logs; i++) {
+		replay_t *r = &replays[i];
+
+		if (r->result == 0) {
+			printf("\nReplay of %s (%s %s %s):\n", r->raw_log, r->disk.vendor, r->disk.model, r->disk.serial);
+			print_scan_result(&r->disk);
+		} else {
+			ret = 1;
+		}
+		disk_replay_close(&r->disk);
+	}
+
+	free(replays);
+	return ret;
+}
+
 static void diskscan_cli_signal(int UNUSED(signal))
 {
 	disk_scan_stop(&disk);
 }
 
+static void diskscan_cli_dump_signal(int UNUSED(signal))
+{
+	disk_flight_recorder_dump(&disk);
+}
+
 static void setup_signals(void)
 {
 	struct sigaction act = {
 		.sa_handler = diskscan_cli_signal,
 		.sa_flags = SA_RESTART,
 	};
+	struct sigaction dump_act = {
+		.sa_handler = diskscan_cli_dump_signal,
+		.sa_flags = SA_RESTART,
+	};
 
 	sigaction(SIGINT, &act, NULL);
 	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGUSR1, &dump_act, NULL);
 }
 
 int diskscan_cli(int argc, char **argv)
@@ -322,12 +793,39 @@ int diskscan_cli(int argc, char **argv)
 		return 1;
 	verbose = opts.verbose;
 
+	if (opts.inventory)
+		return diskscan_inventory(opts.data_log_name, opts.inventory_cache);
+	if (opts.replay)
+		return diskscan_replay(opts.replay_logs, opts.num_replay_logs);
+	if (opts.history_query)
+		return history_compare(opts.history_query, stdout) < 0 ? 1 : 0;
+	if (opts.heatmap_query)
+		return heatmap_query(opts.heatmap_query);
+
 	print_header();
 
 	setup_signals();
 
-	if (disk_open(&disk, opts.disk_path, opts.fix, 70, opts.allowed_mount))
+	if (disk_open(&disk, opts.disk_path, opts.fix, LATENCY_GRAPH_LEN, opts.allowed_mount))
+		return 1;
+	disk.scan_unmapped = opts.scan_unmapped;
+	disk.defer_standby = opts.defer_standby;
+	disk.spinup_lock = opts.spinup_lock;
+	disk.content_map.enabled = opts.content_map;
+	if (opts.heatmap && !heatmap_create(&disk.heatmap, opts.heatmap, opts.heatmap_bucket ? opts.heatmap_bucket : HEATMAP_DEFAULT_BUCKET,
+				disk.num_bytes, disk.sector_size, disk.vendor, disk.model, disk.serial)) {
+		disk_close(&disk);
 		return 1;
+	}
+	if (opts.write_verify && !disk_write_allowed(&disk, DISK_NOT_MOUNTED)) {
+		disk_close(&disk);
+		return 1;
+	}
+	const scan_filter_t filter = { .types = SCAN_EVENT_MASK(SCAN_EVENT_PROGRESS) | SCAN_EVENT_MASK(SCAN_EVENT_DONE) };
+	if (disk_subscribe(&disk, &filter, 1, scan_events, &disk) == NULL) {
+		disk_close(&disk);
+		return 1;
+	}
 
 	/*
 	if (print_disk_info(&disk))
@@ -339,13 +837,33 @@ int diskscan_cli(int argc, char **argv)
 	if (opts.data_log_name)
 		data_log_start(&disk.data_log, opts.data_log_name, &disk);
 	ret = 0;
-	if (disk_scan(&disk, opts.mode, opts.scan_size))
+	if (opts.passes > 1) {
+		if (disk_burnin(&disk, opts.mode, opts.scan_size, opts.passes, opts.write_verify))
+			ret = 1;
+		else if (disk.conclusion == CONCLUSION_DEFERRED)
+			ret = 2;
+		else
+			print_burnin_result(&disk);
+	} else if (disk_scan(&disk, opts.mode, opts.scan_size))
 		ret = 1;
+	else if (disk.conclusion == CONCLUSION_DEFERRED)
+		ret = 2;
 	if (opts.data_log_raw_name)
 		data_log_raw_end(&disk.data_raw);
 	if (opts.data_log_name)
 		data_log_end(&disk.data_log, &disk);
 
+	// Aborted and deferred scans did not cover the disk and would only skew the trend
+	if (opts.history_dir && (disk.conclusion == CONCLUSION_PASSED || disk.conclusion >= CONCLUSION_FAILED_MAX_LATENCY)) {
+		char history[PATH_MAX];
+
+		history_path(opts.history_dir, &disk, history, sizeof(history));
+		if (history_append(opts.history_dir, &disk) == 0) {
+			printf("\n");
+			history_compare(history, stdout);
+		}
+	}
+
 	disk_close(&disk);
 	return ret;
 }
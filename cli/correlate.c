@@ -0,0 +1,422 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cli.h"
+#include "verbose.h"
+#include "compiler.h"
+
+#include "hdrhistogram/src/hdr_histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define CORRELATE_MAX_THREADS 64
+#define CORRELATE_SPIKE_FACTOR 5 /* An IO is a spike when it is this many times slower than the median of its disk */
+#define CORRELATE_MIN_SPIKE_NSEC (50*1000*1000ULL) /* and at least this slow, a seek or a cache miss is not a spike */
+#define CORRELATE_WINDOW_NSEC (100*1000*1000ULL) /* Spikes closer than this are the same event */
+#define CORRELATE_THRESHOLD_IOS 4096 /* The median is followed as the log is read, it is refreshed this often */
+
+enum path_type {
+	PATH_EXPANDER,
+	PATH_ENCLOSURE,
+	PATH_HOST,
+	PATH_NUM,
+};
+
+static const char *path_type_names[PATH_NUM] = {"expander", "enclosure", "host"};
+
+typedef struct spike_t {
+	uint64_t start_nsec; /* Wall clock, the logs of different scans are aligned on it */
+	uint64_t end_nsec;
+	uint64_t max_latency_nsec;
+	unsigned log;
+} spike_t;
+
+typedef struct raw_log_t {
+	const char *path;
+	bool valid;
+	char model[64];
+	char serial[64];
+	char machine[64];
+	char name[64];
+	char paths[PATH_NUM][64];
+	uint64_t first_nsec;
+	uint64_t last_nsec;
+	uint64_t num_ios;
+	spike_t *spikes;
+	unsigned num_spikes;
+	unsigned spikes_size;
+	int last_event; /* Last event the disk was counted in */
+} raw_log_t;
+
+static raw_log_t *logs;
+static unsigned num_logs;
+static unsigned log_next;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Copy the string value of a key in a single line json object */
+static void json_str(const char *line, const char *key, char *buf, int buf_len)
+{
+	char pattern[64];
+	const char *s;
+	int i;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+	s = strstr(line, pattern);
+	if (s == NULL)
+		return;
+
+	s += strlen(pattern);
+	for (i = 0; s[i] && s[i] != '"' && i < buf_len - 1; i++)
+		buf[i] = s[i];
+	buf[i] = 0;
+}
+
+static bool spike_add(raw_log_t *log, uint64_t end_nsec, uint64_t latency_nsec)
+{
+	const uint64_t start_nsec = end_nsec > latency_nsec ? end_nsec - latency_nsec : 0;
+	spike_t *spike;
+
+	// A disk that is slow for a while makes a single spike and not one per IO
+	if (log->num_spikes > 0) {
+		spike = &log->spikes[log->num_spikes - 1];
+		if (start_nsec <= spike->end_nsec + CORRELATE_WINDOW_NSEC) {
+			if (end_nsec > spike->end_nsec)
+				spike->end_nsec = end_nsec;
+			if (latency_nsec > spike->max_latency_nsec)
+				spike->max_latency_nsec = latency_nsec;
+			return true;
+		}
+	}
+
+	if (log->num_spikes == log->spikes_size) {
+		unsigned new_size = log->spikes_size ? log->spikes_size * 2 : 64;
+		spike_t *new_spikes = realloc(log->spikes, new_size * sizeof(spike_t));
+		if (new_spikes == NULL)
+			return false;
+		log->spikes = new_spikes;
+		log->spikes_size = new_size;
+	}
+
+	spike = &log->spikes[log->num_spikes++];
+	spike->start_nsec = start_nsec;
+	spike->end_nsec = end_nsec;
+	spike->max_latency_nsec = latency_nsec;
+	spike->log = log - logs;
+	return true;
+}
+
+/* The log is read once, the spike threshold follows the median latency of the disk as it is read */
+static void correlate_file(raw_log_t *log)
+{
+	struct hdr_histogram *histogram = NULL;
+	uint64_t threshold = CORRELATE_MIN_SPIKE_NSEC;
+	char *line = NULL;
+	size_t line_size = 0;
+	bool in_raw = false;
+	FILE *f;
+
+	f = fopen(log->path, "r");
+	if (f == NULL) {
+		ERROR("Failed to open %s, errno=%d: %s", log->path, errno, strerror(errno));
+		return;
+	}
+	if (hdr_init(1, 60*1000*1000, 3, &histogram) != 0) {
+		ERROR("Failed to allocate a histogram for %s", log->path);
+		goto Exit;
+	}
+
+	while (getline(&line, &line_size, f) > 0) {
+		const char *s = line + strspn(line, " \t");
+		const char *wall;
+		uint64_t lba;
+		uint32_t len;
+		uint64_t latency_nsec;
+		uint64_t end_nsec;
+
+		if (!in_raw) {
+			if (strncmp(s, "\"Raw\": [", 8) == 0) {
+				in_raw = true;
+			} else if (strncmp(s, "\"Machine\": {", 12) == 0) {
+				json_str(s, "Mac", log->machine, sizeof(log->machine));
+			} else if (strncmp(s, "\"Topology\": {", 13) == 0) {
+				json_str(s, "Name", log->name, sizeof(log->name));
+				json_str(s, "Host", log->paths[PATH_HOST], sizeof(log->paths[PATH_HOST]));
+				json_str(s, "Expander", log->paths[PATH_EXPANDER], sizeof(log->paths[PATH_EXPANDER]));
+				json_str(s, "Enclosure", log->paths[PATH_ENCLOSURE], sizeof(log->paths[PATH_ENCLOSURE]));
+			} else {
+				sscanf(s, "\"Model\": \"%63[^\"]\"", log->model);
+				sscanf(s, "\"Serial\": \"%63[^\"]\"", log->serial);
+			}
+			continue;
+		}
+
+		if (sscanf(s, "{\"LBA\": %"SCNu64", \"Len\": %"SCNu32", \"LatencyNSec\": %"SCNu64, &lba, &len, &latency_nsec) != 3)
+			continue;
+		wall = strstr(s, "\"WallNSec\": ");
+		if (wall == NULL) {
+			ERROR("Raw log %s has no IO timestamps, it is from an older diskscan", log->path);
+			goto Exit;
+		}
+		end_nsec = strtoull(wall + 12, NULL, 10);
+
+		if (log->num_ios == 0)
+			log->first_nsec = end_nsec;
+		log->last_nsec = end_nsec;
+		log->num_ios++;
+
+		hdr_record_value(histogram, latency_nsec / 1000);
+		if (log->num_ios % CORRELATE_THRESHOLD_IOS == 0) {
+			threshold = hdr_value_at_percentile(histogram, 50.0) * 1000 * CORRELATE_SPIKE_FACTOR;
+			if (threshold < CORRELATE_MIN_SPIKE_NSEC)
+				threshold = CORRELATE_MIN_SPIKE_NSEC;
+		}
+
+		if (latency_nsec >= threshold && !spike_add(log, end_nsec, latency_nsec)) {
+			ERROR("Failed to allocate memory for the spikes of %s", log->path);
+			goto Exit;
+		}
+	}
+
+	if (log->name[0] == 0)
+		snprintf(log->name, sizeof(log->name), "%s", log->serial);
+	log->valid = log->num_ios > 0;
+	VERBOSE("Raw log %s of %s has %"PRIu64" IOs and %u spikes", log->path, log->name, log->num_ios, log->num_spikes);
+
+Exit:
+	free(histogram);
+	free(line);
+	fclose(f);
+}
+
+static void *correlate_thread(void *UNUSED(arg))
+{
+	while (1) {
+		raw_log_t *log = NULL;
+
+		pthread_mutex_lock(&log_lock);
+		if (log_next < num_logs)
+			log = &logs[log_next++];
+		pthread_mutex_unlock(&log_lock);
+		if (log == NULL)
+			break;
+
+		correlate_file(log);
+	}
+
+	return NULL;
+}
+
+static int spike_cmp(const void *a, const void *b)
+{
+	const spike_t *sa = a;
+	const spike_t *sb = b;
+
+	if (sa->start_nsec < sb->start_nsec)
+		return -1;
+	if (sa->start_nsec > sb->start_nsec)
+		return 1;
+	return 0;
+}
+
+/* Expanders are named by the host they are on, the same name on another host is another expander */
+static bool same_path(raw_log_t *a, raw_log_t *b, enum path_type type)
+{
+	return a->paths[type][0] && strcmp(a->machine, b->machine) == 0 && strcmp(a->paths[type], b->paths[type]) == 0 &&
+		(type != PATH_EXPANDER || strcmp(a->paths[PATH_HOST], b->paths[PATH_HOST]) == 0);
+}
+
+static void time_str(uint64_t nsec, char *buf, int buf_len)
+{
+	time_t t = nsec / 1000000000ULL;
+	struct tm tm;
+	char sec[32];
+
+	if (gmtime_r(&t, &tm) == NULL || strftime(sec, sizeof(sec), "%Y-%m-%d %H:%M:%S", &tm) == 0)
+		snprintf(sec, sizeof(sec), "%"PRIu64, (uint64_t)t);
+	snprintf(buf, buf_len, "%s.%03u", sec, (unsigned)(nsec / 1000000 % 1000));
+}
+
+/* The spiked disks of an event are blamed on the path that most of them share, a tie goes to the narrower path.
+ * Returns false if no two of them share a path.
+ */
+static bool event_report(int event, spike_t *spikes, unsigned num_spikes, uint64_t start_nsec, uint64_t end_nsec)
+{
+	raw_log_t *best_log = NULL;
+	enum path_type best_type = PATH_HOST;
+	unsigned best_spiked = 1;
+	unsigned num_active = 0;
+	char when[64];
+	unsigned i;
+	unsigned j;
+	int type;
+
+	for (i = 0; i < num_spikes; i++) {
+		raw_log_t *log = &logs[spikes[i].log];
+
+		for (type = 0; type < PATH_NUM; type++) {
+			unsigned spiked = 0;
+
+			for (j = 0; j < num_logs; j++) {
+				if (logs[j].last_event == event && same_path(log, &logs[j], type))
+					spiked++;
+			}
+			if (spiked > best_spiked) {
+				best_spiked = spiked;
+				best_log = log;
+				best_type = type;
+			}
+		}
+	}
+
+	if (best_log == NULL)
+		return false;
+
+	// Disks on the path that were scanned at the time and did not spike make the path less likely
+	for (j = 0; j < num_logs; j++) {
+		if (logs[j].valid && same_path(best_log, &logs[j], best_type) &&
+				logs[j].first_nsec <= start_nsec && logs[j].last_nsec >= start_nsec)
+			num_active++;
+	}
+
+	time_str(start_nsec, when, sizeof(when));
+	printf("%s %8"PRIu64" msec  %-9s %-16s %-6s %3u/%-3u ", when, (end_nsec - start_nsec) / 1000000,
+			path_type_names[best_type], best_log->paths[best_type],
+			best_type == PATH_HOST ? "" : best_log->paths[PATH_HOST], best_spiked, num_active);
+	for (j = 0; j < num_logs; j++) {
+		if (logs[j].last_event == event && same_path(best_log, &logs[j], best_type))
+			printf(" %s", logs[j].name);
+	}
+	printf("\n");
+	return true;
+}
+
+static int correlate_spikes(void)
+{
+	spike_t *spikes;
+	unsigned num_spikes = 0;
+	unsigned num_events = 0;
+	unsigned num_unshared = 0;
+	unsigned i;
+	unsigned j;
+
+	for (i = 0; i < num_logs; i++)
+		num_spikes += logs[i].num_spikes;
+
+	spikes = malloc((num_spikes + 1) * sizeof(spike_t));
+	if (spikes == NULL) {
+		ERROR("Failed to allocate memory for %u spikes", num_spikes);
+		return 1;
+	}
+	num_spikes = 0;
+	for (i = 0; i < num_logs; i++) {
+		memcpy(&spikes[num_spikes], logs[i].spikes, logs[i].num_spikes * sizeof(spike_t));
+		num_spikes += logs[i].num_spikes;
+		logs[i].last_event = -1;
+	}
+	qsort(spikes, num_spikes, sizeof(spike_t), spike_cmp);
+
+	printf("\nShared path events:\n");
+	printf("%-23s %13s  %-9s %-16s %-6s %7s  %s\n", "Time (UTC)", "Duration", "Path", "", "Host", "Spiked", "Disks");
+
+	// Sweep the spikes in time order, an event is the spikes that overlap with some slack
+	for (i = 0; i < num_spikes; i = j) {
+		uint64_t end_nsec = spikes[i].end_nsec;
+		unsigned num_disks = 0;
+
+		for (j = i; j < num_spikes && spikes[j].start_nsec <= end_nsec + CORRELATE_WINDOW_NSEC; j++) {
+			if (spikes[j].end_nsec > end_nsec)
+				end_nsec = spikes[j].end_nsec;
+			if (logs[spikes[j].log].last_event != (int)i) {
+				logs[spikes[j].log].last_event = i;
+				num_disks++;
+			}
+		}
+
+		if (num_disks < 2)
+			continue;
+		if (event_report(i, &spikes[i], j - i, spikes[i].start_nsec, end_nsec))
+			num_events++;
+		else
+			num_unshared++;
+	}
+
+	if (num_events == 0)
+		printf("None\n");
+	printf("\n%u spikes, %u shared path events, %u coincident spikes on disks that share no path\n",
+			num_spikes, num_events, num_unshared);
+
+	free(spikes);
+	return 0;
+}
+
+int diskscan_correlate(char **paths, unsigned num_paths, unsigned num_threads)
+{
+	pthread_t threads[CORRELATE_MAX_THREADS];
+	unsigned num_valid = 0;
+	int ret;
+	unsigned i;
+
+	logs = calloc(num_paths, sizeof(raw_log_t));
+	if (logs == NULL) {
+		ERROR("Failed to allocate memory for %u raw logs", num_paths);
+		return 1;
+	}
+	num_logs = num_paths;
+	for (i = 0; i < num_logs; i++)
+		logs[i].path = paths[i];
+
+	if (num_threads > CORRELATE_MAX_THREADS)
+		num_threads = CORRELATE_MAX_THREADS;
+	if (num_threads > num_logs)
+		num_threads = num_logs;
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, correlate_thread, NULL) != 0) {
+			ERROR("Failed to start a correlation thread, errno=%d: %s", errno, strerror(errno));
+			break;
+		}
+	}
+	num_threads = i;
+	// Read here as well, this also covers the case no thread could be started
+	correlate_thread(NULL);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < num_logs; i++) {
+		if (logs[i].valid)
+			num_valid++;
+		else
+			logs[i].num_spikes = 0;
+	}
+	printf("Correlated %u raw logs, %u skipped\n", num_valid, num_logs - num_valid);
+
+	ret = correlate_spikes();
+
+	for (i = 0; i < num_logs; i++)
+		free(logs[i].spikes);
+	free(logs);
+	return ret;
+}
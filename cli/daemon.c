@@ -0,0 +1,618 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cli.h"
+#include "diskscan.h"
+#include "topology.h"
+#include "verbose.h"
+#include "compiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define DAEMON_MAX_DISKS 256
+#define DAEMON_RETRY_SEC (15*60) /* Wait before retrying a disk that was in standby or failed to scan */
+#define DAEMON_STANDBY_LAG 0.1 /* A disk in standby is spun up once it is this fraction of the disk behind its schedule */
+
+enum daemon_group_e {
+	GROUP_HOST,
+	GROUP_EXPANDER,
+	GROUP_ENCLOSURE,
+	GROUP_NUM,
+};
+
+typedef struct daemon_limit_t {
+	int max_scans;              /* Concurrent scans in the group, 0 for no limit */
+	uint64_t max_bytes_per_sec; /* Bandwidth shared by the scans in the group, 0 for no limit */
+} daemon_limit_t;
+
+/* Where the disk is in its verification pass, persisted across restarts */
+typedef struct scan_cursor_t {
+	uint64_t offset_bytes;  /* Start of the next slice to scan in this pass */
+	time_t pass_start;      /* When this pass started, the pass should complete within the period */
+	time_t last_full_pass;  /* When the last pass completed, 0 if never */
+	unsigned num_passes;
+} scan_cursor_t;
+
+typedef struct daemon_disk_t {
+	disk_topology_t topo;
+	scan_cursor_t cursor;
+	bool present;
+	bool active;
+	bool opened;   /* The scan thread opened the disk, its bandwidth can be updated */
+	bool done;     /* The scan thread finished, it can be joined */
+	bool force_spinup; /* The disk is too far behind to wait for it to leave standby */
+	const char *spinup_lock;
+	int result;
+	time_t retry_after;
+	uint64_t slice_end_bytes;
+	pthread_t thread;
+	disk_t disk;
+} daemon_disk_t;
+
+typedef struct daemon_options_t {
+	const char *state_dir;
+	int verbose;
+	unsigned period_days;
+	uint64_t slice_bytes;
+	unsigned interval_sec;
+	daemon_limit_t limits[GROUP_NUM];
+	char spinup_lock[PATH_MAX]; /* Disks that are forced out of standby spin up one at a time */
+} daemon_options_t;
+
+static daemon_disk_t disks[DAEMON_MAX_DISKS];
+static unsigned num_disks;
+static pthread_mutex_t disks_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t daemon_run = 1;
+
+static const char *group_to_str(enum daemon_group_e group)
+{
+	switch (group) {
+		case GROUP_HOST: return "host";
+		case GROUP_EXPANDER: return "expander";
+		case GROUP_ENCLOSURE: return "enclosure";
+		case GROUP_NUM: break;
+	}
+
+	return "unknown";
+}
+
+static const char *disk_group(daemon_disk_t *d, enum daemon_group_e group)
+{
+	switch (group) {
+		case GROUP_HOST: return d->topo.host;
+		case GROUP_EXPANDER: return d->topo.expander;
+		case GROUP_ENCLOSURE: return d->topo.enclosure;
+		case GROUP_NUM: break;
+	}
+
+	return "";
+}
+
+static int daemon_usage(void)
+{
+	printf("diskscan version %s\n\n", VERSION);
+	printf("diskscan daemon [options] <state dir>\n");
+	printf("Options:\n");
+	printf("    -v, --verbose             - Increase verbosity, multiple uses for higher levels\n");
+	printf("    --period <days>           - Fully verify every disk once in this period (default 30)\n");
+	printf("    --slice <GB>              - Amount of a disk to scan in one go (default 16)\n");
+	printf("    --interval <sec>          - Time between looks for new or removed disks (default 300)\n");
+	printf("    --host-scans <num>        - Concurrent scans on a single HBA (default 4, 0 for no limit)\n");
+	printf("    --expander-scans <num>    - Concurrent scans behind a single expander (default 4, 0 for no limit)\n");
+	printf("    --enclosure-scans <num>   - Concurrent scans in a single enclosure (default 0, no limit)\n");
+	printf("    --host-bw <MB/s>          - Bandwidth of all the scans on a single HBA (default 0, no limit)\n");
+	printf("    --expander-bw <MB/s>      - Bandwidth of all the scans behind a single expander (default 0, no limit)\n");
+	printf("    --enclosure-bw <MB/s>     - Bandwidth of all the scans in a single enclosure (default 0, no limit)\n");
+	printf("\n");
+	return 1;
+}
+
+static bool str_to_uint(const char *str, unsigned *val)
+{
+	char *endptr;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(str, &endptr, 0);
+	if (errno != 0 || *endptr != 0 || endptr == str || v > UINT_MAX) {
+		ERROR("Failed to parse the value (%s) to a number", str);
+		return false;
+	}
+
+	*val = v;
+	return true;
+}
+
+static int daemon_parse_args(int argc, char **argv, daemon_options_t *opts)
+{
+	int c;
+	int unknown = 0;
+	unsigned val;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"verbose",        no_argument,       0, 'v'},
+			{"period",         required_argument, 0, 'p'},
+			{"slice",          required_argument, 0, 's'},
+			{"interval",       required_argument, 0, 'i'},
+			{"host-scans",     required_argument, 0, 'H'},
+			{"expander-scans", required_argument, 0, 'X'},
+			{"enclosure-scans",required_argument, 0, 'E'},
+			{"host-bw",        required_argument, 0, 'h'},
+			{"expander-bw",    required_argument, 0, 'x'},
+			{"enclosure-bw",   required_argument, 0, 'e'},
+			{0,                0,                 0,  0}
+		};
+
+		c = getopt_long(argc, argv, "v", long_options, &option_index);
+		if (c == -1)
+			break;
+
+		if (c != 'v' && c != '?' && !str_to_uint(optarg, &val))
+			return daemon_usage();
+
+		switch (c) {
+			case 'v': opts->verbose++; break;
+			case 'p': opts->period_days = val; break;
+			case 's': opts->slice_bytes = (uint64_t)val * 1024*1024*1024; break;
+			case 'i': opts->interval_sec = val; break;
+			case 'H': opts->limits[GROUP_HOST].max_scans = val; break;
+			case 'X': opts->limits[GROUP_EXPANDER].max_scans = val; break;
+			case 'E': opts->limits[GROUP_ENCLOSURE].max_scans = val; break;
+			case 'h': opts->limits[GROUP_HOST].max_bytes_per_sec = (uint64_t)val * 1024*1024; break;
+			case 'x': opts->limits[GROUP_EXPANDER].max_bytes_per_sec = (uint64_t)val * 1024*1024; break;
+			case 'e': opts->limits[GROUP_ENCLOSURE].max_bytes_per_sec = (uint64_t)val * 1024*1024; break;
+			default: unknown = 1; break;
+		}
+	}
+
+	if (unknown) {
+		printf("Unknown option provided\n");
+		return daemon_usage();
+	}
+
+	if (optind != argc - 1) {
+		printf("A single state directory must be given\n");
+		return daemon_usage();
+	}
+
+	if (opts->period_days == 0 || opts->slice_bytes == 0 || opts->interval_sec == 0) {
+		printf("Period, slice and interval must be positive numbers\n");
+		return daemon_usage();
+	}
+
+	opts->state_dir = argv[optind];
+	return 0;
+}
+
+static void cursor_path(const daemon_options_t *opts, daemon_disk_t *d, char *path, int path_len)
+{
+	char name[sizeof(d->topo.wwid)];
+	unsigned i;
+
+	// The wwid may have spaces and other characters that are awkward in a file name
+	for (i = 0; d->topo.wwid[i] && i < sizeof(name) - 1; i++)
+		name[i] = isalnum((unsigned char)d->topo.wwid[i]) || d->topo.wwid[i] == '.' ? d->topo.wwid[i] : '_';
+	name[i] = 0;
+
+	snprintf(path, path_len, "%s/%s.cursor", opts->state_dir, name);
+}
+
+static void cursor_load(const daemon_options_t *opts, daemon_disk_t *d)
+{
+	char path[PATH_MAX];
+	char key[32];
+	uint64_t val;
+	FILE *f;
+
+	memset(&d->cursor, 0, sizeof(d->cursor));
+	d->cursor.pass_start = time(NULL);
+
+	cursor_path(opts, d, path, sizeof(path));
+	f = fopen(path, "r");
+	if (f == NULL) {
+		INFO("Disk %s (%s) has no scan history, starting a new pass", d->topo.name, d->topo.wwid);
+		return;
+	}
+
+	while (fscanf(f, "%31s %"SCNu64, key, &val) == 2) {
+		if (strcmp(key, "offset") == 0)
+			d->cursor.offset_bytes = val;
+		else if (strcmp(key, "pass_start") == 0)
+			d->cursor.pass_start = val;
+		else if (strcmp(key, "last_full_pass") == 0)
+			d->cursor.last_full_pass = val;
+		else if (strcmp(key, "passes") == 0)
+			d->cursor.num_passes = val;
+	}
+	fclose(f);
+
+	INFO("Disk %s (%s) is at offset %"PRIu64" of its current pass, %u passes done", d->topo.name, d->topo.wwid,
+			d->cursor.offset_bytes, d->cursor.num_passes);
+}
+
+static void cursor_save(const daemon_options_t *opts, daemon_disk_t *d)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 8];
+	FILE *f;
+
+	cursor_path(opts, d, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	// Write to the side and rename so that a crash never leaves a truncated cursor
+	f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		ERROR("Failed to save scan cursor to %s, errno=%d: %s", tmp_path, errno, strerror(errno));
+		return;
+	}
+	fprintf(f, "offset %"PRIu64"\n", d->cursor.offset_bytes);
+	fprintf(f, "pass_start %"PRIu64"\n", (uint64_t)d->cursor.pass_start);
+	fprintf(f, "last_full_pass %"PRIu64"\n", (uint64_t)d->cursor.last_full_pass);
+	fprintf(f, "passes %u\n", d->cursor.num_passes);
+	if (fclose(f) != 0 || rename(tmp_path, path) != 0)
+		ERROR("Failed to save scan cursor to %s, errno=%d: %s", path, errno, strerror(errno));
+}
+
+static void daemon_discover(const daemon_options_t *opts)
+{
+	static disk_topology_t found[DAEMON_MAX_DISKS];
+	int num_found = topology_discover(found, DAEMON_MAX_DISKS);
+	unsigned i;
+	int j;
+
+	if (num_found < 0)
+		return;
+
+	for (i = 0; i < num_disks; i++)
+		disks[i].present = false;
+
+	for (j = 0; j < num_found; j++) {
+		daemon_disk_t *d = NULL;
+
+		for (i = 0; i < num_disks; i++) {
+			if (strcmp(disks[i].topo.wwid, found[j].wwid) == 0) {
+				d = &disks[i];
+				break;
+			}
+		}
+
+		if (d == NULL) {
+			if (num_disks == DAEMON_MAX_DISKS) {
+				ERROR("Too many disks, not scanning %s", found[j].name);
+				continue;
+			}
+			d = &disks[num_disks++];
+			memset(d, 0, sizeof(*d));
+			d->topo = found[j];
+			cursor_load(opts, d);
+		} else if (!d->active) {
+			// The disk may have been moved or renamed, the cursor stays with its wwid
+			d->topo = found[j];
+		}
+		d->present = true;
+	}
+}
+
+static unsigned group_active_scans(daemon_disk_t *d, enum daemon_group_e group)
+{
+	const char *name = disk_group(d, group);
+	unsigned i;
+	unsigned count = 0;
+
+	for (i = 0; i < num_disks; i++) {
+		if (disks[i].active && strcmp(disk_group(&disks[i], group), name) == 0)
+			count++;
+	}
+
+	return count;
+}
+
+static bool group_has_room(const daemon_options_t *opts, daemon_disk_t *d)
+{
+	int group;
+
+	for (group = 0; group < GROUP_NUM; group++) {
+		const int max_scans = opts->limits[group].max_scans;
+
+		if (max_scans == 0 || disk_group(d, group)[0] == 0)
+			continue;
+		if (group_active_scans(d, group) >= (unsigned)max_scans) {
+			VVERBOSE("Disk %s waits for a scan slot on %s %s", d->topo.name, group_to_str(group), disk_group(d, group));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* The bandwidth of each group is shared evenly by its active scans, a scan gets the smallest share of all its groups */
+static void daemon_bandwidth_update(const daemon_options_t *opts)
+{
+	unsigned i;
+	int group;
+
+	for (i = 0; i < num_disks; i++) {
+		daemon_disk_t *d = &disks[i];
+		uint64_t bw = 0;
+
+		if (!d->active || !d->opened)
+			continue;
+
+		for (group = 0; group < GROUP_NUM; group++) {
+			const uint64_t max_bw = opts->limits[group].max_bytes_per_sec;
+			uint64_t share;
+
+			if (max_bw == 0 || disk_group(d, group)[0] == 0)
+				continue;
+			share = max_bw / group_active_scans(d, group);
+			if (bw == 0 || share < bw)
+				bw = share;
+		}
+
+		d->disk.max_bytes_per_sec = bw;
+	}
+}
+
+/* How far behind its schedule the disk is, as a fraction of the disk. Positive means it needs scanning */
+static double disk_deficit(const daemon_options_t *opts, daemon_disk_t *d, time_t now)
+{
+	const double period_sec = opts->period_days * 24.0 * 3600.0;
+	double expected;
+
+	if (now < d->cursor.pass_start || d->topo.num_bytes == 0)
+		return 0.0;
+
+	expected = (now - d->cursor.pass_start) / period_sec;
+	if (expected > 1.0)
+		expected = 1.0;
+
+	// Always allow to at least start the slice that is due
+	return expected - (double)d->cursor.offset_bytes / d->topo.num_bytes + (double)opts->slice_bytes / d->topo.num_bytes;
+}
+
+/* A disk that stays in standby would never be verified, it may only wait while it can still complete the pass in the
+ * period. A disk in standby falls behind by a day every day, so it is deferred for at most a tenth of the period.
+ */
+static bool disk_standby_overdue(const daemon_options_t *opts, daemon_disk_t *d, time_t now)
+{
+	const time_t pass_end = d->cursor.pass_start + opts->period_days * 24 * 3600;
+
+	if (now >= pass_end)
+		return true;
+	return disk_deficit(opts, d, now) - (double)opts->slice_bytes / d->topo.num_bytes > DAEMON_STANDBY_LAG;
+}
+
+static void *daemon_scan_thread(void *arg)
+{
+	daemon_disk_t *d = arg;
+	disk_t *disk = &d->disk;
+
+	d->result = 1;
+	if (disk_open(disk, d->topo.dev_path, 0, LATENCY_GRAPH_LEN, DISK_NOT_MOUNTED) == 0) {
+		disk->defer_standby = !d->force_spinup;
+		disk->spinup_lock = d->spinup_lock;
+		if (d->force_spinup && disk->power_state == DISK_POWER_STANDBY)
+			INFO("Disk %s is too far behind its schedule to stay in standby, forcing a spin-up", d->topo.name);
+		disk->scan_start_bytes = d->cursor.offset_bytes;
+		disk->scan_end_bytes = d->slice_end_bytes < disk->num_bytes ? d->slice_end_bytes : disk->num_bytes;
+
+		pthread_mutex_lock(&disks_lock);
+		d->opened = true;
+		pthread_mutex_unlock(&disks_lock);
+
+		// The daemon may have been stopped while the disk was opened
+		if (daemon_run)
+			d->result = disk_scan(disk, SCAN_MODE_SEQ, 64*1024);
+
+		pthread_mutex_lock(&disks_lock);
+		d->opened = false;
+		pthread_mutex_unlock(&disks_lock);
+
+		disk_close(disk);
+	}
+
+	pthread_mutex_lock(&disks_lock);
+	d->done = true;
+	pthread_mutex_unlock(&disks_lock);
+	return NULL;
+}
+
+static void daemon_scan_start(const daemon_options_t *opts, daemon_disk_t *d, time_t now)
+{
+	d->slice_end_bytes = d->cursor.offset_bytes + opts->slice_bytes;
+	d->active = true;
+	d->done = false;
+	d->opened = false;
+	d->force_spinup = disk_standby_overdue(opts, d, now);
+	d->spinup_lock = opts->spinup_lock;
+
+	INFO("Scanning disk %s (%s) from offset %"PRIu64" to %"PRIu64, d->topo.name, d->topo.wwid,
+			d->cursor.offset_bytes, d->slice_end_bytes);
+	if (pthread_create(&d->thread, NULL, daemon_scan_thread, d) != 0) {
+		ERROR("Failed to start scan thread for disk %s, errno=%d: %s", d->topo.name, errno, strerror(errno));
+		d->active = false;
+		d->retry_after = time(NULL) + DAEMON_RETRY_SEC;
+	}
+}
+
+static void daemon_scan_done(const daemon_options_t *opts, daemon_disk_t *d, time_t now)
+{
+	const enum conclusion conclusion = d->disk.conclusion;
+
+	pthread_join(d->thread, NULL);
+	d->active = false;
+
+	if (d->result != 0 || conclusion == CONCLUSION_SCAN_PROBLEM || conclusion == CONCLUSION_ABORTED) {
+		ERROR("Scan of disk %s did not complete, will retry later", d->topo.name);
+		d->retry_after = now + DAEMON_RETRY_SEC;
+		return;
+	}
+
+	if (conclusion == CONCLUSION_DEFERRED) {
+		INFO("Disk %s is in standby, will retry later", d->topo.name);
+		d->retry_after = now + DAEMON_RETRY_SEC;
+		return;
+	}
+
+	INFO("Scan of disk %s up to offset %"PRIu64" %s with %"PRIu64" errors", d->topo.name, d->slice_end_bytes,
+			conclusion_to_str(conclusion), d->disk.num_errors);
+
+	d->cursor.offset_bytes = d->slice_end_bytes;
+	if (d->cursor.offset_bytes >= d->topo.num_bytes) {
+		const time_t next_pass = d->cursor.pass_start + opts->period_days * 24 * 3600;
+
+		INFO("Disk %s completed a full pass", d->topo.name);
+		d->cursor.offset_bytes = 0;
+		d->cursor.last_full_pass = now;
+		d->cursor.num_passes++;
+		// Keep the cadence of the period, but a late pass does not make the next one start early
+		d->cursor.pass_start = next_pass > now ? next_pass : now;
+	}
+	cursor_save(opts, d);
+}
+
+static void daemon_schedule(const daemon_options_t *opts)
+{
+	const time_t now = time(NULL);
+	unsigned i;
+
+	pthread_mutex_lock(&disks_lock);
+
+	for (i = 0; i < num_disks; i++) {
+		if (disks[i].active && disks[i].done)
+			daemon_scan_done(opts, &disks[i], now);
+	}
+
+	// Start the disks that are the most behind their schedule first
+	while (daemon_run) {
+		daemon_disk_t *best = NULL;
+		double best_deficit = 0.0;
+
+		for (i = 0; i < num_disks; i++) {
+			daemon_disk_t *d = &disks[i];
+			double deficit;
+
+			if (!d->present || d->active || now < d->retry_after)
+				continue;
+			deficit = disk_deficit(opts, d, now);
+			if (deficit > best_deficit && group_has_room(opts, d)) {
+				best = d;
+				best_deficit = deficit;
+			}
+		}
+
+		if (best == NULL)
+			break;
+
+		daemon_scan_start(opts, best, now);
+		if (!best->active)
+			break;
+	}
+
+	daemon_bandwidth_update(opts);
+	pthread_mutex_unlock(&disks_lock);
+}
+
+static void daemon_stop(void)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&disks_lock);
+	for (i = 0; i < num_disks; i++) {
+		if (disks[i].active && disks[i].opened)
+			disk_scan_stop(&disks[i].disk);
+	}
+	pthread_mutex_unlock(&disks_lock);
+}
+
+static void daemon_signal(int UNUSED(signal))
+{
+	daemon_run = 0;
+}
+
+int diskscan_daemon(int argc, char **argv)
+{
+	daemon_options_t opts;
+	struct sigaction act = {
+		.sa_handler = daemon_signal,
+		.sa_flags = SA_RESTART,
+	};
+	time_t last_discover = 0;
+	unsigned i;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.period_days = 30;
+	opts.slice_bytes = 16ULL*1024*1024*1024;
+	opts.interval_sec = 300;
+	opts.limits[GROUP_HOST].max_scans = 4;
+	opts.limits[GROUP_EXPANDER].max_scans = 4;
+
+	if (daemon_parse_args(argc, argv, &opts))
+		return 1;
+	verbose = opts.verbose;
+
+	if (access(opts.state_dir, R_OK|W_OK|X_OK) != 0) {
+		ERROR("State directory %s is inaccessible, errno=%d: %s", opts.state_dir, errno, strerror(errno));
+		return 1;
+	}
+	snprintf(opts.spinup_lock, sizeof(opts.spinup_lock), "%s/spinup.lock", opts.state_dir);
+
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	INFO("diskscan daemon version %s, verifying every disk every %u days", VERSION, opts.period_days);
+	while (daemon_run) {
+		const time_t now = time(NULL);
+
+		if (now - last_discover >= (time_t)opts.interval_sec) {
+			pthread_mutex_lock(&disks_lock);
+			daemon_discover(&opts);
+			pthread_mutex_unlock(&disks_lock);
+			last_discover = now;
+		}
+
+		daemon_schedule(&opts);
+		sleep(1);
+	}
+
+	INFO("Stopping the daemon");
+	daemon_stop();
+	for (i = 0; i < num_disks; i++) {
+		if (disks[i].active) {
+			pthread_join(disks[i].thread, NULL);
+			disks[i].active = false;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,348 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cli.h"
+#include "diskscan.h"
+#include "topology.h"
+#include "verbose.h"
+#include "compiler.h"
+
+#include "libscsicmd/include/ata_smart.h"
+#include "libscsicmd/include/smartdb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define INVENTORY_MAX_DISKS 1024
+#define INVENTORY_THREADS 32 /* Disks are probed concurrently, the commands of one disk are still issued serially */
+
+/* What does not change while the disk stays attached, the power state and SMART are read on every inventory */
+typedef struct inventory_identity_t {
+	char vendor[64];
+	char model[64];
+	char fw_rev[64];
+	char serial[64];
+	bool is_ata;
+	uint64_t num_bytes;
+	uint64_t sector_size;
+} inventory_identity_t;
+
+typedef struct inventory_disk_t {
+	disk_topology_t topo;
+	bool from_cache; /* The identity was cached, the state of the disk was still read */
+	inventory_identity_t id;
+	char *device;  /* JSON of what the disk reported about itself, NULL if it could not be probed */
+} inventory_disk_t;
+
+static inventory_disk_t inv_disks[INVENTORY_MAX_DISKS];
+static unsigned inv_num_disks;
+static unsigned inv_next;
+static pthread_mutex_t inv_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *inv_cache_dir;
+
+static void inventory_cache_path(inventory_disk_t *inv, char *path, int path_len)
+{
+	char name[sizeof(inv->topo.wwid)];
+	unsigned i;
+
+	// The wwid may have spaces and other characters that are awkward in a file name
+	for (i = 0; inv->topo.wwid[i] && i < sizeof(name) - 1; i++)
+		name[i] = isalnum((unsigned char)inv->topo.wwid[i]) || inv->topo.wwid[i] == '.' ? inv->topo.wwid[i] : '_';
+	name[i] = 0;
+
+	snprintf(path, path_len, "%s/%s.inventory", inv_cache_dir, name);
+}
+
+/* A string value is the rest of its line, the identity strings may have spaces */
+static bool inventory_cache_str(FILE *f, const char *key, char *val, size_t val_len)
+{
+	char line[256];
+	const size_t key_len = strlen(key);
+
+	if (fgets(line, sizeof(line), f) == NULL || strncmp(line, key, key_len) != 0 || line[key_len] != ' ')
+		return false;
+	line[strcspn(line, "\n")] = 0;
+	snprintf(val, val_len, "%s", line + key_len + 1);
+	return true;
+}
+
+/* The cached identity is only good for the same attachment of the disk, the kernel gives a new diskseq when the disk
+ * is hot-plugged or its media changes. Without a diskseq there is no way to tell and the disk is always identified.
+ */
+static bool inventory_cache_load(inventory_disk_t *inv)
+{
+	char path[PATH_MAX];
+	inventory_identity_t id;
+	uint64_t diskseq;
+	int is_ata;
+	bool loaded = false;
+	FILE *f;
+
+	if (inv_cache_dir == NULL || inv->topo.diskseq == 0)
+		return false;
+
+	inventory_cache_path(inv, path, sizeof(path));
+	f = fopen(path, "r");
+	if (f == NULL)
+		return false;
+
+	if (fscanf(f, "diskseq %"SCNu64"\n", &diskseq) != 1 || diskseq != inv->topo.diskseq) {
+		VERBOSE("Inventory cache of %s is stale", inv->topo.name);
+		goto Exit;
+	}
+
+	// An entry of an older version does not parse and is replaced
+	memset(&id, 0, sizeof(id));
+	if (fscanf(f, "ata %d\n", &is_ata) != 1 ||
+			fscanf(f, "num_bytes %"SCNu64"\n", &id.num_bytes) != 1 ||
+			fscanf(f, "sector_size %"SCNu64"\n", &id.sector_size) != 1 ||
+			!inventory_cache_str(f, "vendor", id.vendor, sizeof(id.vendor)) ||
+			!inventory_cache_str(f, "model", id.model, sizeof(id.model)) ||
+			!inventory_cache_str(f, "fw_rev", id.fw_rev, sizeof(id.fw_rev)) ||
+			!inventory_cache_str(f, "serial", id.serial, sizeof(id.serial))) {
+		VERBOSE("Inventory cache of %s is not readable", inv->topo.name);
+		goto Exit;
+	}
+
+	id.is_ata = is_ata;
+	inv->id = id;
+	loaded = true;
+
+Exit:
+	fclose(f);
+	return loaded;
+}
+
+static void inventory_cache_save(inventory_disk_t *inv)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 8];
+	FILE *f;
+
+	if (inv_cache_dir == NULL || inv->topo.diskseq == 0)
+		return;
+
+	inventory_cache_path(inv, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	// Write to the side and rename so that a concurrent inventory never reads a truncated entry
+	f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		ERROR("Failed to save inventory cache to %s, errno=%d: %s", tmp_path, errno, strerror(errno));
+		return;
+	}
+	fprintf(f, "diskseq %"PRIu64"\n", inv->topo.diskseq);
+	fprintf(f, "ata %d\n", inv->id.is_ata);
+	fprintf(f, "num_bytes %"PRIu64"\n", inv->id.num_bytes);
+	fprintf(f, "sector_size %"PRIu64"\n", inv->id.sector_size);
+	fprintf(f, "vendor %s\n", inv->id.vendor);
+	fprintf(f, "model %s\n", inv->id.model);
+	fprintf(f, "fw_rev %s\n", inv->id.fw_rev);
+	fprintf(f, "serial %s\n", inv->id.serial);
+	if (fclose(f) != 0 || rename(tmp_path, path) != 0)
+		ERROR("Failed to save inventory cache to %s, errno=%d: %s", path, errno, strerror(errno));
+}
+
+static void inventory_smart_output(FILE *f, disk_dev_t *dev, const char *vendor, const char *model, const char *fw_rev)
+{
+	ata_smart_attr_t smart[MAX_SMART_ATTRS];
+	const smart_table_t *table = smart_table_for_disk(vendor, model, fw_rev);
+	const int trip = disk_smart_trip(dev);
+	const int smart_num = disk_smart_attributes(dev, smart, MAX_SMART_ATTRS);
+	int min_temp = -1;
+	int max_temp = -1;
+
+	fprintf(f, "{\"Tripped\": %s", trip < 0 ? "null" : trip ? "true" : "false");
+	if (smart_num > 0 && table != NULL) {
+		fprintf(f, ", \"Temperature\": %d", ata_smart_get_temperature(smart, smart_num, table, &min_temp, &max_temp));
+		fprintf(f, ", \"Reallocations\": %d", ata_smart_get_num_reallocations(smart, smart_num, table));
+		fprintf(f, ", \"PendingReallocations\": %d", ata_smart_get_num_pending_reallocations(smart, smart_num, table));
+		fprintf(f, ", \"CrcErrors\": %d", ata_smart_get_num_crc_errors(smart, smart_num, table));
+	}
+	fprintf(f, "}");
+}
+
+/* Issue the identify and capacity commands, the same that disk_open() uses without setting up for a scan */
+static bool inventory_identify(inventory_disk_t *inv, disk_dev_t *dev)
+{
+	inventory_identity_t *id = &inv->id;
+	unsigned char ata_buf[512];
+	unsigned ata_buf_len = 0;
+
+	if (disk_dev_read_cap(dev, &id->num_bytes, &id->sector_size) < 0) {
+		ERROR("Can't get the capacity of %s", inv->topo.dev_path);
+		return false;
+	}
+
+	if (disk_dev_identify(dev, id->vendor, id->model, id->fw_rev, id->serial, &id->is_ata, ata_buf, &ata_buf_len) < 0) {
+		ERROR("Can't identify %s", inv->topo.dev_path);
+		return false;
+	}
+
+	return true;
+}
+
+/* The identity may come from the cache, the power state and SMART are read every time as they change */
+static char *inventory_probe(inventory_disk_t *inv)
+{
+	const inventory_identity_t *id = &inv->id;
+	disk_dev_t dev;
+	disk_power_state_e power_state;
+	char *device = NULL;
+	size_t device_len;
+	FILE *f;
+
+	if (!disk_dev_open(&dev, inv->topo.dev_path)) {
+		ERROR("Failed to open %s, errno=%d: %s", inv->topo.dev_path, errno, strerror(errno));
+		return NULL;
+	}
+
+	inv->from_cache = inventory_cache_load(inv);
+	if (!inv->from_cache) {
+		VERBOSE("Identifying disk %s", inv->topo.name);
+		if (!inventory_identify(inv, &dev))
+			goto Exit;
+		inventory_cache_save(inv);
+	}
+
+	power_state = disk_power_state(&dev, id->is_ata);
+
+	f = open_memstream(&device, &device_len);
+	if (f == NULL)
+		goto Exit;
+
+	fprintf(f, "{\"Vendor\": \"%s\", \"Model\": \"%s\", \"FwRev\": \"%s\", \"Serial\": \"%s\", \"Ata\": %s, ",
+			id->vendor, id->model, id->fw_rev, id->serial, id->is_ata ? "true" : "false");
+	fprintf(f, "\"NumBytes\": %"PRIu64", \"SectorSize\": %"PRIu64", \"Power\": \"%s\", \"Smart\": ",
+			id->num_bytes, id->sector_size, power_state_to_str(power_state));
+	// Reading SMART data may spin up a disk in standby, the inventory should not wake up the disks
+	if (id->is_ata && power_state != DISK_POWER_STANDBY)
+		inventory_smart_output(f, &dev, id->vendor, id->model, id->fw_rev);
+	else
+		fprintf(f, "null");
+	fprintf(f, "}");
+
+	if (fclose(f) != 0) {
+		free(device);
+		device = NULL;
+	}
+
+Exit:
+	disk_dev_close(&dev);
+	return device;
+}
+
+static void *inventory_thread(void *UNUSED(arg))
+{
+	while (1) {
+		inventory_disk_t *inv;
+
+		pthread_mutex_lock(&inv_lock);
+		inv = inv_next < inv_num_disks ? &inv_disks[inv_next++] : NULL;
+		pthread_mutex_unlock(&inv_lock);
+		if (inv == NULL)
+			break;
+
+		VERBOSE("Probing disk %s", inv->topo.name);
+		inv->device = inventory_probe(inv);
+	}
+
+	return NULL;
+}
+
+static void inventory_output(FILE *f)
+{
+	unsigned i;
+
+	fprintf(f, "{\n");
+	fprintf(f, "    \"Disks\": [\n");
+	for (i = 0; i < inv_num_disks; i++) {
+		inventory_disk_t *inv = &inv_disks[i];
+
+		fprintf(f, "        {\"Name\": \"%s\", \"Path\": \"%s\", \"WWID\": \"%s\", \"Host\": \"%s\", \"Expander\": \"%s\", \"Enclosure\": \"%s\", ",
+				inv->topo.name, inv->topo.dev_path, inv->topo.wwid, inv->topo.host, inv->topo.expander, inv->topo.enclosure);
+		fprintf(f, "\"FromCache\": %s, \"Device\": %s}%s\n", inv->from_cache ? "true" : "false",
+				inv->device ? inv->device : "null", i < inv_num_disks - 1 ? "," : "");
+	}
+	fprintf(f, "    ]\n");
+	fprintf(f, "}\n");
+}
+
+int diskscan_inventory(const char *output, const char *cache_dir)
+{
+	static disk_topology_t found[INVENTORY_MAX_DISKS];
+	pthread_t threads[INVENTORY_THREADS];
+	unsigned num_threads;
+	unsigned i;
+	int num_found;
+	int ret = 0;
+	FILE *f = stdout;
+
+	inv_cache_dir = cache_dir;
+
+	num_found = topology_discover(found, INVENTORY_MAX_DISKS);
+	if (num_found < 0)
+		return 1;
+
+	inv_num_disks = num_found;
+	for (i = 0; i < inv_num_disks; i++)
+		inv_disks[i].topo = found[i];
+
+	num_threads = inv_num_disks < INVENTORY_THREADS ? inv_num_disks : INVENTORY_THREADS;
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, inventory_thread, NULL) != 0) {
+			ERROR("Failed to start an inventory thread, errno=%d: %s", errno, strerror(errno));
+			break;
+		}
+	}
+	num_threads = i;
+	// Probe here as well, this also covers the case no thread could be started
+	inventory_thread(NULL);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (output) {
+		f = fopen(output, "w");
+		if (f == NULL) {
+			ERROR("Failed to open inventory output %s, errno=%d: %s", output, errno, strerror(errno));
+			ret = 1;
+			goto Exit;
+		}
+	}
+
+	inventory_output(f);
+	if (output && fclose(f) != 0) {
+		ERROR("Failed to write inventory output %s, errno=%d: %s", output, errno, strerror(errno));
+		ret = 1;
+	}
+
+Exit:
+	for (i = 0; i < inv_num_disks; i++) {
+		free(inv_disks[i].device);
+		inv_disks[i].device = NULL;
+	}
+	return ret;
+}
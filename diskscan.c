@@ -20,7 +20,11 @@
 
 #include "cli.h"
 
+#include <string.h>
+
 int main(int argc, char **argv)
 {
+	if (argc > 1 && strcmp(argv[1], "daemon") == 0)
+		return diskscan_daemon(argc - 1, argv + 1);
 	return diskscan_cli(argc, argv);
 }
@@ -0,0 +1,52 @@
+#ifndef DISKSCAN_ANOMALY_H
+#define DISKSCAN_ANOMALY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Slow regions are found from the median latency of the buckets of the latency graph as each one finishes. A bucket
+ * is slow when its median is well above the buckets just before it, the local baseline follows the gradual change in
+ * speed from the outer to the inner tracks, or well above the median of all the buckets so far. Both baselines use
+ * the median and the median absolute deviation so that the slow buckets themselves do not move them.
+ */
+
+#define ANOMALY_WINDOW 8            /* Buckets in the local baseline */
+#define ANOMALY_BINS 256            /* Log scale bins of the bucket medians, 8 per power of two */
+#define ANOMALY_MAX_REGIONS 16
+
+typedef struct slow_region_t {
+	uint64_t start_sector;
+	uint64_t end_sector;
+	uint32_t median_usec;   /* Worst bucket median in the region */
+	uint32_t baseline_usec; /* Median latency the region was compared against */
+} slow_region_t;
+
+typedef struct anomaly_bucket_t {
+	uint64_t start_sector;
+	uint64_t end_sector;
+	uint32_t median_usec;
+} anomaly_bucket_t;
+
+typedef struct anomaly_t {
+	uint32_t window[ANOMALY_WINDOW]; /* Medians of the last buckets that were not slow */
+	unsigned window_len;
+	unsigned window_next;
+	uint32_t bins[ANOMALY_BINS];
+	uint32_t num_buckets;
+
+	/* The first buckets wait until there is a baseline to compare them with */
+	anomaly_bucket_t pending[ANOMALY_WINDOW];
+	unsigned num_pending;
+
+	bool in_region;
+	uint64_t region_end;
+	slow_region_t regions[ANOMALY_MAX_REGIONS];
+	unsigned num_regions; /* May be more than are kept */
+} anomaly_t;
+
+/* Account a finished bucket, O(1) */
+void anomaly_bucket(anomaly_t *a, uint64_t start_sector, uint64_t end_sector, uint32_t median_usec);
+/* The range is done, judge the buckets that still wait for a baseline */
+void anomaly_finish(anomaly_t *a);
+
+#endif
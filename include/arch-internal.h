@@ -0,0 +1 @@
+/root/repo/arch/arch-linux.h
\ No newline at end of file
@@ -23,10 +23,22 @@ typedef struct {
 		ERROR_FATAL,       /* A fatal error encountered, no reason to continue using disk */
 		ERROR_UNKNOWN,     /* An unknown error encountered, continue for a while unless it persists */
 	} error;
+	enum result_transport_e {
+		TRANSPORT_OK,         /* The command reached the device and it answered */
+		TRANSPORT_BUSY,       /* The host could not issue the command right now */
+		TRANSPORT_TIMEOUT,    /* The device did not answer in time, the command was aborted */
+		TRANSPORT_RESET,      /* The command was lost to a bus or device reset */
+		TRANSPORT_DISRUPTED,  /* The link to the device went down and may come back */
+		TRANSPORT_NO_CONNECT, /* The device is gone */
+		TRANSPORT_ERROR,      /* Any other failure of the host or the link */
+	} transport;
 
 	sense_info_t info;
 	unsigned char sense[256];
 	unsigned sense_len;
+
+	bool device_nsec_valid;  /* The kernel measured the time the device took for the command */
+	uint64_t device_nsec;
 } io_result_t;
 
 typedef enum {
@@ -51,6 +63,14 @@ int disk_dev_identify(disk_dev_t *dev, char *vendor, char *model, char *fw_rev,
 
 void mac_read(unsigned char *buf, int len);
 
+/** Find the NUMA node of the controller the disk is attached to.
+ * Returns -1 if it is unknown or the system is not NUMA.
+ */
+int disk_dev_numa_node(disk_dev_t *dev);
+
+/** Run the calling thread, and the threads it creates later, only on the CPUs of the NUMA node. */
+bool numa_node_bind(int node);
+
 #include "arch-internal.h"
 
 #endif
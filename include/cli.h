@@ -1,6 +1,13 @@
 #ifndef DISKSCAN_CLI
 #define DISKSCAN_CLI
 
+/* Columns of the latency graph of a scan, the history compares the scans of a disk zone by zone only when they match */
+#define LATENCY_GRAPH_LEN 70
+
 int diskscan_cli(int argc, char **argv);
+int diskscan_daemon(int argc, char **argv);
+int diskscan_inventory(const char *output, const char *cache_dir);
+int diskscan_analyze(int argc, char **argv);
+int diskscan_correlate(char **paths, unsigned num_paths, unsigned num_threads);
 
 #endif
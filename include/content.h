@@ -0,0 +1,70 @@
+#ifndef DISKSCAN_CONTENT_H
+#define DISKSCAN_CONTENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Ordered so that a granule holding several kinds of chunks is marked with the most significant one */
+typedef enum content_type_e {
+	CONTENT_UNREAD,  /* Not read or the read failed */
+	CONTENT_ZERO,
+	CONTENT_PATTERN, /* The same 64 bit word repeated, a fill pattern and not real data */
+	CONTENT_DATA,
+	CONTENT_TYPE_NUM,
+} content_type_e;
+
+#define CONTENT_GRANULE_BYTES (1024*1024)
+#define CONTENT_QUEUE_LEN 8
+
+typedef struct content_chunk_t {
+	uint64_t offset;
+	uint32_t len;
+	void *buf;
+} content_chunk_t;
+
+/* What the disk holds, classified from the data the scan reads anyway. The classification runs in its own thread,
+ * the scan hands over its buffer with the data and continues with a free one.
+ */
+typedef struct content_map_t {
+	bool enabled;
+	uint64_t num_granules;
+	uint8_t *map; /* 2 bits per granule */
+	uint64_t bytes[CONTENT_TYPE_NUM];
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	bool stop;
+	content_chunk_t queue[CONTENT_QUEUE_LEN];
+	unsigned queue_head;
+	unsigned queue_len;
+	void *free_bufs[CONTENT_QUEUE_LEN];
+	unsigned num_free;
+	unsigned buf_size;
+} content_map_t;
+
+/* Start the classifier for a scan of a disk of num_bytes with buffers of buf_size, the map of an earlier scan is
+ * cleared. Returns false if it could not be started, the scan then goes on without it.
+ */
+bool content_map_start(content_map_t *map, uint64_t num_bytes, unsigned buf_size);
+/* Queue the data read at offset for classification and return a buffer for the next read, waits if the classifier
+ * is behind. The buffer is mmap'ed like the one given.
+ */
+void *content_map_submit(content_map_t *map, uint64_t offset, uint32_t len, void *buf);
+/* Classify what is still queued and stop the classifier, the map is kept */
+void content_map_stop(content_map_t *map);
+void content_map_free(content_map_t *map);
+
+content_type_e content_map_get(const content_map_t *map, uint64_t granule);
+content_type_e content_classify(const void *buf, size_t len);
+const char *content_type_to_str(content_type_e type);
+/* Write the map as runs of granules of the same type, "z1200 d3 p1" is 1200 zero granules followed by 3 of data and
+ * one of a pattern. Unread granules are "u".
+ */
+void content_map_runs_output(FILE *f, const content_map_t *map);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef DISKSCAN_COST_H
+#define DISKSCAN_COST_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Where the time of the scan goes, to tell when diskscan and not the disk limits the scan */
+typedef enum cost_phase_e {
+	COST_DEVICE,       /* Waiting for the device in the SG_IO ioctl or read syscall */
+	COST_BUFFER_CLEAR, /* Clearing the buffer before the read */
+	COST_LOG,          /* Logs, flight recorder and reports, including waiting for the log lock */
+	COST_HISTOGRAM,    /* Recording the latency in the histograms and latency graph */
+	COST_PROGRESS,
+	COST_MONITOR,      /* SMART polling, without the temperature pause */
+	COST_TEMP_PAUSE,
+	COST_CONTENT,      /* Handing the data over to the content classifier, waiting for it when it falls behind */
+	COST_PHASE_NUM,
+} cost_phase_e;
+
+typedef struct scan_cost_t {
+	uint64_t ticks[COST_PHASE_NUM];
+	uint64_t num_ios;
+	double nsec_per_tick; /* Calibrated over the scan */
+	uint64_t wall_nsec;
+	uint64_t cpu_nsec;    /* User and system time of the process */
+} scan_cost_t;
+
+/* Cost counters of the scan running in this thread, NULL when the thread is not scanning */
+extern __thread scan_cost_t *cost_thread;
+
+const char *cost_phase_to_str(cost_phase_e phase);
+
+/* A cycle counter where there is a cheap one, the ticks are converted to time only for the report */
+static inline uint64_t cost_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline void cost_add(cost_phase_e phase, uint64_t start)
+{
+	if (cost_thread)
+		cost_thread->ticks[phase] += cost_ticks() - start;
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "arch.h"
 #include "libscsicmd/include/ata.h"
+#include "libscsicmd/include/parse_report_zones.h"
 
 /** Check if the disk had a smart trip, only relevant for ATA disks.
  *
@@ -15,4 +16,73 @@ int disk_smart_trip(disk_dev_t *dev);
  */
 int disk_smart_attributes(disk_dev_t *dev, ata_smart_attr_t *attrs, int max_attrs);
 
+typedef enum disk_power_state_e {
+	DISK_POWER_UNKNOWN,
+	DISK_POWER_ACTIVE,
+	DISK_POWER_IDLE,
+	DISK_POWER_STANDBY,
+} disk_power_state_e;
+
+/** Find the power condition of the disk without spinning it up.
+ *
+ * ATA disks are asked with CHECK POWER MODE, SCSI disks report their power condition in the REQUEST SENSE data.
+ */
+disk_power_state_e disk_power_state(disk_dev_t *dev, bool is_ata);
+
+typedef struct lba_extent_t {
+	uint64_t lba;
+	uint64_t num_blocks;
+	bool mapped;
+} lba_extent_t;
+
+/** Check if the disk uses logical block provisioning and can tell which blocks are mapped.
+ *
+ * Returns true if GET LBA STATUS can be used to find the unmapped blocks.
+ */
+bool disk_lbp_supported(disk_dev_t *dev);
+
+/** Read the provisioning status of the blocks starting at lba into the extents array.
+ * Returns -1 on error, number of extents on success.
+ */
+int disk_lba_status(disk_dev_t *dev, uint64_t lba, lba_extent_t *extents, int max_extents);
+
+typedef enum zoned_model_e {
+	ZONED_NONE,
+	ZONED_HOST_AWARE,
+	ZONED_HOST_MANAGED,
+	ZONED_DEVICE_MANAGED,
+} zoned_model_e;
+
+typedef struct zone_t {
+	uint64_t start_lba;
+	uint32_t num_blocks;
+	uint32_t wp_offset; /* Blocks written from the start of the zone */
+	uint8_t type;
+	uint8_t cond;
+} zone_t;
+
+/** Find out if the disk is a zoned block device and which model of zoning it uses. */
+zoned_model_e disk_zoned_model(disk_dev_t *dev);
+
+/** Read the zone descriptors starting with the zone that contains lba into the zones array.
+ * Returns -1 on error, number of zones on success.
+ */
+int disk_report_zones(disk_dev_t *dev, uint64_t lba, zone_t *zones, int max_zones);
+
+/** Parse the zone descriptors of a REPORT ZONES answer, used by disk_report_zones(). */
+int disk_report_zones_parse(unsigned char *buf, unsigned buf_len, zone_t *zones, int max_zones);
+
+typedef struct lba_range_t {
+	uint64_t start_lba;
+	uint64_t num_blocks;
+} lba_range_t;
+
+/** Read the concurrent positioning ranges of a multi-actuator disk, the ranges are sorted by their start lba.
+ * Returns -1 on error, number of ranges on success.
+ */
+int disk_concurrent_ranges(disk_dev_t *dev, lba_range_t *ranges, int max_ranges);
+
+/** Parse the concurrent positioning ranges VPD page, used by disk_concurrent_ranges(). */
+int disk_concurrent_ranges_parse(unsigned char *buf, unsigned buf_len, lba_range_t *ranges, int max_ranges);
+
 #endif
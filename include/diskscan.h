@@ -3,13 +3,27 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include "arch.h"
+#include "disk.h"
+#include "cost.h"
+#include "content.h"
+#include "heatmap.h"
+#include "anomaly.h"
+#include "events.h"
 
 #include "libscsicmd/include/ata.h"
 #include "hdrhistogram/src/hdr_histogram.h"
 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
 
+#define DISK_MAX_RANGES 8
+#define DISK_MAX_PASSES 16
+#define DISK_MAX_SUBSCRIPTIONS 4
+#define DISK_MAX_BAD_SECTORS 64
+
 enum scan_mode {
 	SCAN_MODE_UNKNOWN,
 	SCAN_MODE_SEQ,
@@ -19,11 +33,21 @@ enum scan_mode {
 enum conclusion {
 	CONCLUSION_SCAN_PROBLEM, /* Problem in the scan, no real conclusion */
 	CONCLUSION_ABORTED, /* Scan aborted by used */
+	CONCLUSION_DEFERRED, /* Disk is in standby and was not spun up for the scan */
 	CONCLUSION_PASSED,  /* Disk looks fine */
 	/* Disk looks bad, and the reason it failed the test */
 	CONCLUSION_FAILED_MAX_LATENCY,
 	CONCLUSION_FAILED_LATENCY_PERCENTILE,
 	CONCLUSION_FAILED_IO_ERRORS,
+	CONCLUSION_FAILED_SLOW_REGION, /* A part of the disk is much slower than the parts around it */
+	CONCLUSION_NUM,
+};
+
+enum burnin_result {
+	BURNIN_NOT_CONVERGED, /* All the passes were done and the metrics still change */
+	BURNIN_CONVERGED,     /* The last pass repeated the one before it, more passes would not tell more */
+	BURNIN_FAILED,        /* A pass failed the disk */
+	BURNIN_ABORTED,
 };
 
 typedef struct latency_t {
@@ -34,14 +58,68 @@ typedef struct latency_t {
 	uint32_t latency_median_msec;
 } latency_t;
 
+/* A part of the disk that can be scanned independently, on multi-actuator disks there is one per actuator */
+typedef struct disk_range_t {
+	uint64_t start_bytes;
+	uint64_t end_bytes;
+	struct hdr_histogram *histogram;
+	latency_t *latency_graph; /* Slice of the disk latency graph */
+	unsigned latency_graph_len;
+	uint64_t num_errors;
+} disk_range_t;
+
+/* Results of a single pass of a burn-in, the pass is compared with the pass of the same kind before it */
+typedef struct disk_pass_t {
+	bool write_verify;
+	enum conclusion conclusion;
+	uint64_t num_errors;
+	uint64_t wall_nsec;
+	struct hdr_histogram *device_histogram;
+	latency_t *latency_graph;
+	bool has_smart;
+	int temp;
+	int reallocs;
+	int pending_reallocs;
+	int crc_errors;
+} disk_pass_t;
+
+#define FLIGHT_RECORDER_LEN 256
+#define FLIGHT_RECORDER_SLOWEST 16
+
+/* Compact record of a single IO for the flight recorder */
+typedef struct io_record_t {
+	uint64_t lba;
+	uint64_t timestamp_nsec; /* Since the scan started */
+	uint64_t t_nsec;
+	uint32_t len;
+	uint8_t data;
+	uint8_t error;
+	uint8_t sense_len;
+	unsigned char sense[32];
+} io_record_t;
+
+/* Keeps the last IOs and the slowest IOs in memory, they are dumped to the data log on errors, on request and at the end */
+typedef struct flight_recorder_t {
+	struct timespec start;
+	io_record_t recent[FLIGHT_RECORDER_LEN]; /* Ring of the last IOs */
+	uint64_t num_recorded;
+	uint64_t last_dump; /* num_recorded at the last dump, IOs are dumped only once */
+	io_record_t slowest[FLIGHT_RECORDER_SLOWEST];
+	unsigned num_slowest;
+	unsigned fastest_slow; /* Index of the fastest IO in slowest, the next to be replaced */
+	volatile sig_atomic_t dump_requested;
+} flight_recorder_t;
+
 typedef struct data_log_raw_t {
 	FILE *f;
 	bool is_first;
+	int64_t wall_offset_nsec; /* CLOCK_REALTIME - CLOCK_MONOTONIC when the log started */
 } data_log_raw_t;
 
 typedef struct data_log_t {
 	FILE *f;
 	bool is_first;
+	int64_t wall_offset_nsec;
 } data_log_t;
 
 typedef struct ata_state_t {
@@ -76,35 +154,94 @@ typedef struct disk_t {
 	uint64_t sector_size;
 	int run;
 	int fix;
+	int numa_node; /* NUMA node of the disk controller, -1 if unknown */
+
+	disk_power_state_e power_state; /* Power state found when the disk was opened */
+	bool defer_standby;
+	const char *spinup_lock; /* Lock file shared by all the scans that should not spin up disks at the same time */
+	uint64_t spinup_nsec;
+
+	uint64_t scan_start_bytes; /* Part of the disk to scan, the whole disk if scan_end_bytes is 0 */
+	uint64_t scan_end_bytes;
+	uint64_t max_bytes_per_sec; /* Bandwidth limit of the scan, 0 for none. May be changed while scanning */
+
+	bool lbp_supported;
+	bool scan_unmapped;
+	uint64_t mapped_bytes;
+	uint64_t unmapped_bytes;
+
+	zoned_model_e zoned;
+	zone_t *zones;
+	unsigned num_zones;
+	uint64_t unwritten_bytes;
+	struct hdr_histogram *zone_histogram[ZONE_TYPE_NUM];
 
 	uint64_t num_errors;
-	struct hdr_histogram *histogram;
+	struct hdr_histogram *histogram;        /* End-to-end latency as seen by diskscan */
+	struct hdr_histogram *device_histogram; /* Latency of the device as measured by the kernel, the conclusion is based on it */
 	unsigned latency_graph_len;
 	latency_t *latency_graph;
 	enum conclusion conclusion;
+	slow_region_t slow_regions[ANOMALY_MAX_REGIONS];
+	unsigned num_slow_regions; /* May be more than are kept */
+	uint64_t bad_sectors[DISK_MAX_BAD_SECTORS]; /* Failing LBAs as reported by the disk */
+	unsigned num_bad_sectors;  /* May be more than are kept */
+
+	disk_range_t ranges[DISK_MAX_RANGES];
+	unsigned num_ranges;
+	pthread_mutex_t lock; /* Protects the logs, reports and monitoring when scanning ranges concurrently */
+
+	bool write_verify; /* Write a pattern and read it back instead of only reading, destroys the data */
+	disk_pass_t passes[DISK_MAX_PASSES];
+	unsigned num_passes;
+	enum burnin_result burnin;
+
+	content_map_t content_map; /* Set content_map.enabled before the scan to classify the data read */
+	heatmap_t heatmap;         /* Created with heatmap_create() before the scan to record the latency at a finer resolution */
+	scan_subscription_t *subscriptions[DISK_MAX_SUBSCRIPTIONS];
+	unsigned num_subscriptions;
 
 	data_log_raw_t data_raw;
 	data_log_t data_log;
+	flight_recorder_t flight_recorder;
+	scan_cost_t cost;
 } disk_t;
 
 int disk_open(disk_t *disk, const char *path, int fix, unsigned latency_graph_len, disk_mount_e allowed_mount);
 int disk_scan(disk_t *disk, enum scan_mode mode, unsigned data_size);
 int disk_close(disk_t *disk);
 void disk_scan_stop(disk_t *disk);
+/* Scan the disk up to max_passes times, alternating read and write-verify passes if write_verify is set. Stops early
+ * when a pass fails the disk or repeats the results of the pass of the same kind before it.
+ */
+int disk_burnin(disk_t *disk, enum scan_mode mode, unsigned data_size, unsigned max_passes, bool write_verify);
+/* Check that the disk may be written, it must not be mounted beyond allowed_mount */
+bool disk_write_allowed(disk_t *disk, disk_mount_e allowed_mount);
+const char *burnin_result_to_str(enum burnin_result result);
+/* Account the IOs of a raw log as a scan would have and reach a conclusion, nothing is reported.
+ * The disk is released with disk_replay_close().
+ */
+int disk_replay(disk_t *disk, const char *raw_log, unsigned latency_graph_len);
+void disk_replay_close(disk_t *disk);
+/* Ask to dump the flight recorder to the data log, safe to call from a signal handler */
+void disk_flight_recorder_dump(disk_t *disk);
 
 enum scan_mode str_to_scan_mode(const char *s);
 const char *conclusion_to_str(enum conclusion conclusion);
+const char *zone_type_to_str(zone_type_e type);
+const char *power_state_to_str(disk_power_state_e state);
 
-/* Implemented by the user (gui/cli) */
-void report_progress(disk_t *disk, int percent_part, int percent_full);
-void report_scan_success(disk_t *disk, uint64_t offset_bytes, uint64_t data_size, uint64_t time);
-void report_scan_error(disk_t *disk, uint64_t offset_bytes, uint64_t data_size, uint64_t time);
-void report_scan_done(disk_t *disk);
+/* Follow the scans of an open disk, see events.h. Not to be called while the disk is scanned, the subscriptions that
+ * are left are released by disk_close(). Returns NULL on error.
+ */
+scan_subscription_t *disk_subscribe(disk_t *disk, const scan_filter_t *filter, unsigned batch, scan_event_cb_t cb, void *ctx);
+void disk_unsubscribe(disk_t *disk, scan_subscription_t *sub);
 
 /* Used to log data to files */
 void data_log_raw_start(data_log_raw_t *log_raw, const char *filename, disk_t *disk);
 void data_log_raw_end(data_log_raw_t *log_raw);
 void data_log_start(data_log_t *log, const char *filename, disk_t *disk);
 void data_log_end(data_log_t *log, disk_t *disk);
+void data_log_flight_recorder(data_log_t *log, flight_recorder_t *fr, const char *reason);
 
 #endif
@@ -0,0 +1,44 @@
+#ifndef DISKSCAN_ERROR_POLICY_H
+#define DISKSCAN_ERROR_POLICY_H
+
+#include "arch.h"
+
+/* What the scan does with a failed IO is decided by a table keyed on the sense key, ASC and ASCQ of the sense, or on
+ * the transport status when the command failed without sense. The first entry that matches wins, a field of
+ * ERROR_POLICY_ANY matches every value.
+ */
+
+typedef enum error_action_e {
+	ERROR_ACTION_CONTINUE,      /* Account the IO as it completed, clean or recovered by the disk */
+	ERROR_ACTION_RETRY,         /* Transient, retry the same IO after a backoff */
+	ERROR_ACTION_RETRY_SMALLER, /* Retry with half the size, the size of the request may be the trigger */
+	ERROR_ACTION_SKIP,          /* Give up on the rest of the read, continue with the next one */
+	ERROR_ACTION_MEDIA,         /* A defect of the media, continue after the failing sector */
+	ERROR_ACTION_ABORT,         /* The device cannot be scanned any further */
+} error_action_e;
+
+#define ERROR_POLICY_ANY -1
+
+typedef struct error_policy_t {
+	int sense_key;
+	int asc;
+	int ascq;
+	enum result_transport_e transport;
+	enum result_error_e error;
+	error_action_e action;
+} error_policy_t;
+
+/* A transient error is retried this many times before it is taken as final */
+#define ERROR_POLICY_MAX_RETRIES 5
+/* The backoff doubles with each retry */
+#define ERROR_POLICY_BACKOFF_USEC 50000
+
+/* Never NULL, unknown sense falls back on the sense key */
+const error_policy_t *error_policy_sense(const sense_info_t *info);
+/* Never NULL, for a transport status other than TRANSPORT_OK */
+const error_policy_t *error_policy_transport(enum result_transport_e transport);
+/* The action for the result of an IO */
+error_action_e error_policy_action(const io_result_t *io_res);
+const char *error_action_to_str(error_action_e action);
+
+#endif
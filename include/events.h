@@ -0,0 +1,63 @@
+#ifndef DISKSCAN_EVENTS_H
+#define DISKSCAN_EVENTS_H
+
+#include "arch.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Users of the library follow a scan by subscribing to its events. The scan only queues the events that pass the
+ * filter of a subscription in its ring, a thread of the subscription delivers them to its callback in batches. The
+ * scan never waits for a subscriber, events that do not fit in a full ring are dropped and counted.
+ */
+
+typedef enum scan_event_type_e {
+	SCAN_EVENT_IO,       /* An IO of the scan completed */
+	SCAN_EVENT_PROGRESS, /* The scan progressed by a part */
+	SCAN_EVENT_DONE,     /* The scan ended, the results of the disk are final */
+	SCAN_EVENT_TYPE_NUM,
+} scan_event_type_e;
+
+#define SCAN_EVENT_MASK(type) (1U << (type))
+#define SCAN_EVENT_MASK_ALL (SCAN_EVENT_MASK(SCAN_EVENT_TYPE_NUM) - 1)
+
+typedef struct scan_event_t {
+	scan_event_type_e type;
+	/* SCAN_EVENT_IO */
+	uint64_t offset_bytes;
+	uint32_t data_size;
+	enum result_data_e data;
+	enum result_error_e error;
+	uint64_t latency_nsec;
+	/* SCAN_EVENT_PROGRESS */
+	int progress_part;
+	int progress_full;
+} scan_event_t;
+
+typedef struct scan_filter_t {
+	unsigned types;            /* SCAN_EVENT_MASK of the types to deliver */
+	/* With neither set all the IOs are delivered, otherwise an IO that matches either one */
+	bool io_errors;            /* IOs that failed or were recovered */
+	uint64_t io_min_latency_nsec; /* IOs that took at least this long, 0 to not filter on it */
+} scan_filter_t;
+
+/* Called from the thread of the subscription, never from the scan threads */
+typedef void (*scan_event_cb_t)(void *ctx, const scan_event_t *events, unsigned num_events);
+
+#define SCAN_EVENT_RING_LEN 4096 /* Must be a power of two */
+#define SCAN_EVENT_MAX_BATCH 256
+
+typedef struct scan_subscription_t scan_subscription_t;
+
+/* batch is the number of events to gather before a delivery, up to SCAN_EVENT_MAX_BATCH. Fewer are delivered when
+ * the scan is slow to produce them. Returns NULL on error.
+ */
+scan_subscription_t *scan_subscription_new(const scan_filter_t *filter, unsigned batch, scan_event_cb_t cb, void *ctx);
+/* Deliver what is still queued and release the subscription */
+void scan_subscription_free(scan_subscription_t *sub);
+void scan_subscription_publish(scan_subscription_t *sub, const scan_event_t *event);
+/* Wait until all the events queued so far were delivered */
+void scan_subscription_flush(scan_subscription_t *sub);
+uint64_t scan_subscription_dropped(scan_subscription_t *sub);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DISKSCAN_HEATMAP_H
+#define DISKSCAN_HEATMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* The heatmap is the latency of the disk at a fixed resolution, independent of the terminal graph. The file is a
+ * header followed by one record per bucket, in host byte order, and can be mmap'ed while the scan fills it. A record
+ * is written once all of its bucket was scanned, the DONE flag tells which are.
+ */
+
+#define HEATMAP_MAGIC "DSHEATM1"
+#define HEATMAP_VERSION 1
+#define HEATMAP_HEADER_SIZE 4096
+#define HEATMAP_MAX_BUCKETS (64*1024*1024)
+
+typedef struct heatmap_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size; /* Records start here */
+	uint32_t record_size;
+	uint32_t sector_size;
+	uint64_t bucket_bytes;
+	uint64_t num_buckets;
+	uint64_t disk_bytes;
+	int64_t start_time;   /* Unix time the file was created */
+	char vendor[64];
+	char model[64];
+	char serial[64];
+} heatmap_header_t;
+
+#define HEATMAP_RECORD_DONE 1
+
+typedef struct heatmap_record_t {
+	uint32_t flags;
+	uint32_t num_ios;
+	uint32_t num_errors;  /* IOs that failed */
+	uint32_t num_retries; /* IOs the disk completed only after recovering, corrected or retried */
+	uint32_t min_usec;
+	uint32_t median_usec;
+	uint32_t p99_usec;
+	uint32_t max_usec;
+} heatmap_record_t;
+
+typedef struct heatmap_t {
+	char path[256];
+	int fd;
+	size_t map_len;
+	heatmap_header_t *header;
+	heatmap_record_t *records; /* NULL when there is no heatmap */
+	pthread_mutex_t lock;
+} heatmap_t;
+
+/* Create the heatmap file of a disk, an existing file is replaced. Returns false on error. */
+bool heatmap_create(heatmap_t *hm, const char *path, uint64_t bucket_bytes, uint64_t disk_bytes, uint32_t sector_size,
+		const char *vendor, const char *model, const char *serial);
+/* Map an existing heatmap file read-only. Returns false on error. */
+bool heatmap_open(heatmap_t *hm, const char *path);
+void heatmap_close(heatmap_t *hm);
+
+/* Store the record of a completely scanned bucket. A bucket that was completed before, when it straddles two
+ * actuators, is merged with conservatively: the worse median and p99 are kept.
+ */
+void heatmap_bucket_done(heatmap_t *hm, uint64_t bucket, const heatmap_record_t *record);
+
+/* Parse a size with an optional K, M, G or T suffix. Returns 0 on error. */
+uint64_t heatmap_str_to_bytes(const char *str);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef DISKSCAN_HISTORY_H
+#define DISKSCAN_HISTORY_H
+
+#include "diskscan.h"
+
+#include <stdio.h>
+
+/* The scans of a disk are kept in <dir>/<model>_<serial>.history, one line per scan appended at its end.
+ * Degradation shows only when the same disk is compared over months, a single scan rarely fails on it.
+ */
+
+/** Path of the history file of the disk in the history directory */
+void history_path(const char *dir, disk_t *disk, char *path, int path_len);
+
+/** Append the results of the scan of the disk to its history.
+ * Returns 0 on success, -1 on error.
+ */
+int history_append(const char *dir, disk_t *disk);
+
+/** Compare the last scan in the history file against the first scan (the baseline) and the one before it, zone
+ * by zone of the latency graph. The report is written to f.
+ * Returns -1 on error, otherwise the number of zones and percentiles that drifted.
+ */
+int history_compare(const char *path, FILE *f);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DISKSCAN_PROBES_H
+#define DISKSCAN_PROBES_H
+
+/* USDT static probes to trace a running scan with bpftrace or perf, a probe is a single nop until a tracer attaches to it.
+ * List them with: bpftrace -l 'usdt:/usr/bin/diskscan:*'
+ * Probe names use a double underscore that tracers show as a dash, io__complete is io-complete.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(diskscan, name)
+#define PROBE1(name, a1) DTRACE_PROBE1(diskscan, name, a1)
+#define PROBE2(name, a1, a2) DTRACE_PROBE2(diskscan, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(diskscan, name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(diskscan, name, a1, a2, a3, a4)
+#define PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(diskscan, name, a1, a2, a3, a4, a5)
+#define PROBE6(name, a1, a2, a3, a4, a5, a6) DTRACE_PROBE6(diskscan, name, a1, a2, a3, a4, a5, a6)
+#else
+#define PROBE(name) do {} while (0)
+#define PROBE1(name, a1) do { (void)(a1); } while (0)
+#define PROBE2(name, a1, a2) do { (void)(a1); (void)(a2); } while (0)
+#define PROBE3(name, a1, a2, a3) do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#define PROBE4(name, a1, a2, a3, a4) do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while (0)
+#define PROBE5(name, a1, a2, a3, a4, a5) do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); } while (0)
+#define PROBE6(name, a1, a2, a3, a4, a5, a6) do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); (void)(a6); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef DISKSCAN_TOPOLOGY_H
+#define DISKSCAN_TOPOLOGY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Where a disk is connected, disks that share a host, expander or enclosure share its bandwidth */
+typedef struct disk_topology_t {
+	char name[32];       /* Kernel name, sda */
+	char dev_path[64];   /* /dev/sda */
+	char wwid[128];      /* Stable identifier of the disk, the kernel name may change between boots */
+	uint64_t num_bytes;
+	uint64_t diskseq;    /* Changes every time a disk is attached, 0 if the kernel doesn't tell */
+	char host[32];       /* SCSI host of the HBA, host0 */
+	char expander[32];   /* SAS expander closest to the HBA, empty for direct attached disks */
+	char enclosure[64];  /* Enclosure the disk slot is in, empty if unknown */
+} disk_topology_t;
+
+/** Discover the SCSI disks of the system and their topology from sysfs.
+ * Returns -1 on error, number of disks on success.
+ */
+int topology_discover(disk_topology_t *disks, int max_disks);
+
+/** Topology of the disk of a device path such as /dev/sda.
+ * Returns false if the path is not a SCSI disk known to sysfs.
+ */
+bool topology_for_path(const char *path, disk_topology_t *disk);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "anomaly.h"
+#include "verbose.h"
+
+#include <inttypes.h>
+
+/* A slow bucket is at least half again as slow as its baseline, more than ANOMALY_MAD_K scaled median absolute
+ * deviations above it and at least ANOMALY_MIN_EXCESS_USEC above it so that microsecond noise of fast disks is not
+ * taken for a slow region.
+ */
+#define ANOMALY_RATIO_PCT 150
+#define ANOMALY_MAD_K 3
+#define ANOMALY_MIN_EXCESS_USEC 250
+/* Scales the MAD to the standard deviation of normally distributed values, in thousandths */
+#define ANOMALY_MAD_SCALE 1483
+/* Fewest buckets for a baseline */
+#define ANOMALY_MIN_BASELINE 3
+
+static unsigned bin_of(uint32_t v)
+{
+	if (v < 8)
+		return v;
+
+	const unsigned log = 31 - __builtin_clz(v);
+	return (log - 2) * 8 + ((v >> (log - 3)) & 7);
+}
+
+/* Middle of the values that fall in the bin */
+static uint32_t bin_value(unsigned bin)
+{
+	if (bin < 8)
+		return bin;
+
+	const unsigned shift = bin / 8 - 1;
+	return ((8 + bin % 8) << shift) + (1U << shift) / 2;
+}
+
+static void global_baseline(anomaly_t *a, uint32_t *median, uint32_t *mad)
+{
+	const uint32_t half = (a->num_buckets + 1) / 2;
+	uint32_t count = 0;
+	int left, right;
+	unsigned bin;
+
+	for (bin = 0; bin < ANOMALY_BINS - 1 && count + a->bins[bin] < half; bin++)
+		count += a->bins[bin];
+	*median = bin_value(bin);
+
+	// Walk out of the median bin both ways, nearest deviation first, until half of the buckets are covered
+	count = 0;
+	*mad = 0;
+	left = bin;
+	right = bin + 1;
+	while (count < half && (left >= 0 || right < ANOMALY_BINS)) {
+		const uint32_t dev_left = left >= 0 ? *median - bin_value(left) : UINT32_MAX;
+		const uint32_t dev_right = right < ANOMALY_BINS ? bin_value(right) - *median : UINT32_MAX;
+
+		if (dev_left <= dev_right) {
+			count += a->bins[left--];
+			*mad = dev_left;
+		} else {
+			count += a->bins[right++];
+			*mad = dev_right;
+		}
+	}
+}
+
+static void window_baseline(anomaly_t *a, uint32_t *median, uint32_t *mad)
+{
+	uint32_t v[ANOMALY_WINDOW];
+	unsigned i, j;
+
+	for (i = 0; i < a->window_len; i++) {
+		const uint32_t x = a->window[i];
+		for (j = i; j > 0 && v[j-1] > x; j--)
+			v[j] = v[j-1];
+		v[j] = x;
+	}
+	*median = v[(a->window_len - 1) / 2];
+
+	for (i = 0; i < a->window_len; i++) {
+		const uint32_t x = a->window[i] > *median ? a->window[i] - *median : *median - a->window[i];
+		for (j = i; j > 0 && v[j-1] > x; j--)
+			v[j] = v[j-1];
+		v[j] = x;
+	}
+	*mad = v[(a->window_len - 1) / 2];
+}
+
+static bool is_excess(uint32_t value, uint32_t median, uint32_t mad)
+{
+	const uint64_t spread = (uint64_t)mad * ANOMALY_MAD_SCALE * ANOMALY_MAD_K / 1000;
+	const uint64_t min_excess = spread > ANOMALY_MIN_EXCESS_USEC ? spread : ANOMALY_MIN_EXCESS_USEC;
+
+	return (uint64_t)value * 100 >= (uint64_t)median * ANOMALY_RATIO_PCT && value >= median + min_excess;
+}
+
+static bool is_slow(anomaly_t *a, uint32_t median_usec, uint32_t *baseline_usec)
+{
+	uint32_t median, mad;
+
+	if (a->window_len >= ANOMALY_MIN_BASELINE) {
+		window_baseline(a, &median, &mad);
+		if (is_excess(median_usec, median, mad)) {
+			*baseline_usec = median;
+			return true;
+		}
+	}
+
+	if (a->num_buckets >= ANOMALY_WINDOW) {
+		global_baseline(a, &median, &mad);
+		if (is_excess(median_usec, median, mad)) {
+			*baseline_usec = median;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void region_add(anomaly_t *a, const anomaly_bucket_t *b, uint32_t baseline_usec)
+{
+	slow_region_t *r;
+
+	// Adjacent slow buckets are a single region
+	if (a->in_region && a->region_end == b->start_sector) {
+		a->region_end = b->end_sector;
+		if (a->num_regions > ANOMALY_MAX_REGIONS)
+			return;
+		r = &a->regions[a->num_regions - 1];
+		r->end_sector = b->end_sector;
+		if (b->median_usec > r->median_usec)
+			r->median_usec = b->median_usec;
+		return;
+	}
+
+	INFO("Slow region at sectors %"PRIu64"-%"PRIu64", median latency %u usec against %u usec around it",
+			b->start_sector, b->end_sector, b->median_usec, baseline_usec);
+	a->in_region = true;
+	a->region_end = b->end_sector;
+	if (a->num_regions++ >= ANOMALY_MAX_REGIONS)
+		return;
+	r = &a->regions[a->num_regions - 1];
+	r->start_sector = b->start_sector;
+	r->end_sector = b->end_sector;
+	r->median_usec = b->median_usec;
+	r->baseline_usec = baseline_usec;
+}
+
+static bool judge(anomaly_t *a, const anomaly_bucket_t *b)
+{
+	uint32_t baseline_usec;
+
+	if (is_slow(a, b->median_usec, &baseline_usec)) {
+		region_add(a, b, baseline_usec);
+		return true;
+	}
+
+	a->in_region = false;
+	return false;
+}
+
+static void window_push(anomaly_t *a, uint32_t median_usec)
+{
+	if (a->window_len < ANOMALY_WINDOW) {
+		a->window[a->window_len++] = median_usec;
+	} else {
+		a->window[a->window_next] = median_usec;
+		a->window_next = (a->window_next + 1) % ANOMALY_WINDOW;
+	}
+}
+
+static void judge_pending(anomaly_t *a)
+{
+	unsigned i;
+
+	for (i = 0; i < a->num_pending; i++)
+		judge(a, &a->pending[i]);
+	a->num_pending = 0;
+}
+
+void anomaly_bucket(anomaly_t *a, uint64_t start_sector, uint64_t end_sector, uint32_t median_usec)
+{
+	const anomaly_bucket_t b = {.start_sector = start_sector, .end_sector = end_sector, .median_usec = median_usec};
+
+	a->bins[bin_of(median_usec)]++;
+	a->num_buckets++;
+
+	// The first buckets are their own baseline, they are judged together once there are enough of them
+	if (a->window_len < ANOMALY_WINDOW) {
+		a->pending[a->num_pending++] = b;
+		window_push(a, median_usec);
+		if (a->window_len == ANOMALY_WINDOW)
+			judge_pending(a);
+		return;
+	}
+
+	// Slow buckets stay out of the local baseline, a long slow region is still compared with what came before it
+	if (!judge(a, &b))
+		window_push(a, median_usec);
+}
+
+void anomaly_finish(anomaly_t *a)
+{
+	if (a->window_len >= ANOMALY_MIN_BASELINE)
+		judge_pending(a);
+	a->num_pending = 0;
+	a->in_region = false;
+}
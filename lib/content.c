@@ -0,0 +1,235 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "content.h"
+#include "verbose.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+/* Generic vectors, the compiler maps them to AVX2, SSE or NEON as the target allows */
+typedef uint64_t content_vec_t __attribute__((vector_size(32)));
+
+/* Vectors compared between checks for a difference, data usually differs within the first of them */
+#define CONTENT_VEC_BATCH 4
+
+const char *content_type_to_str(content_type_e type)
+{
+	switch (type) {
+		case CONTENT_UNREAD: return "unread";
+		case CONTENT_ZERO: return "zero";
+		case CONTENT_PATTERN: return "pattern";
+		case CONTENT_DATA: return "data";
+		case CONTENT_TYPE_NUM: break;
+	}
+	return "unknown";
+}
+
+/* The buffer must be aligned to the vector size, scan buffers are page aligned */
+content_type_e content_classify(const void *buf, size_t len)
+{
+	const content_vec_t *vec = buf;
+	const uint64_t *word = buf;
+	const size_t num_vecs = len / sizeof(content_vec_t);
+	uint64_t first;
+	size_t i;
+
+	if (len < sizeof(uint64_t))
+		return CONTENT_UNREAD;
+
+	first = word[0];
+	const content_vec_t pattern = {first, first, first, first};
+
+	for (i = 0; i + CONTENT_VEC_BATCH <= num_vecs; i += CONTENT_VEC_BATCH) {
+		content_vec_t diff = (vec[i] ^ pattern) | (vec[i+1] ^ pattern) | (vec[i+2] ^ pattern) | (vec[i+3] ^ pattern);
+		if (diff[0] | diff[1] | diff[2] | diff[3])
+			return CONTENT_DATA;
+	}
+
+	for (i = i * sizeof(content_vec_t) / sizeof(uint64_t); i < len / sizeof(uint64_t); i++) {
+		if (word[i] != first)
+			return CONTENT_DATA;
+	}
+
+	return first == 0 ? CONTENT_ZERO : CONTENT_PATTERN;
+}
+
+content_type_e content_map_get(const content_map_t *map, uint64_t granule)
+{
+	return (map->map[granule / 4] >> (granule % 4 * 2)) & 3;
+}
+
+static void content_map_mark(content_map_t *map, uint64_t offset, uint32_t len, content_type_e type)
+{
+	uint64_t granule;
+	uint64_t last = (offset + len - 1) / CONTENT_GRANULE_BYTES;
+
+	if (last >= map->num_granules)
+		last = map->num_granules - 1;
+
+	map->bytes[type] += len;
+	for (granule = offset / CONTENT_GRANULE_BYTES; granule <= last; granule++) {
+		if (content_map_get(map, granule) < type) {
+			map->map[granule / 4] &= ~(3 << (granule % 4 * 2));
+			map->map[granule / 4] |= type << (granule % 4 * 2);
+		}
+	}
+}
+
+static void *content_map_thread(void *arg)
+{
+	content_map_t *map = arg;
+
+	pthread_mutex_lock(&map->lock);
+	while (1) {
+		while (map->queue_len == 0 && !map->stop)
+			pthread_cond_wait(&map->cond, &map->lock);
+		if (map->queue_len == 0)
+			break;
+
+		content_chunk_t chunk = map->queue[map->queue_head];
+		map->queue_head = (map->queue_head + 1) % CONTENT_QUEUE_LEN;
+		map->queue_len--;
+		pthread_mutex_unlock(&map->lock);
+
+		// Only this thread updates the map, no lock needed for it
+		content_map_mark(map, chunk.offset, chunk.len, content_classify(chunk.buf, chunk.len));
+
+		pthread_mutex_lock(&map->lock);
+		map->free_bufs[map->num_free++] = chunk.buf;
+		pthread_cond_broadcast(&map->cond);
+	}
+	pthread_mutex_unlock(&map->lock);
+
+	return NULL;
+}
+
+static void content_map_free_bufs(content_map_t *map)
+{
+	while (map->num_free > 0)
+		munmap(map->free_bufs[--map->num_free], map->buf_size);
+}
+
+bool content_map_start(content_map_t *map, uint64_t num_bytes, unsigned buf_size)
+{
+	const uint64_t num_granules = (num_bytes + CONTENT_GRANULE_BYTES - 1) / CONTENT_GRANULE_BYTES;
+
+	if (map->map == NULL || map->num_granules != num_granules) {
+		free(map->map);
+		map->map = calloc((num_granules + 3) / 4, 1);
+		if (map->map == NULL) {
+			ERROR("Failed to allocate the content map for %"PRIu64" granules", num_granules);
+			return false;
+		}
+		map->num_granules = num_granules;
+	} else {
+		memset(map->map, 0, (num_granules + 3) / 4);
+	}
+	memset(map->bytes, 0, sizeof(map->bytes));
+
+	map->buf_size = buf_size;
+	map->num_free = 0;
+	map->queue_head = 0;
+	map->queue_len = 0;
+	map->stop = false;
+	while (map->num_free < CONTENT_QUEUE_LEN) {
+		void *buf = mmap(NULL, buf_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+		if (buf == MAP_FAILED) {
+			ERROR("Failed to allocate content classification buffers, errno=%d: %s", errno, strerror(errno));
+			content_map_free_bufs(map);
+			return false;
+		}
+		map->free_bufs[map->num_free++] = buf;
+	}
+
+	pthread_mutex_init(&map->lock, NULL);
+	pthread_cond_init(&map->cond, NULL);
+	if (pthread_create(&map->thread, NULL, content_map_thread, map) != 0) {
+		ERROR("Failed to start the content classification thread, errno=%d: %s", errno, strerror(errno));
+		pthread_cond_destroy(&map->cond);
+		pthread_mutex_destroy(&map->lock);
+		content_map_free_bufs(map);
+		return false;
+	}
+
+	map->running = true;
+	return true;
+}
+
+void *content_map_submit(content_map_t *map, uint64_t offset, uint32_t len, void *buf)
+{
+	void *next;
+
+	pthread_mutex_lock(&map->lock);
+	while (map->num_free == 0)
+		pthread_cond_wait(&map->cond, &map->lock);
+	next = map->free_bufs[--map->num_free];
+
+	// A buffer is either free, queued or being classified so the queue never overflows
+	map->queue[(map->queue_head + map->queue_len) % CONTENT_QUEUE_LEN] = (content_chunk_t){.offset = offset, .len = len, .buf = buf};
+	map->queue_len++;
+	pthread_cond_broadcast(&map->cond);
+	pthread_mutex_unlock(&map->lock);
+
+	return next;
+}
+
+void content_map_stop(content_map_t *map)
+{
+	if (!map->running)
+		return;
+
+	pthread_mutex_lock(&map->lock);
+	map->stop = true;
+	pthread_cond_broadcast(&map->cond);
+	pthread_mutex_unlock(&map->lock);
+	pthread_join(map->thread, NULL);
+
+	pthread_cond_destroy(&map->cond);
+	pthread_mutex_destroy(&map->lock);
+	content_map_free_bufs(map);
+	map->running = false;
+}
+
+void content_map_runs_output(FILE *f, const content_map_t *map)
+{
+	static const char type_char[CONTENT_TYPE_NUM] = {'u', 'z', 'p', 'd'};
+	uint64_t granule = 0;
+
+	while (granule < map->num_granules) {
+		const content_type_e type = content_map_get(map, granule);
+		const uint64_t start = granule;
+
+		while (granule < map->num_granules && content_map_get(map, granule) == type)
+			granule++;
+		fprintf(f, "%s%c%"PRIu64, start ? " " : "", type_char[type], granule - start);
+	}
+}
+
+void content_map_free(content_map_t *map)
+{
+	content_map_stop(map);
+	free(map->map);
+	map->map = NULL;
+	map->num_granules = 0;
+}
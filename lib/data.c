@@ -22,6 +22,7 @@
 #include "data.h"
 #include "compiler.h"
 #include "system_id.h"
+#include "topology.h"
 
 #include "hdrhistogram/src/hdr_histogram_log.h"
 
@@ -131,6 +132,7 @@ static void disk_output(FILE *f, disk_t *disk, int indent)
 	add_indent(f, indent); fprintf(f, "\"FwRev\": \"%s\",\n", disk->fw_rev);
 	add_indent(f, indent); fprintf(f, "\"Serial\": \"%s\",\n", disk->serial);
 	add_indent(f, indent); fprintf(f, "\"NumSectors\": %"PRIu64",\n", disk->num_bytes / disk->sector_size);
+	add_indent(f, indent); fprintf(f, "\"NumaNode\": %d,\n", disk->numa_node);
 	add_indent(f, indent); fprintf(f, "\"SectorSize\": %"PRIu64"\n", disk->sector_size);
 	if (disk->is_ata && disk->ata_buf_len > 0) {
 		unsigned char ata_hex[512*2+1];
@@ -140,21 +142,58 @@ static void disk_output(FILE *f, disk_t *disk, int indent)
 	add_indent(f, indent); fprintf(f, "}");
 }
 
-static void data_log_event(FILE *f, int indent, uint64_t lba, uint32_t len, io_result_t *io_res, uint32_t t_nsec)
+/* Offset of the wall clock from the monotonic clock, the IOs are timed on the monotonic clock and a single offset
+ * keeps the two timestamps of an IO consistent even if the wall clock is stepped during the scan.
+ */
+static int64_t wall_offset_nsec(void)
 {
-	add_indent(f, indent); fprintf(f, "{\"LBA\": %16"PRIu64", \"Len\": %8u, \"LatencyNSec\": %8u, ", lba, len, t_nsec);
+	struct timespec mono;
+	struct timespec wall;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &wall);
+	return (wall.tv_sec - mono.tv_sec) * 1000000000LL + wall.tv_nsec - mono.tv_nsec;
+}
+
+/* The monotonic time of the IO completion aligns the logs of disks scanned concurrently on the same machine, the wall
+ * clock aligns them to the logs of other machines and to the system log.
+ */
+static void data_log_event(FILE *f, int indent, uint64_t lba, uint32_t len, io_result_t *io_res, uint64_t t_nsec,
+		unsigned retry, struct timespec *t_end, int64_t wall_offset)
+{
+	const uint64_t mono_nsec = t_end->tv_sec * 1000000000ULL + t_end->tv_nsec;
+
+	add_indent(f, indent); fprintf(f, "{\"LBA\": %16"PRIu64", \"Len\": %8u, \"LatencyNSec\": %8"PRIu64", ", lba, len, t_nsec);
 	fprintf(f, "\"Data\": \"%s\", ", result_data_to_name(io_res->data));
 	fprintf(f, "\"Error\": \"%s\", ", result_error_to_name(io_res->error));
-	fprintf(f, "\"Sense\": %s", sense_info_to_json(&io_res->info, io_res->sense, io_res->sense_len));
+	fprintf(f, "\"Sense\": %s, ", sense_info_to_json(&io_res->info, io_res->sense, io_res->sense_len));
+	fprintf(f, "\"MonoNSec\": %"PRIu64", \"WallNSec\": %"PRIu64, mono_nsec, mono_nsec + wall_offset);
+	fprintf(f, ", \"DeviceNSec\": %"PRIu64, io_res->device_nsec);
+	// A failed attempt that is retried is not the result of the IO
+	if (retry > 0)
+		fprintf(f, ", \"Retry\": %u", retry);
 	fprintf(f, "}");
 }
 
+static void topology_output(FILE *f, disk_t *disk)
+{
+	disk_topology_t topo;
+
+	if (!topology_for_path(disk->path, &topo)) {
+		fprintf(f, "{}");
+		return;
+	}
+	fprintf(f, "{\"Name\": \"%s\", \"WWID\": \"%s\", \"Host\": \"%s\", \"Expander\": \"%s\", \"Enclosure\": \"%s\"}",
+			topo.name, topo.wwid, topo.host, topo.expander, topo.enclosure);
+}
+
 void data_log_raw_start(data_log_raw_t *log_raw, const char *filename, disk_t *disk)
 {
 	log_raw->f = fopen(filename, "wt");
 	if (log_raw->f == NULL)
 		return;
 	log_raw->is_first = true;
+	log_raw->wall_offset_nsec = wall_offset_nsec();
 
 	fprintf(log_raw->f, "{\n");
 
@@ -163,6 +202,22 @@ void data_log_raw_start(data_log_raw_t *log_raw, const char *filename, disk_t *d
 	disk_output(log_raw->f, disk, 2);
 	fprintf(log_raw->f, ",\n");
 
+	// Where the disk is connected, disks behind the same host or expander share its problems
+	add_indent(log_raw->f, 1); fprintf(log_raw->f, "\"Machine\": ");
+	system_id_output(log_raw->f);
+	fprintf(log_raw->f, ",\n");
+	add_indent(log_raw->f, 1); fprintf(log_raw->f, "\"Topology\": ");
+	topology_output(log_raw->f, disk);
+	fprintf(log_raw->f, ",\n");
+
+	// The ranges of a multi-actuator disk are scanned concurrently and their IOs are interleaved in the log
+	add_indent(log_raw->f, 1); fprintf(log_raw->f, "\"Ranges\": [");
+	unsigned i;
+	for (i = 0; i < disk->num_ranges; i++)
+		fprintf(log_raw->f, "%s{\"StartSector\": %"PRIu64", \"EndSector\": %"PRIu64"}", i != 0 ? ", " : "",
+				disk->ranges[i].start_bytes / disk->sector_size, disk->ranges[i].end_bytes / disk->sector_size);
+	fprintf(log_raw->f, "],\n");
+
 	add_indent(log_raw->f, 1); fprintf(log_raw->f, "\"Raw\": [\n");
 }
 
@@ -174,7 +229,8 @@ void data_log_raw_end(data_log_raw_t *log_raw)
 	fclose(log_raw->f);
 }
 
-void data_log_raw(data_log_raw_t *log_raw, uint64_t lba, uint32_t len, io_result_t *io_res, uint32_t t_nsec)
+void data_log_raw(data_log_raw_t *log_raw, uint64_t lba, uint32_t len, io_result_t *io_res, uint64_t t_nsec,
+		unsigned retry, struct timespec *t_end)
 {
 	if (log_raw == NULL || log_raw->f == NULL)
 		return;
@@ -184,7 +240,64 @@ void data_log_raw(data_log_raw_t *log_raw, uint64_t lba, uint32_t len, io_result
 	else
 		log_raw->is_first = false;
 
-	data_log_event(log_raw->f, 2, lba, len, io_res, t_nsec);
+	data_log_event(log_raw->f, 2, lba, len, io_res, t_nsec, retry, t_end, log_raw->wall_offset_nsec);
+}
+
+static void io_record_output(FILE *f, int indent, io_record_t *rec)
+{
+	unsigned char sense_hex[sizeof(rec->sense) * 2 + 1];
+
+	buf_to_hex(rec->sense, rec->sense_len, sense_hex, sizeof(sense_hex));
+
+	add_indent(f, indent);
+	fprintf(f, "{\"LBA\": %"PRIu64", \"Len\": %u, \"LatencyNSec\": %"PRIu64", \"TimeNSec\": %"PRIu64", \"Data\": \"%s\", \"Error\": \"%s\", \"Sense\": \"%s\"}",
+			rec->lba, rec->len, rec->t_nsec, rec->timestamp_nsec,
+			result_data_to_name(rec->data), result_error_to_name(rec->error), sense_hex);
+}
+
+static void flight_recorder_output(FILE *f, int indent, flight_recorder_t *fr, const char *reason)
+{
+	uint64_t first = fr->last_dump;
+	uint64_t i;
+	unsigned j;
+
+	// Older IOs have already been overwritten in the ring
+	if (fr->num_recorded - first > FLIGHT_RECORDER_LEN)
+		first = fr->num_recorded - FLIGHT_RECORDER_LEN;
+
+	fprintf(f, "{\"Reason\": \"%s\", \"NumRecorded\": %"PRIu64", \"Recent\": [\n", reason, fr->num_recorded);
+	for (i = first; i < fr->num_recorded; i++) {
+		if (i != first)
+			fprintf(f, ",\n");
+		io_record_output(f, indent+1, &fr->recent[i % FLIGHT_RECORDER_LEN]);
+	}
+	fprintf(f, "\n");
+	add_indent(f, indent); fprintf(f, "], \"Slowest\": [\n");
+	for (j = 0; j < fr->num_slowest; j++) {
+		if (j != 0)
+			fprintf(f, ",\n");
+		io_record_output(f, indent+1, &fr->slowest[j]);
+	}
+	fprintf(f, "\n");
+	add_indent(f, indent); fprintf(f, "]}");
+
+	fr->last_dump = fr->num_recorded;
+}
+
+void data_log_flight_recorder(data_log_t *log, flight_recorder_t *fr, const char *reason)
+{
+	if (log == NULL || log->f == NULL)
+		return;
+
+	if (!log->is_first)
+		fprintf(log->f, ",\n");
+	else
+		log->is_first = false;
+
+	add_indent(log->f, 3); fprintf(log->f, "{\"FlightRecorder\": ");
+	flight_recorder_output(log->f, 3, fr, reason);
+	fprintf(log->f, "}");
+	fflush(log->f);
 }
 
 static void time_output(FILE *f, const char *name)
@@ -208,6 +321,7 @@ void data_log_start(data_log_t *log, const char *filename, disk_t *disk)
 	if (!log->f)
 		return;
 	log->is_first = true;
+	log->wall_offset_nsec = wall_offset_nsec();
 
 	fprintf(log->f, "{\n");
 	add_indent(log->f, 1); fprintf(log->f, "\"Disk\": ");
@@ -226,18 +340,147 @@ void data_log_start(data_log_t *log, const char *filename, disk_t *disk)
 	add_indent(log->f, 2); fprintf(log->f, "\"Events\": [\n");
 }
 
-static void histogram_output(FILE *f, struct hdr_histogram *histogram, int indent)
+static void histogram_output(FILE *f, const char *name, struct hdr_histogram *histogram, int indent)
 {
 	char *encoded_histogram;
 
 	hdr_log_encode(histogram, &encoded_histogram);
 
 	add_indent(f, indent);
-	fprintf(f, "\"Histogram\": \"%s\"\n", encoded_histogram);
+	fprintf(f, "\"%s\": \"%s\",\n", name, encoded_histogram);
 
 	free(encoded_histogram);
 }
 
+static void zones_output(FILE *f, disk_t *disk, int indent)
+{
+	int i;
+	bool is_first = true;
+
+	add_indent(f, indent); fprintf(f, "\"Zones\": {\"NumZones\": %u, \"UnwrittenBytes\": %"PRIu64", \"Histograms\": {",
+			disk->num_zones, disk->unwritten_bytes);
+	for (i = 0; i < ZONE_TYPE_NUM; i++) {
+		struct hdr_histogram *histogram = disk->zone_histogram[i];
+		char *encoded_histogram;
+
+		if (histogram == NULL || histogram->total_count == 0)
+			continue;
+		if (hdr_log_encode(histogram, &encoded_histogram) != 0)
+			continue;
+
+		fprintf(f, "%s\"%s\": \"%s\"", is_first ? "" : ", ", zone_type_to_str(i), encoded_histogram);
+		is_first = false;
+		free(encoded_histogram);
+	}
+	fprintf(f, "}},\n");
+}
+
+static void ranges_output(FILE *f, disk_t *disk, int indent)
+{
+	unsigned i;
+
+	add_indent(f, indent); fprintf(f, "\"Ranges\": [\n");
+	for (i = 0; i < disk->num_ranges; i++) {
+		disk_range_t *range = &disk->ranges[i];
+		char *encoded_histogram = NULL;
+
+		if (hdr_log_encode(range->histogram, &encoded_histogram) != 0)
+			encoded_histogram = NULL;
+
+		if (i != 0)
+			fprintf(f, ",\n");
+		add_indent(f, indent+1);
+		fprintf(f, "{\"StartSector\": %"PRIu64", \"EndSector\": %"PRIu64", \"NumErrors\": %"PRIu64", \"Histogram\": \"%s\"}",
+				range->start_bytes / disk->sector_size, range->end_bytes / disk->sector_size,
+				range->num_errors, encoded_histogram ? encoded_histogram : "");
+		free(encoded_histogram);
+	}
+	fprintf(f, "\n");
+	add_indent(f, indent); fprintf(f, "],\n");
+}
+
+static void passes_output(FILE *f, disk_t *disk, int indent)
+{
+	unsigned i, j;
+
+	add_indent(f, indent); fprintf(f, "\"Burnin\": \"%s\",\n", burnin_result_to_str(disk->burnin));
+	add_indent(f, indent); fprintf(f, "\"Passes\": [\n");
+	for (i = 0; i < disk->num_passes; i++) {
+		disk_pass_t *pass = &disk->passes[i];
+		char *encoded_histogram = NULL;
+
+		if (hdr_log_encode(pass->device_histogram, &encoded_histogram) != 0)
+			encoded_histogram = NULL;
+
+		if (i != 0)
+			fprintf(f, ",\n");
+		add_indent(f, indent+1);
+		fprintf(f, "{\"WriteVerify\": %s, \"Conclusion\": \"%s\", \"NumErrors\": %"PRIu64", \"WallNSec\": %"PRIu64", ",
+				pass->write_verify ? "true" : "false", conclusion_to_str(pass->conclusion), pass->num_errors, pass->wall_nsec);
+		if (pass->has_smart)
+			fprintf(f, "\"Smart\": {\"Temperature\": %d, \"Reallocations\": %d, \"PendingReallocations\": %d, \"CrcErrors\": %d}, ",
+					pass->temp, pass->reallocs, pass->pending_reallocs, pass->crc_errors);
+		fprintf(f, "\"LatencyMedianMsec\": [");
+		for (j = 0; j < disk->latency_graph_len; j++)
+			fprintf(f, "%s%u", j ? ", " : "", pass->latency_graph[j].latency_median_msec);
+		fprintf(f, "], \"DeviceHistogram\": \"%s\"}", encoded_histogram ? encoded_histogram : "");
+		free(encoded_histogram);
+	}
+	fprintf(f, "\n");
+	add_indent(f, indent); fprintf(f, "],\n");
+}
+
+static void content_map_output(FILE *f, content_map_t *map, int indent)
+{
+	add_indent(f, indent);
+	fprintf(f, "\"ContentMap\": {\"GranuleBytes\": %d, \"ZeroBytes\": %"PRIu64", \"PatternBytes\": %"PRIu64", \"DataBytes\": %"PRIu64", \"Runs\": \"",
+			CONTENT_GRANULE_BYTES, map->bytes[CONTENT_ZERO], map->bytes[CONTENT_PATTERN], map->bytes[CONTENT_DATA]);
+	content_map_runs_output(f, map);
+	fprintf(f, "\"},\n");
+}
+
+static void slow_regions_output(FILE *f, disk_t *disk, int indent)
+{
+	unsigned i;
+
+	add_indent(f, indent); fprintf(f, "\"SlowRegions\": [\n");
+	for (i = 0; i < disk->num_slow_regions && i < ANOMALY_MAX_REGIONS; i++) {
+		slow_region_t *r = &disk->slow_regions[i];
+
+		if (i != 0)
+			fprintf(f, ",\n");
+		add_indent(f, indent+1);
+		fprintf(f, "{\"StartSector\": %"PRIu64", \"EndSector\": %"PRIu64", \"MedianUsec\": %u, \"BaselineUsec\": %u}",
+				r->start_sector, r->end_sector, r->median_usec, r->baseline_usec);
+	}
+	fprintf(f, "\n");
+	add_indent(f, indent); fprintf(f, "],\n");
+}
+
+static void bad_sectors_output(FILE *f, disk_t *disk, int indent)
+{
+	unsigned i;
+
+	add_indent(f, indent); fprintf(f, "\"BadSectors\": {\"Count\": %u, \"LBAs\": [", disk->num_bad_sectors);
+	for (i = 0; i < disk->num_bad_sectors && i < DISK_MAX_BAD_SECTORS; i++)
+		fprintf(f, "%s%"PRIu64, i ? ", " : "", disk->bad_sectors[i]);
+	fprintf(f, "]},\n");
+}
+
+static void cost_output(FILE *f, disk_t *disk, int indent)
+{
+	int phase;
+
+	add_indent(f, indent);
+	fprintf(f, "\"Cost\": {\"NumIOs\": %"PRIu64", \"WallNSec\": %"PRIu64", \"CpuNSec\": %"PRIu64", \"PhasesNSec\": {",
+			disk->cost.num_ios, disk->cost.wall_nsec, disk->cost.cpu_nsec);
+	for (phase = 0; phase < COST_PHASE_NUM; phase++) {
+		fprintf(f, "%s\"%s\": %"PRIu64, phase ? ", " : "", cost_phase_to_str(phase),
+				(uint64_t)(disk->cost.ticks[phase] * disk->cost.nsec_per_tick));
+	}
+	fprintf(f, "}},\n");
+}
+
 static void latency_output(FILE *f, latency_t *latency, int latency_len, int indent)
 {
 	//unsigned latency_graph_len;
@@ -274,15 +517,43 @@ void data_log_end(data_log_t *log, disk_t *disk)
 
 	add_indent(log->f, 2); time_output(log->f, "EndTime"); fprintf(log->f, ",\n");
 
-	histogram_output(log->f, disk->histogram, 2);
+	histogram_output(log->f, "Histogram", disk->histogram, 2);
+	histogram_output(log->f, "DeviceHistogram", disk->device_histogram, 2);
 	latency_output(log->f, disk->latency_graph, disk->latency_graph_len, 2);
+	add_indent(log->f, 2); fprintf(log->f, "\"Power\": {\"InitialState\": \"%s\", \"SpinUpLatencyNSec\": %"PRIu64"},\n",
+			power_state_to_str(disk->power_state), disk->spinup_nsec);
+	add_indent(log->f, 2); fprintf(log->f, "\"Provisioning\": {\"Supported\": %s, \"MappedBytes\": %"PRIu64", \"UnmappedBytes\": %"PRIu64"},\n",
+			disk->lbp_supported && !disk->scan_unmapped ? "true" : "false", disk->mapped_bytes, disk->unmapped_bytes);
+	if (disk->num_zones > 0)
+		zones_output(log->f, disk, 2);
+	if (disk->num_ranges > 1)
+		ranges_output(log->f, disk, 2);
+	if (disk->num_slow_regions > 0)
+		slow_regions_output(log->f, disk, 2);
+	if (disk->num_bad_sectors > 0)
+		bad_sectors_output(log->f, disk, 2);
+	if (disk->num_passes > 1)
+		passes_output(log->f, disk, 2);
+	if (disk->content_map.map)
+		content_map_output(log->f, &disk->content_map, 2);
+	// The heatmap itself is too large for the output, only where to find it
+	if (disk->heatmap.records) {
+		add_indent(log->f, 2);
+		fprintf(log->f, "\"Heatmap\": {\"File\": \"%s\", \"BucketBytes\": %"PRIu64", \"NumBuckets\": %"PRIu64"},\n",
+				disk->heatmap.path, disk->heatmap.header->bucket_bytes, disk->heatmap.header->num_buckets);
+	}
+	cost_output(log->f, disk, 2);
+	add_indent(log->f, 2); fprintf(log->f, "\"FlightRecorder\": ");
+	flight_recorder_output(log->f, 2, &disk->flight_recorder, "end");
+	fprintf(log->f, ",\n");
 	add_indent(log->f, 2); fprintf(log->f, "\"Conclusion\": \"%s\"\n", conclusion_to_str(disk->conclusion));
 
 	add_indent(log->f, 1); fprintf(log->f, "}\n");
 	fprintf(log->f, "}\n");
 }
 
-void data_log(data_log_t *log, uint64_t lba, uint32_t len, io_result_t *io_res, uint32_t t_nsec)
+void data_log(data_log_t *log, uint64_t lba, uint32_t len, io_result_t *io_res, uint64_t t_nsec, unsigned retry,
+		struct timespec *t_end)
 {
 	if (log == NULL || log->f == NULL)
 		return;
@@ -293,6 +564,6 @@ void data_log(data_log_t *log, uint64_t lba, uint32_t len, io_result_t *io_res,
 		else
 			log->is_first = false;
 
-		data_log_event(log->f, 3, lba, len, io_res, t_nsec);
+		data_log_event(log->f, 3, lba, len, io_res, t_nsec, retry, t_end, log->wall_offset_nsec);
 	}
 }
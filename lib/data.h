@@ -3,7 +3,10 @@
 
 #include "arch.h"
 
-void data_log(data_log_t *log, uint64_t lba, uint32_t len, io_result_t *io_res, uint32_t t_nsec);
-void data_log_raw(data_log_raw_t *log_raw, uint64_t lba, uint32_t len, io_result_t *io_res, uint32_t t_nsec);
+/* retry is the number of the failed attempt of an IO that is retried, 0 for the result of the IO */
+void data_log(data_log_t *log, uint64_t lba, uint32_t len, io_result_t *io_res, uint64_t t_nsec, unsigned retry,
+		struct timespec *t_end);
+void data_log_raw(data_log_raw_t *log_raw, uint64_t lba, uint32_t len, io_result_t *io_res, uint64_t t_nsec,
+		unsigned retry, struct timespec *t_end);
 
 #endif
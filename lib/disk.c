@@ -1,6 +1,13 @@
 #include "disk.h"
 
+#include "verbose.h"
+
 #include "libscsicmd/include/ata.h"
+#include "libscsicmd/include/parse_vpd.h"
+#include "libscsicmd/include/parse_get_lba_status.h"
+
+#include <stdlib.h>
+#include <memory.h>
 
 int disk_smart_trip(disk_dev_t *dev)
 {
@@ -40,3 +47,303 @@ int disk_smart_attributes(disk_dev_t *dev, ata_smart_attr_t *attrs, int max_attr
 
 	return ata_parse_ata_smart_read_data(buf, attrs, max_attrs);
 }
+
+static disk_power_state_e disk_ata_power_state(disk_dev_t *dev)
+{
+	int cdb_len;
+	unsigned char cdb[32];
+	unsigned char buf[512];
+	unsigned char sense[128];
+	unsigned buf_read = 0;
+	unsigned sense_read = 0;
+	io_result_t io_res;
+	uint8_t power_mode;
+
+	cdb_len = cdb_ata_check_power_mode(cdb);
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, sizeof(buf), &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (!ata_check_power_mode_result(sense, sense_read, &power_mode))
+		return DISK_POWER_UNKNOWN;
+
+	switch (power_mode) {
+		case ATA_POWER_MODE_STANDBY:
+		case ATA_POWER_MODE_NV_CACHE_SPUN_DOWN:
+			return DISK_POWER_STANDBY;
+		case ATA_POWER_MODE_IDLE:
+		case ATA_POWER_MODE_IDLE_A:
+		case ATA_POWER_MODE_IDLE_B:
+		case ATA_POWER_MODE_IDLE_C:
+			return DISK_POWER_IDLE;
+		default:
+			return DISK_POWER_ACTIVE;
+	}
+}
+
+static disk_power_state_e disk_scsi_power_state(disk_dev_t *dev)
+{
+	int cdb_len;
+	unsigned char cdb[32];
+	unsigned char buf[252];
+	unsigned char sense[128];
+	unsigned buf_read = 0;
+	unsigned sense_read = 0;
+	io_result_t io_res;
+	sense_info_t info;
+
+	memset(buf, 0, sizeof(buf));
+	cdb_len = cdb_request_sense(cdb, false, sizeof(buf));
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, sizeof(buf), &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (sense_read > 0 || buf_read == 0 || !scsi_parse_sense(buf, buf_read, &info))
+		return DISK_POWER_UNKNOWN;
+
+	// Low power conditions are reported as NO SENSE with ASC 0x5E
+	if (info.sense_key != SENSE_KEY_NO_SENSE || info.asc != 0x5E)
+		return DISK_POWER_ACTIVE;
+
+	switch (info.ascq) {
+		case 0x02: // Standby condition activated by timer
+		case 0x04: // Standby condition activated by command
+		case 0x09: // Standby_Y condition activated by timer
+		case 0x0A: // Standby_Y condition activated by command
+			return DISK_POWER_STANDBY;
+		case 0x00: // Low power condition on
+		case 0x01: // Idle condition activated by timer
+		case 0x03: // Idle condition activated by command
+		case 0x05: // Idle_B condition activated by timer
+		case 0x06: // Idle_B condition activated by command
+		case 0x07: // Idle_C condition activated by timer
+		case 0x08: // Idle_C condition activated by command
+			return DISK_POWER_IDLE;
+		default:
+			return DISK_POWER_ACTIVE;
+	}
+}
+
+disk_power_state_e disk_power_state(disk_dev_t *dev, bool is_ata)
+{
+	return is_ata ? disk_ata_power_state(dev) : disk_scsi_power_state(dev);
+}
+
+bool disk_lbp_supported(disk_dev_t *dev)
+{
+	int cdb_len;
+	unsigned char cdb[32];
+	unsigned char buf[512];
+	unsigned char sense[128];
+	unsigned buf_read = 0;
+	unsigned sense_read = 0;
+	io_result_t io_res;
+	bool lbpme = false;
+	bool lbprz = false;
+
+	memset(buf, 0, sizeof(buf));
+	cdb_len = cdb_read_capacity_16(cdb, 32);
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, 32, &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (sense_read > 0 || !parse_read_capacity_16(buf, buf_read, NULL, NULL, NULL, NULL, NULL, NULL, &lbpme, &lbprz, NULL))
+		return false;
+
+	if (!lbpme)
+		return false;
+
+	memset(buf, 0, sizeof(buf));
+	cdb_len = cdb_inquiry(cdb, true, VPD_PAGE_LOGICAL_BLOCK_PROVISIONING, sizeof(buf));
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, sizeof(buf), &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (sense_read == 0 && vpd_lbp_is_valid(buf, buf_read)) {
+		INFO("Logical block provisioning: type %s, unmap %s, unmapped reads return %s",
+				vpd_lbp_provisioning_type(buf) == VPD_PROVISIONING_THIN ? "thin" :
+				vpd_lbp_provisioning_type(buf) == VPD_PROVISIONING_RESOURCE ? "resource" : "unreported",
+				vpd_lbp_lbpu(buf) ? "supported" : "unsupported",
+				lbprz ? "zeros" : "unspecified data");
+	} else {
+		INFO("Logical block provisioning is enabled but the provisioning VPD page is unavailable");
+	}
+
+	return true;
+}
+
+int disk_lba_status(disk_dev_t *dev, uint64_t lba, lba_extent_t *extents, int max_extents)
+{
+	int cdb_len;
+	unsigned char cdb[32];
+	unsigned char sense[128];
+	unsigned buf_read = 0;
+	unsigned sense_read = 0;
+	io_result_t io_res;
+	const unsigned buf_len = GET_LBA_STATUS_MIN_LEN + GET_LBA_STATUS_DESC_LEN * max_extents;
+	unsigned char *buf;
+	int num_extents = -1;
+
+	buf = malloc(buf_len);
+	if (!buf)
+		return -1;
+
+	cdb_len = cdb_get_lba_status(cdb, lba, buf_len);
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, buf_len, &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (sense_read > 0 || io_res.data == DATA_NONE || !get_lba_status_is_valid(buf, buf_read))
+		goto Exit;
+
+	const unsigned num_descs = get_lba_status_num_descs(buf, buf_read);
+	unsigned i;
+	for (i = 0, num_extents = 0; i < num_descs && num_extents < max_extents; i++) {
+		uint8_t *desc = get_lba_status_desc(buf, i);
+		lba_extent_t *extent = &extents[num_extents];
+
+		extent->lba = get_lba_status_desc_lba(desc);
+		extent->num_blocks = get_lba_status_desc_num_blocks(desc);
+		extent->mapped = get_lba_status_desc_status(desc) == LBA_STATUS_MAPPED;
+		if (extent->num_blocks == 0)
+			continue;
+
+		num_extents++;
+	}
+
+Exit:
+	free(buf);
+	return num_extents;
+}
+
+zoned_model_e disk_zoned_model(disk_dev_t *dev)
+{
+	int cdb_len;
+	unsigned char cdb[32];
+	unsigned char buf[512];
+	unsigned char sense[128];
+	unsigned buf_read = 0;
+	unsigned sense_read = 0;
+	io_result_t io_res;
+
+	memset(buf, 0, sizeof(buf));
+	cdb_len = cdb_inquiry(cdb, true, VPD_PAGE_BLOCK_DEVICE_CHARACTERISTICS, sizeof(buf));
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, sizeof(buf), &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (sense_read > 0 || !vpd_bdc_is_valid(buf, buf_read))
+		return ZONED_NONE;
+
+	if (evpd_peripheral_device_type(buf) == SCSI_DEV_TYPE_ZBC)
+		return ZONED_HOST_MANAGED;
+
+	switch (vpd_bdc_zoned(buf)) {
+		case VPD_ZONED_HOST_AWARE: return ZONED_HOST_AWARE;
+		case VPD_ZONED_DEVICE_MANAGED: return ZONED_DEVICE_MANAGED;
+		default: return ZONED_NONE;
+	}
+}
+
+int disk_report_zones_parse(unsigned char *buf, unsigned buf_len, zone_t *zones, int max_zones)
+{
+	if (!report_zones_is_valid(buf, buf_len))
+		return -1;
+
+	const unsigned num_descs = report_zones_num_descs(buf, buf_len);
+	unsigned i;
+	int num_zones = 0;
+
+	for (i = 0; i < num_descs && num_zones < max_zones; i++) {
+		uint8_t *desc = report_zones_desc(buf, i);
+		zone_t *zone = &zones[num_zones];
+		const uint64_t zone_len = report_zones_desc_len(desc);
+		const uint64_t wp_lba = report_zones_desc_wp_lba(desc);
+
+		if (zone_len == 0 || zone_len > UINT32_MAX)
+			continue;
+
+		zone->start_lba = report_zones_desc_start_lba(desc);
+		zone->num_blocks = zone_len;
+		zone->type = report_zones_desc_type(desc);
+		zone->cond = report_zones_desc_cond(desc);
+
+		// The write pointer is only meaningful for sequential zones that are not full
+		if (wp_lba >= zone->start_lba && wp_lba - zone->start_lba < zone_len)
+			zone->wp_offset = wp_lba - zone->start_lba;
+		else
+			zone->wp_offset = zone_len;
+
+		num_zones++;
+	}
+
+	return num_zones;
+}
+
+int disk_report_zones(disk_dev_t *dev, uint64_t lba, zone_t *zones, int max_zones)
+{
+	int cdb_len;
+	unsigned char cdb[32];
+	unsigned char sense[128];
+	unsigned buf_read = 0;
+	unsigned sense_read = 0;
+	io_result_t io_res;
+	const unsigned buf_len = REPORT_ZONES_MIN_LEN + REPORT_ZONES_DESC_LEN * max_zones;
+	unsigned char *buf;
+	int num_zones = -1;
+
+	buf = malloc(buf_len);
+	if (!buf)
+		return -1;
+
+	cdb_len = cdb_report_zones(cdb, lba, buf_len, REPORT_ZONES_ALL, false);
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, buf_len, &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (sense_read == 0 && io_res.data != DATA_NONE)
+		num_zones = disk_report_zones_parse(buf, buf_read, zones, max_zones);
+
+	free(buf);
+	return num_zones;
+}
+
+int disk_concurrent_ranges_parse(unsigned char *buf, unsigned buf_len, lba_range_t *ranges, int max_ranges)
+{
+	if (!vpd_cpr_is_valid(buf, buf_len))
+		return -1;
+	// A page cut short would silently lose the ranges at its end
+	if ((unsigned)(evpd_page_len(buf) + EVPD_MIN_LEN) > buf_len)
+		return -1;
+
+	const unsigned num_descs = vpd_cpr_num_descs(buf, buf_len);
+	unsigned i;
+	int num_ranges = 0;
+
+	for (i = 0; i < num_descs; i++) {
+		uint8_t *desc = vpd_cpr_desc(buf, i);
+		lba_range_t range = {
+			.start_lba = vpd_cpr_desc_start_lba(desc),
+			.num_blocks = vpd_cpr_desc_num_lbas(desc),
+		};
+
+		if (range.num_blocks == 0)
+			continue;
+		if (num_ranges == max_ranges)
+			return -1;
+
+		// Insertion sort, there are only a handful of ranges
+		int j;
+		for (j = num_ranges; j > 0 && ranges[j-1].start_lba > range.start_lba; j--)
+			ranges[j] = ranges[j-1];
+		ranges[j] = range;
+		num_ranges++;
+	}
+
+	// The ranges must not overlap for them to be scanned independently
+	int j;
+	for (j = 1; j < num_ranges; j++) {
+		if (ranges[j-1].start_lba + ranges[j-1].num_blocks > ranges[j].start_lba)
+			return -1;
+	}
+
+	return num_ranges;
+}
+
+int disk_concurrent_ranges(disk_dev_t *dev, lba_range_t *ranges, int max_ranges)
+{
+	int cdb_len;
+	unsigned char cdb[32];
+	unsigned char buf[1024];
+	unsigned char sense[128];
+	unsigned buf_read = 0;
+	unsigned sense_read = 0;
+	io_result_t io_res;
+
+	memset(buf, 0, sizeof(buf));
+	cdb_len = cdb_inquiry(cdb, true, VPD_PAGE_CONCURRENT_POSITIONING_RANGES, sizeof(buf));
+	disk_dev_cdb_in(dev, cdb, cdb_len, buf, sizeof(buf), &buf_read, sense, sizeof(sense), &sense_read, &io_res);
+	if (sense_read > 0)
+		return -1;
+
+	return disk_concurrent_ranges_parse(buf, buf_read, ranges, max_ranges);
+}
@@ -25,10 +25,14 @@
 #include "median.h"
 #include "compiler.h"
 #include "data.h"
+#include "probes.h"
+#include "cost.h"
+#include "error_policy.h"
 #include "libscsicmd/include/smartdb.h"
 #include "libscsicmd/include/ata_smart.h"
 
 #include <sched.h>
+#include <pthread.h>
 #include <memory.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -36,25 +40,96 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/file.h>
 #include <time.h>
 #include <inttypes.h>
 #include <errno.h>
 #include <assert.h>
+#include <sys/resource.h>
 
 #define TEMP_THRESHOLD 65
+#define LBA_STATUS_BATCH 4096
+#define REPORT_ZONES_BATCH 1024
+
+struct scan_progress {
+	uint64_t bytes;
+	uint64_t total;
+	int part;
+	int full;
+};
+
+/* An IO waiting for the heatmap bucket it is in to be completely scanned */
+typedef struct heatmap_io_t {
+	uint32_t bucket;
+	uint32_t usec;
+	uint32_t result;
+} heatmap_io_t;
+
+enum heatmap_io_result {
+	HEATMAP_IO_OK,
+	HEATMAP_IO_RETRY,
+	HEATMAP_IO_ERROR,
+};
 
+/* State of a single IO stream, there is one for each concurrent positioning range of the disk */
 struct scan_state {
+	disk_t *disk;
+	disk_range_t *range;
+	uint64_t start_bytes; /* Part of the range that is scanned */
+	uint64_t end_bytes;
+	struct scan_progress *progress;
+	pthread_t thread;
+	bool result;
+	enum scan_mode mode;
+	unsigned data_size;
+	uint32_t *scan_order;
 	uint32_t latency_bucket;
 	uint64_t latency_stride;
 	uint32_t latency_count;
-	uint32_t *latency;
+	uint32_t *latency; /* usec */
+	anomaly_t anomaly;
 	void *data;
-	uint64_t progress_bytes;
-	int progress_part;
-	int progress_full;
 	unsigned num_unknown_errors;
+	unsigned io_retries;    /* Retries of the current IO for a transient error */
+	uint32_t io_size_limit; /* Reads are split to this size after a retry with a smaller size */
+	bool lbp_enabled;
+	lba_extent_t *lba_map;
+	unsigned lba_map_len;
+	unsigned lba_map_size;
+	uint64_t mapped_bytes;
+	uint64_t unmapped_bytes;
+	uint64_t unwritten_bytes;
+	zone_type_e zone_type;
+	struct timespec throttle_start;
+	uint64_t throttle_bytes;
+	uint64_t throttle_limit;
+	scan_cost_t cost;
+	heatmap_io_t *heatmap_ios;
+	unsigned heatmap_ios_len;
+	unsigned heatmap_ios_size;
 };
 
+static inline void disk_lock(disk_t *disk)
+{
+	pthread_mutex_lock(&disk->lock);
+}
+
+static inline void disk_unlock(disk_t *disk)
+{
+	pthread_mutex_unlock(&disk->lock);
+}
+
+/* The rings of the subscriptions have their own locks, events are published outside of the disk lock */
+static void disk_publish(disk_t *disk, const scan_event_t *event)
+{
+	unsigned i;
+
+	for (i = 0; i < disk->num_subscriptions; i++)
+		scan_subscription_publish(disk->subscriptions[i], event);
+}
+
+__thread scan_cost_t *cost_thread;
+
 typedef int spinner_t;
 
 static char spinner_form[] = {'|', '/', '-', '\\', '|', '/', '-', '\\'};
@@ -84,11 +159,27 @@ const char *conclusion_to_str(enum conclusion conclusion)
 {
 	switch (conclusion) {
 		case CONCLUSION_FAILED_IO_ERRORS: return "failed due to IO errors";
+		case CONCLUSION_FAILED_SLOW_REGION: return "failed due to a slow region";
 		case CONCLUSION_FAILED_MAX_LATENCY: return "failed due to a high max latency";
 		case CONCLUSION_FAILED_LATENCY_PERCENTILE: return "failed to to a high latency in the 99.99%'ile";
 		case CONCLUSION_PASSED: return "passed";
 		case CONCLUSION_SCAN_PROBLEM: return "scan_problem";
 		case CONCLUSION_ABORTED: return "scan_aborted";
+		case CONCLUSION_DEFERRED: return "deferred, disk is in standby";
+		case CONCLUSION_NUM:
+			break;
+	}
+
+	return "unknown";
+}
+
+const char *burnin_result_to_str(enum burnin_result result)
+{
+	switch (result) {
+		case BURNIN_NOT_CONVERGED: return "did not converge";
+		case BURNIN_CONVERGED: return "converged";
+		case BURNIN_FAILED: return "failed";
+		case BURNIN_ABORTED: return "aborted";
 	}
 
 	return "unknown";
@@ -157,6 +248,7 @@ static void ata_test_temp(disk_t *disk, ata_smart_attr_t *smart, int smart_num)
 
 	if (temp >= TEMP_THRESHOLD) {
 		spinner_t spinner;
+		const uint64_t cost_start = cost_ticks();
 		INFO("Pausing scan due to high disk temperature");
 		spinner_init(&spinner);
 		while (temp >= TEMP_THRESHOLD) {
@@ -171,6 +263,7 @@ static void ata_test_temp(disk_t *disk, ata_smart_attr_t *smart, int smart_num)
 			}
 		}
 		spinner_done();
+		cost_add(COST_TEMP_PAUSE, cost_start);
 		INFO("Finished pause, temperature is now %d", temp);
 	}
 }
@@ -218,6 +311,7 @@ static void disk_ata_monitor(disk_t *disk)
 	}
 
 	smart_num = disk_smart_attributes(&disk->dev, smart, ARRAY_SIZE(smart));
+	PROBE2(smart__poll, smart_num, disk->state.ata.is_smart_tripped);
 
 	if (smart_num > 0) {
 		ata_test_temp(disk, smart, smart_num);
@@ -269,6 +363,195 @@ static void disk_scsi_monitor_end(disk_t *disk)
 	(void)disk;
 }
 
+const char *cost_phase_to_str(cost_phase_e phase)
+{
+	switch (phase) {
+		case COST_DEVICE: return "device";
+		case COST_BUFFER_CLEAR: return "buffer_clear";
+		case COST_LOG: return "log";
+		case COST_HISTOGRAM: return "histogram";
+		case COST_PROGRESS: return "progress";
+		case COST_MONITOR: return "monitor";
+		case COST_TEMP_PAUSE: return "temp_pause";
+		case COST_CONTENT: return "content";
+		case COST_PHASE_NUM: break;
+	}
+
+	return "unknown";
+}
+
+const char *power_state_to_str(disk_power_state_e state)
+{
+	switch (state) {
+		case DISK_POWER_UNKNOWN: return "unknown";
+		case DISK_POWER_ACTIVE: return "active";
+		case DISK_POWER_IDLE: return "idle";
+		case DISK_POWER_STANDBY: return "standby";
+	}
+
+	return "unknown";
+}
+
+static const char *zoned_model_to_str(zoned_model_e zoned)
+{
+	switch (zoned) {
+		case ZONED_NONE: return "none";
+		case ZONED_HOST_AWARE: return "host-aware";
+		case ZONED_HOST_MANAGED: return "host-managed";
+		case ZONED_DEVICE_MANAGED: return "device-managed";
+	}
+
+	return "unknown";
+}
+
+const char *zone_type_to_str(zone_type_e type)
+{
+	switch (type) {
+		case ZONE_TYPE_CONVENTIONAL: return "Conventional";
+		case ZONE_TYPE_SEQ_WRITE_REQUIRED: return "SequentialWriteRequired";
+		case ZONE_TYPE_SEQ_WRITE_PREFERRED: return "SequentialWritePreferred";
+		case ZONE_TYPE_SEQ_OR_BEFORE_REQUIRED: return "SequentialOrBeforeRequired";
+		case ZONE_TYPE_RESERVED:
+		case ZONE_TYPE_NUM:
+			break;
+	}
+
+	return "Unknown";
+}
+
+static bool disk_zones_load(disk_t *disk)
+{
+	const uint64_t num_sectors = disk->num_bytes / disk->sector_size;
+	unsigned zones_size = 0;
+	uint64_t lba = 0;
+
+	disk->num_zones = 0;
+
+	while (lba < num_sectors) {
+		if (disk->num_zones + REPORT_ZONES_BATCH > zones_size) {
+			unsigned new_size = zones_size ? zones_size * 2 : REPORT_ZONES_BATCH * 4;
+			zone_t *new_zones = realloc(disk->zones, new_size * sizeof(zone_t));
+			if (!new_zones)
+				return false;
+			disk->zones = new_zones;
+			zones_size = new_size;
+		}
+
+		int num_zones = disk_report_zones(&disk->dev, lba, disk->zones + disk->num_zones, REPORT_ZONES_BATCH);
+		if (num_zones <= 0)
+			return false;
+
+		int i;
+		for (i = 0; i < num_zones; i++) {
+			zone_t *zone = &disk->zones[disk->num_zones + i];
+			if (zone->start_lba != lba) {
+				ERROR("Zone list is not contiguous, expected zone at lba %"PRIu64" got %"PRIu64, lba, zone->start_lba);
+				return false;
+			}
+			if (zone->cond == ZONE_COND_OFFLINE)
+				INFO("Zone at lba %"PRIu64" is offline and will not be scanned", zone->start_lba);
+			lba += zone->num_blocks;
+		}
+		disk->num_zones += num_zones;
+	}
+
+	return true;
+}
+
+/* The number of blocks from the start of the zone that hold data and are worth reading */
+static uint64_t zone_readable_blocks(zone_t *zone)
+{
+	if (zone->type == ZONE_TYPE_CONVENTIONAL)
+		return zone->num_blocks;
+
+	switch (zone->cond) {
+		case ZONE_COND_EMPTY:
+		case ZONE_COND_OFFLINE:
+			return 0;
+		case ZONE_COND_FULL:
+		case ZONE_COND_READ_ONLY:
+		case ZONE_COND_NOT_WP:
+			return zone->num_blocks;
+		default:
+			return zone->wp_offset;
+	}
+}
+
+static unsigned zone_find(disk_t *disk, uint64_t lba)
+{
+	unsigned low = 0;
+	unsigned high = disk->num_zones;
+
+	while (low < high) {
+		unsigned mid = (low + high) / 2;
+		zone_t *zone = &disk->zones[mid];
+		if (zone->start_lba + zone->num_blocks <= lba)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool disk_ranges_valid(lba_range_t *ranges, int num_ranges, uint64_t num_sectors)
+{
+	int i;
+	uint64_t next_lba = 0;
+
+	for (i = 0; i < num_ranges; i++) {
+		if (ranges[i].start_lba != next_lba)
+			return false;
+		next_lba += ranges[i].num_blocks;
+	}
+
+	return next_lba == num_sectors;
+}
+
+/* Split the latency graph between the ranges, a disk with a single range keeps a single histogram */
+static bool disk_ranges_init(disk_t *disk, const lba_range_t *ranges, int num_ranges)
+{
+	int i;
+
+	disk->num_ranges = num_ranges;
+	for (i = 0; i < num_ranges; i++) {
+		disk_range_t *range = &disk->ranges[i];
+		const unsigned first_bucket = i * disk->latency_graph_len / num_ranges;
+		const unsigned last_bucket = (i + 1) * disk->latency_graph_len / num_ranges;
+
+		range->start_bytes = ranges[i].start_lba * disk->sector_size;
+		range->end_bytes = (ranges[i].start_lba + ranges[i].num_blocks) * disk->sector_size;
+		range->latency_graph = disk->latency_graph + first_bucket;
+		range->latency_graph_len = last_bucket - first_bucket;
+
+		if (num_ranges == 1)
+			range->histogram = disk->histogram;
+		else if (hdr_init(1, 60*1000*1000, 3, &range->histogram) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static bool disk_ranges_setup(disk_t *disk)
+{
+	lba_range_t ranges[DISK_MAX_RANGES];
+	const uint64_t num_sectors = disk->num_bytes / disk->sector_size;
+	int num_ranges = disk_concurrent_ranges(&disk->dev, ranges, ARRAY_SIZE(ranges));
+
+	if (num_ranges > 1 && (unsigned)num_ranges <= disk->latency_graph_len && disk_ranges_valid(ranges, num_ranges, num_sectors)) {
+		INFO("Disk has %d concurrent positioning ranges, scanning them concurrently", num_ranges);
+	} else {
+		if (num_ranges > 1)
+			INFO("Disk reports %d concurrent positioning ranges that do not cover it, scanning it as a whole", num_ranges);
+		num_ranges = 1;
+		ranges[0].start_lba = 0;
+		ranges[0].num_blocks = num_sectors;
+	}
+
+	return disk_ranges_init(disk, ranges, num_ranges);
+}
+
 static const char *disk_mount_str(disk_mount_e mount)
 {
 	switch (mount) {
@@ -295,10 +578,21 @@ static int disk_mount_allowed(const char *path, disk_mount_e allowed_mount)
 	return 1;
 }
 
+bool disk_write_allowed(disk_t *disk, disk_mount_e allowed_mount)
+{
+	if (access(disk->path, R_OK|W_OK)) {
+		ERROR("Disk path %s is not writable, errno=%d: %s", disk->path, errno, strerror(errno));
+		return false;
+	}
+
+	return disk_mount_allowed(disk->path, allowed_mount);
+}
+
 int disk_open(disk_t *disk, const char *path, int fix, unsigned latency_graph_len, disk_mount_e allowed_mount)
 {
 	memset(disk, 0, sizeof(*disk));
 	disk->fix = fix;
+	pthread_mutex_init(&disk->lock, NULL);
 
 	INFO("Validating path %s", path);
 	if (access(path, F_OK)) {
@@ -352,7 +646,14 @@ int disk_open(disk_t *disk, const char *path, int fix, unsigned latency_graph_le
 	strncpy(disk->path, path, sizeof(disk->path));
 	disk->path[sizeof(disk->path)-1] = 0;
 
+	disk->numa_node = disk_dev_numa_node(&disk->dev);
+
+	// Find the power state before any command that may need the media and spin up the disk
+	disk->power_state = disk_power_state(&disk->dev, disk->is_ata);
+	INFO("Disk power state is %s", power_state_to_str(disk->power_state));
+
 	hdr_init(1, 60*1000*1000, 3, &disk->histogram);
+	hdr_init(1, 60*1000*1000, 3, &disk->device_histogram);
 
 	disk->latency_graph_len = latency_graph_len;
 	disk->latency_graph = calloc(latency_graph_len, sizeof(latency_t));
@@ -366,6 +667,29 @@ int disk_open(disk_t *disk, const char *path, int fix, unsigned latency_graph_le
 	else
 		disk_scsi_monitor_start(disk);
 
+	disk->lbp_supported = disk_lbp_supported(&disk->dev);
+
+	disk->zoned = disk_zoned_model(&disk->dev);
+	if (disk->zoned == ZONED_HOST_AWARE || disk->zoned == ZONED_HOST_MANAGED) {
+		if (!disk_zones_load(disk)) {
+			ERROR("Failed to read the zone list of a %s zoned disk", zoned_model_to_str(disk->zoned));
+			goto Error;
+		}
+
+		int i;
+		for (i = 0; i < ZONE_TYPE_NUM; i++)
+			hdr_init(1, 60*1000*1000, 3, &disk->zone_histogram[i]);
+
+		INFO("Disk is %s zoned with %u zones, only written blocks will be scanned", zoned_model_to_str(disk->zoned), disk->num_zones);
+	} else if (disk->zoned == ZONED_DEVICE_MANAGED) {
+		INFO("Disk is device-managed zoned, scanning it as a regular disk");
+	}
+
+	if (!disk_ranges_setup(disk)) {
+		ERROR("Failed to setup the disk ranges");
+		goto Error;
+	}
+
 	INFO("Opened disk %s sector size %"PRIu64" num bytes %"PRIu64, path, disk->sector_size, disk->num_bytes);
 	return 0;
 
@@ -374,8 +698,38 @@ Error:
 	return 1;
 }
 
+scan_subscription_t *disk_subscribe(disk_t *disk, const scan_filter_t *filter, unsigned batch, scan_event_cb_t cb, void *ctx)
+{
+	scan_subscription_t *sub;
+
+	if (disk->num_subscriptions == DISK_MAX_SUBSCRIPTIONS) {
+		ERROR("Disk %s already has %u subscriptions", disk->path, DISK_MAX_SUBSCRIPTIONS);
+		return NULL;
+	}
+
+	sub = scan_subscription_new(filter, batch, cb, ctx);
+	if (sub)
+		disk->subscriptions[disk->num_subscriptions++] = sub;
+	return sub;
+}
+
+void disk_unsubscribe(disk_t *disk, scan_subscription_t *sub)
+{
+	unsigned i;
+
+	for (i = 0; i < disk->num_subscriptions; i++) {
+		if (disk->subscriptions[i] == sub) {
+			disk->subscriptions[i] = disk->subscriptions[--disk->num_subscriptions];
+			scan_subscription_free(sub);
+			return;
+		}
+	}
+}
+
 int disk_close(disk_t *disk)
 {
+	unsigned i;
+
 	if (disk->is_ata)
 		disk_ata_monitor_end(disk);
 	else
@@ -387,6 +741,36 @@ int disk_close(disk_t *disk)
 		free(disk->latency_graph);
 		disk->latency_graph = NULL;
 	}
+	free(disk->device_histogram);
+	disk->device_histogram = NULL;
+	if (disk->num_ranges > 1) {
+		for (i = 0; i < disk->num_ranges; i++) {
+			free(disk->ranges[i].histogram);
+			disk->ranges[i].histogram = NULL;
+		}
+	}
+	disk->num_ranges = 0;
+	for (i = 0; i < disk->num_passes; i++) {
+		free(disk->passes[i].device_histogram);
+		free(disk->passes[i].latency_graph);
+	}
+	disk->num_passes = 0;
+	content_map_free(&disk->content_map);
+	heatmap_close(&disk->heatmap);
+	for (i = 0; i < disk->num_subscriptions; i++)
+		scan_subscription_free(disk->subscriptions[i]);
+	disk->num_subscriptions = 0;
+	if (disk->zones) {
+		for (i = 0; i < ZONE_TYPE_NUM; i++) {
+			if (disk->zone_histogram[i]) {
+				free(disk->zone_histogram[i]);
+				disk->zone_histogram[i] = NULL;
+			}
+		}
+		free(disk->zones);
+		disk->zones = NULL;
+		disk->num_zones = 0;
+	}
 	return 0;
 }
 
@@ -395,12 +779,68 @@ void disk_scan_stop(disk_t *disk)
 	disk->run = 0;
 }
 
+void disk_flight_recorder_dump(disk_t *disk)
+{
+	disk->flight_recorder.dump_requested = 1;
+}
+
+static void flight_recorder_start(flight_recorder_t *fr)
+{
+	memset(fr, 0, sizeof(*fr));
+	clock_gettime(CLOCK_MONOTONIC, &fr->start);
+}
+
+static void flight_recorder_add(flight_recorder_t *fr, uint64_t lba, uint32_t len, io_result_t *io_res, uint64_t t_nsec, struct timespec *t_end)
+{
+	io_record_t *rec = &fr->recent[fr->num_recorded % FLIGHT_RECORDER_LEN];
+	unsigned i;
+
+	rec->lba = lba;
+	rec->len = len;
+	rec->t_nsec = t_nsec;
+	rec->timestamp_nsec = (t_end->tv_sec - fr->start.tv_sec) * 1000000000ULL + t_end->tv_nsec - fr->start.tv_nsec;
+	rec->data = io_res->data;
+	rec->error = io_res->error;
+	rec->sense_len = io_res->sense_len < sizeof(rec->sense) ? io_res->sense_len : sizeof(rec->sense);
+	memcpy(rec->sense, io_res->sense, rec->sense_len);
+	fr->num_recorded++;
+
+	// Keep the slowest IOs seen, an IO only needs to be faster than the fastest of them to be dropped
+	if (fr->num_slowest < FLIGHT_RECORDER_SLOWEST) {
+		fr->slowest[fr->num_slowest++] = *rec;
+		if (rec->t_nsec < fr->slowest[fr->fastest_slow].t_nsec)
+			fr->fastest_slow = fr->num_slowest - 1;
+		return;
+	}
+	if (rec->t_nsec <= fr->slowest[fr->fastest_slow].t_nsec)
+		return;
+
+	fr->slowest[fr->fastest_slow] = *rec;
+	for (i = 0; i < FLIGHT_RECORDER_SLOWEST; i++) {
+		if (fr->slowest[i].t_nsec < fr->slowest[fr->fastest_slow].t_nsec)
+			fr->fastest_slow = i;
+	}
+}
+
+/* The buffer is faulted in and locked before the scan so that page faults and reclaim do not show up in the latency,
+ * the scan thread is already bound to the NUMA node of the disk so the pages are local to it.
+ */
 static void *allocate_buffer(int buf_size)
 {
 	void *buf = mmap(NULL, buf_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-	if (!buf)
+	if (buf == MAP_FAILED)
 		return NULL;
 
+#ifdef MADV_HUGEPAGE
+	// Large scan sizes get fewer TLB misses from transparent huge pages
+	madvise(buf, buf_size, MADV_HUGEPAGE);
+#endif
+
+	if (mlock(buf, buf_size) < 0) {
+		VERBOSE("Failed to lock the buffer in memory, errno=%d: %s", errno, strerror(errno));
+		memset(buf, 0, buf_size);
+	}
+
 	return buf;
 }
 
@@ -411,8 +851,8 @@ static void free_buffer(void *buf, int buf_size)
 
 static void latency_bucket_prepare(disk_t *disk, struct scan_state *state, uint64_t offset)
 {
-	assert(state->latency_bucket < disk->latency_graph_len);
-	latency_t *l = &disk->latency_graph[state->latency_bucket];
+	assert(state->latency_bucket < state->range->latency_graph_len);
+	latency_t *l = &state->range->latency_graph[state->latency_bucket];
 	const uint64_t start_sector = offset / disk->sector_size;
 
 	VVERBOSE("bucket prepare bucket=%u", state->latency_bucket);
@@ -424,29 +864,251 @@ static void latency_bucket_prepare(disk_t *disk, struct scan_state *state, uint6
 
 static void latency_bucket_finish(disk_t *disk, struct scan_state *state, uint64_t offset)
 {
-	latency_t *l = &disk->latency_graph[state->latency_bucket];
+	latency_t *l = &state->range->latency_graph[state->latency_bucket];
 	const uint64_t end_sector = offset / disk->sector_size;
 
 	VVERBOSE("bucket finish bucket=%d", state->latency_bucket);
 
 	l->end_sector = end_sector;
-	l->latency_median_msec = median(state->latency, state->latency_count);
+	if (state->latency_count > 0) {
+		const uint32_t median_usec = median(state->latency, state->latency_count);
+		l->latency_median_msec = median_usec / 1000;
+		anomaly_bucket(&state->anomaly, l->start_sector, l->end_sector, median_usec);
+	} else {
+		// Nothing was read in this bucket, all of it was skipped
+		l->latency_min_msec = 0;
+		l->latency_median_msec = 0;
+	}
+	PROBE6(bucket__finish, state->latency_bucket, l->start_sector, l->end_sector,
+			l->latency_min_msec, l->latency_median_msec, l->latency_max_msec);
 
 	state->latency_count = 0;
 	state->latency_bucket++;
 }
 
-static void latency_bucket_add(disk_t *disk, uint64_t latency, struct scan_state *state)
+static void latency_bucket_add(uint64_t latency_usec, struct scan_state *state)
+{
+	latency_t *l = &state->range->latency_graph[state->latency_bucket];
+	const uint64_t latency_msec = latency_usec / 1000;
+
+	if (latency_msec < l->latency_min_msec)
+		l->latency_min_msec = latency_msec;
+	if (l->latency_max_msec < latency_msec)
+		l->latency_max_msec = latency_msec;
+
+	// Collect info for median calculation later, in usec for the slow region detection. Reads resumed after a failing
+	// sector are more IOs than the stride has room for, the median is taken without them.
+	if (state->latency_count < state->latency_stride)
+		state->latency[state->latency_count++] = latency_usec < UINT32_MAX ? latency_usec : UINT32_MAX;
+}
+
+/* The slow regions of the range go to the disk once the range is done */
+static void anomaly_collect(disk_t *disk, struct scan_state *state)
+{
+	unsigned i;
+
+	for (i = 0; i < state->anomaly.num_regions && i < ANOMALY_MAX_REGIONS; i++) {
+		if (disk->num_slow_regions < ANOMALY_MAX_REGIONS)
+			disk->slow_regions[disk->num_slow_regions] = state->anomaly.regions[i];
+		disk->num_slow_regions++;
+	}
+	disk->num_slow_regions += state->anomaly.num_regions - i;
+}
+
+/* Latency accounting of a single IO, shared by the scan and the replay of a raw log. The latency graph and the slow
+ * regions found in it judge the disk, they follow the device time so that host scheduling jitter does not fail a disk.
+ */
+static void scan_latency_account(struct scan_state *state, uint64_t t_nsec, uint64_t device_nsec)
+{
+	hdr_record_value(state->range->histogram, t_nsec / 1000);
+	latency_bucket_add(device_nsec / 1000, state);
+}
+
+static int heatmap_io_cmp(const void *a, const void *b)
+{
+	const heatmap_io_t *io_a = a;
+	const heatmap_io_t *io_b = b;
+
+	if (io_a->bucket != io_b->bucket)
+		return io_a->bucket < io_b->bucket ? -1 : 1;
+	if (io_a->usec != io_b->usec)
+		return io_a->usec < io_b->usec ? -1 : 1;
+	return 0;
+}
+
+/* Write the records of the buckets before end_bucket, their IOs were all done. The IOs of the later buckets are kept
+ * for them.
+ */
+static void heatmap_flush(disk_t *disk, struct scan_state *state, uint64_t end_bucket)
+{
+	unsigned start = 0;
+
+	qsort(state->heatmap_ios, state->heatmap_ios_len, sizeof(heatmap_io_t), heatmap_io_cmp);
+	while (start < state->heatmap_ios_len && state->heatmap_ios[start].bucket < end_bucket) {
+		const uint32_t bucket = state->heatmap_ios[start].bucket;
+		heatmap_record_t record = {.flags = 0};
+		unsigned end;
+
+		for (end = start; end < state->heatmap_ios_len && state->heatmap_ios[end].bucket == bucket; end++) {
+			if (state->heatmap_ios[end].result == HEATMAP_IO_ERROR)
+				record.num_errors++;
+			else if (state->heatmap_ios[end].result == HEATMAP_IO_RETRY)
+				record.num_retries++;
+		}
+
+		const unsigned num_ios = end - start;
+		record.num_ios = num_ios;
+		record.min_usec = state->heatmap_ios[start].usec;
+		record.median_usec = state->heatmap_ios[start + (num_ios - 1) / 2].usec;
+		record.p99_usec = state->heatmap_ios[start + (num_ios * 99 + 99) / 100 - 1].usec;
+		record.max_usec = state->heatmap_ios[end - 1].usec;
+		heatmap_bucket_done(&disk->heatmap, bucket, &record);
+		start = end;
+	}
+
+	memmove(state->heatmap_ios, state->heatmap_ios + start, (state->heatmap_ios_len - start) * sizeof(heatmap_io_t));
+	state->heatmap_ios_len -= start;
+}
+
+static void heatmap_io_add(disk_t *disk, struct scan_state *state, uint64_t offset, uint64_t t_nsec, io_result_t *io_res, bool retried)
+{
+	const uint64_t bucket = offset / disk->heatmap.header->bucket_bytes;
+	heatmap_io_t *io;
+
+	// A sequential scan is done with a bucket once it moves past it, only the IOs of the current bucket are held
+	if (state->mode == SCAN_MODE_SEQ && state->heatmap_ios_len > 0 && state->heatmap_ios[0].bucket != bucket)
+		heatmap_flush(disk, state, bucket);
+
+	if (state->heatmap_ios_len == state->heatmap_ios_size) {
+		const unsigned size = state->heatmap_ios_size ? state->heatmap_ios_size * 2 : 4096;
+		heatmap_io_t *ios = realloc(state->heatmap_ios, size * sizeof(heatmap_io_t));
+		if (ios == NULL) {
+			ERROR("Failed to allocate memory for the heatmap, it will miss IOs");
+			return;
+		}
+		state->heatmap_ios = ios;
+		state->heatmap_ios_size = size;
+	}
+
+	io = &state->heatmap_ios[state->heatmap_ios_len++];
+	io->bucket = bucket;
+	io->usec = t_nsec / 1000 < UINT32_MAX ? t_nsec / 1000 : UINT32_MAX;
+	if (io_res->data != DATA_FULL || (io_res->error != ERROR_NONE && io_res->error != ERROR_CORRECTED && io_res->error != ERROR_NEED_RETRY))
+		io->result = HEATMAP_IO_ERROR;
+	else if (io_res->error != ERROR_NONE || retried)
+		io->result = HEATMAP_IO_RETRY;
+	else
+		io->result = HEATMAP_IO_OK;
+}
+
+static bool lba_map_append(struct scan_state *state, lba_extent_t *extent)
+{
+	if (state->lba_map_len > 0) {
+		lba_extent_t *last = &state->lba_map[state->lba_map_len-1];
+		if (last->mapped == extent->mapped && last->lba + last->num_blocks == extent->lba) {
+			last->num_blocks += extent->num_blocks;
+			return true;
+		}
+	}
+
+	if (state->lba_map_len == state->lba_map_size) {
+		unsigned new_size = state->lba_map_size ? state->lba_map_size * 2 : LBA_STATUS_BATCH;
+		lba_extent_t *new_map = realloc(state->lba_map, new_size * sizeof(lba_extent_t));
+		if (!new_map)
+			return false;
+		state->lba_map = new_map;
+		state->lba_map_size = new_size;
+	}
+
+	state->lba_map[state->lba_map_len++] = *extent;
+	return true;
+}
+
+/* Build the allocation map of the blocks in the range, the map is kept for the current latency stride only */
+static bool lba_map_load(disk_t *disk, struct scan_state *state, uint64_t start_lba, uint64_t end_lba)
+{
+	lba_extent_t *extents;
+	uint64_t lba = start_lba;
+	bool result = false;
+
+	state->lba_map_len = 0;
+
+	extents = malloc(LBA_STATUS_BATCH * sizeof(lba_extent_t));
+	if (!extents)
+		return false;
+
+	while (lba < end_lba) {
+		int num_extents = disk_lba_status(&disk->dev, lba, extents, LBA_STATUS_BATCH);
+		if (num_extents <= 0)
+			goto Exit;
+
+		const uint64_t batch_lba = lba;
+		int i;
+		for (i = 0; i < num_extents && lba < end_lba; i++) {
+			lba_extent_t *extent = &extents[i];
+			if (extent->lba + extent->num_blocks <= lba)
+				continue;
+			if (extent->lba > lba) {
+				// Hole in the reply, we'll need to ask again from here
+				break;
+			}
+
+			// Clip the extent to the range we are interested in
+			extent->num_blocks -= lba - extent->lba;
+			extent->lba = lba;
+			if (extent->lba + extent->num_blocks > end_lba)
+				extent->num_blocks = end_lba - extent->lba;
+
+			if (!lba_map_append(state, extent))
+				goto Exit;
+
+			if (extent->mapped)
+				state->mapped_bytes += extent->num_blocks * disk->sector_size;
+			else
+				state->unmapped_bytes += extent->num_blocks * disk->sector_size;
+
+			lba += extent->num_blocks;
+		}
+
+		if (lba == batch_lba) {
+			// No progress was made, the device doesn't answer about our range
+			goto Exit;
+		}
+	}
+
+	VVERBOSE("Loaded allocation map of %u extents for lba %"PRIu64" to %"PRIu64, state->lba_map_len, start_lba, end_lba);
+	result = true;
+
+Exit:
+	free(extents);
+	return result;
+}
+
+/* Check if the entire range is unmapped and can be skipped */
+static bool lba_map_is_unmapped(struct scan_state *state, uint64_t lba, uint64_t num_blocks)
 {
-	latency_t *l = &disk->latency_graph[state->latency_bucket];
+	unsigned low = 0;
+	unsigned high = state->lba_map_len;
+	const uint64_t end_lba = lba + num_blocks;
+
+	// Find the first extent that ends after our lba
+	while (low < high) {
+		unsigned mid = (low + high) / 2;
+		lba_extent_t *extent = &state->lba_map[mid];
+		if (extent->lba + extent->num_blocks <= lba)
+			low = mid + 1;
+		else
+			high = mid;
+	}
 
-	if (latency < l->latency_min_msec)
-		l->latency_min_msec = latency;
-	if (l->latency_max_msec < latency)
-		l->latency_max_msec = latency;
+	for (; low < state->lba_map_len && lba < end_lba; low++) {
+		lba_extent_t *extent = &state->lba_map[low];
+		if (extent->lba > lba || extent->mapped)
+			return false;
+		lba = extent->lba + extent->num_blocks;
+	}
 
-	// Collect info for median calculation later
-	state->latency[state->latency_count++] = latency;
+	return lba >= end_lba;
 }
 
 static const char *error_to_str(enum result_error_e err)
@@ -476,7 +1138,28 @@ static const char *data_to_str(enum result_data_e data)
 	return "unknown";
 }
 
-static bool disk_scan_part(disk_t *disk, uint64_t offset, void *data, int data_size, struct scan_state *state)
+/* The disk tells which sector failed in the INFORMATION field of the sense, or for SAT in the LBA of the ATA status
+ * return descriptor. It is only trusted when it falls within the sectors that were read.
+ */
+static bool io_failing_lba(const io_result_t *io_res, uint64_t lba, uint64_t num_blocks, uint64_t *failing_lba)
+{
+	uint64_t val;
+
+	if (io_res->info.information_valid)
+		val = io_res->info.information;
+	else if (io_res->info.ata_status_valid && (io_res->info.ata_status.status & 0x01))
+		val = io_res->info.ata_status.lba;
+	else
+		return false;
+
+	if (val < lba || val >= lba + num_blocks)
+		return false;
+	*failing_lba = val;
+	return true;
+}
+
+/* Read once, resume_offset is where the rest of the part is to be read from */
+static bool disk_scan_io(disk_t *disk, uint64_t offset, void *data, int data_size, struct scan_state *state, uint64_t *resume_offset)
 {
 	ssize_t ret;
 	struct timespec t_start;
@@ -484,33 +1167,99 @@ static bool disk_scan_part(disk_t *disk, uint64_t offset, void *data, int data_s
 	uint64_t t;
 	int error = 0;
 	io_result_t io_res;
+	uint64_t cost_start;
+	uint64_t failing_lba = 0;
+	bool failing_lba_valid = false;
 
+	*resume_offset = offset + data_size;
+	PROBE2(io__submit, offset/disk->sector_size, data_size/disk->sector_size);
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
 	ret = disk_dev_read(&disk->dev, offset, data_size, data, &io_res);
+	// The logging and accounting below may change errno
+	const int s_errno = errno;
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
 	t = (t_end.tv_sec - t_start.tv_sec) * 1000000000 +
 		t_end.tv_nsec - t_start.tv_nsec;
 	const uint64_t t_msec = t / 1000000;
 
-	// Perform logging
-	data_log_raw(&disk->data_raw, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t);
-	data_log(&disk->data_log, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t);
+	// The kernel duration is 32 bits and wraps after about 4 seconds when it is in nanoseconds, the wall time is all we have then
+	if (!io_res.device_nsec_valid || t > UINT32_MAX)
+		io_res.device_nsec = t;
+	PROBE5(io__complete, offset/disk->sector_size, data_size/disk->sector_size, t, io_res.data, io_res.error);
+
+	state->cost.num_ios++;
+
+	// A transient error is retried before it is held against the disk, only the logs see the failed attempts
+	const error_action_e action = error_policy_action(&io_res);
+	if ((action == ERROR_ACTION_RETRY || action == ERROR_ACTION_RETRY_SMALLER) && state->io_retries < ERROR_POLICY_MAX_RETRIES && disk->run) {
+		disk_lock(disk);
+		data_log_raw(&disk->data_raw, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t, state->io_retries + 1, &t_end);
+		data_log(&disk->data_log, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t, state->io_retries + 1, &t_end);
+		flight_recorder_add(&disk->flight_recorder, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t, &t_end);
+		disk_unlock(disk);
+
+		state->io_retries++;
+		if (action == ERROR_ACTION_RETRY_SMALLER && data_size > (int)disk->sector_size) {
+			state->io_size_limit = data_size / 2 / disk->sector_size * disk->sector_size;
+		} else {
+			usleep(ERROR_POLICY_BACKOFF_USEC << (state->io_retries - 1));
+		}
+		VERBOSE("Transient error at offset %"PRIu64" size %d, error=%s %02X/%02X/%02X, %s %u of %u",
+				offset, data_size, error_to_str(io_res.error), io_res.info.sense_key, io_res.info.asc, io_res.info.ascq,
+				error_action_to_str(action), state->io_retries, ERROR_POLICY_MAX_RETRIES);
+		*resume_offset = offset;
+		return true;
+	}
+	const bool retried = state->io_retries > 0;
+	state->io_retries = 0;
+
+	// Perform logging, the log files and the reports are shared by all the IO streams of the disk
+	cost_start = cost_ticks();
+	disk_lock(disk);
+	data_log_raw(&disk->data_raw, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t, 0, &t_end);
+	data_log(&disk->data_log, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t, 0, &t_end);
+	flight_recorder_add(&disk->flight_recorder, offset/disk->sector_size, data_size/disk->sector_size, &io_res, t, &t_end);
+	if (disk->flight_recorder.dump_requested) {
+		disk->flight_recorder.dump_requested = 0;
+		data_log_flight_recorder(&disk->data_log, &disk->flight_recorder, "request");
+	}
+	hdr_record_value(disk->device_histogram, io_res.device_nsec / 1000);
+	if (disk->num_zones > 0)
+		hdr_record_value(disk->zone_histogram[state->zone_type], io_res.device_nsec / 1000);
 
 	// Handle error or incomplete data
 	if (io_res.data != DATA_FULL || io_res.error != ERROR_NONE) {
-		int s_errno = errno;
-		ERROR("Error when reading at offset %" PRIu64 " size %d read %zd, errno=%d: %s", offset, data_size, ret, errno, strerror(errno));
-		ERROR("Details: error=%s data=%s %02X/%02X/%02X", error_to_str(io_res.error), data_to_str(io_res.data),
-				io_res.info.sense_key, io_res.info.asc, io_res.info.ascq);
-		report_scan_error(disk, offset, data_size, t);
 		disk->num_errors++;
+		failing_lba_valid = io_failing_lba(&io_res, offset/disk->sector_size, data_size/disk->sector_size, &failing_lba);
+		// Only a media defect is resumed after the failing sector, the sense of other errors is not about the media
+		failing_lba_valid = action == ERROR_ACTION_MEDIA && failing_lba_valid;
+		if (failing_lba_valid) {
+			if (disk->num_bad_sectors < DISK_MAX_BAD_SECTORS)
+				disk->bad_sectors[disk->num_bad_sectors] = failing_lba;
+			disk->num_bad_sectors++;
+		}
+		// Errors in a bad area come in bunches, a dump covers all the errors since the last one
+		if (disk->flight_recorder.last_dump == 0 || disk->flight_recorder.num_recorded - disk->flight_recorder.last_dump >= FLIGHT_RECORDER_LEN)
+			data_log_flight_recorder(&disk->data_log, &disk->flight_recorder, "error");
+		disk_unlock(disk);
+		cost_add(COST_LOG, cost_start);
+
+		ERROR("Error when reading at offset %" PRIu64 " size %d read %zd, errno=%d: %s", offset, data_size, ret, s_errno, strerror(s_errno));
+		char asc_str[ASC_NUM_STR_LEN];
+		ERROR("Details: error=%s data=%s %02X/%02X/%02X %s, %s%s", error_to_str(io_res.error), data_to_str(io_res.data),
+				io_res.info.sense_key, io_res.info.asc, io_res.info.ascq,
+				asc_num_to_str(io_res.info.asc, io_res.info.ascq, asc_str, sizeof(asc_str)),
+				error_action_to_str(action), retried ? " after retries" : "");
+		if (failing_lba_valid)
+			ERROR("Disk reported the failing sector at LBA %"PRIu64, failing_lba);
+		state->range->num_errors++;
 		error = 1;
-		if (io_res.error == ERROR_FATAL) {
+		if (action == ERROR_ACTION_ABORT) {
 			ERROR("Fatal error occurred, bailing out.");
 			return false;
 		}
-		if (io_res.error == ERROR_UNKNOWN || (s_errno != EIO && s_errno != 0)) {
+		if (action == ERROR_ACTION_SKIP || (s_errno != EIO && s_errno != 0)) {
 			if (state->num_unknown_errors++ > 500) {
 				ERROR("%u unknown errors occurred, assuming fatal issue.", state->num_unknown_errors);
 				return false;
@@ -520,12 +1269,28 @@ static bool disk_scan_part(disk_t *disk, uint64_t offset, void *data, int data_s
 		}
 	}
 	else {
+		disk_unlock(disk);
+		cost_add(COST_LOG, cost_start);
 		state->num_unknown_errors = 0; // Clear non-consecutive unknown errors
-		report_scan_success(disk, offset, data_size, t);
 	}
 
-	hdr_record_value(disk->histogram, t / 1000);
-	latency_bucket_add(disk, t_msec, state);
+	cost_start = cost_ticks();
+	scan_latency_account(state, t, io_res.device_nsec);
+	if (disk->heatmap.records)
+		heatmap_io_add(disk, state, offset, io_res.device_nsec, &io_res, retried);
+	cost_add(COST_HISTOGRAM, cost_start);
+
+	if (disk->num_subscriptions > 0) {
+		scan_event_t event = {
+			.type = SCAN_EVENT_IO,
+			.offset_bytes = offset,
+			.data_size = data_size,
+			.data = io_res.data,
+			.error = io_res.error,
+			.latency_nsec = t,
+		};
+		disk_publish(disk, &event);
+	}
 
 	if (t_msec > 1000) {
 		VERBOSE("Scanning at offset %" PRIu64 " took %"PRIu64" msec", offset, t_msec);
@@ -535,9 +1300,19 @@ static bool disk_scan_part(disk_t *disk, uint64_t offset, void *data, int data_s
 		if (io_res.error != ERROR_UNCORRECTED) {
 			INFO("Fixing region by rewriting, offset=%"PRIu64" size=%d", offset, data_size);
 			ret = disk_dev_write(&disk->dev, offset, data_size, data, &io_res);
+			PROBE3(fix__rewrite, offset/disk->sector_size, data_size/disk->sector_size, ret);
 			if (ret != data_size) {
 				ERROR("Error while attempting to rewrite the data! ret=%zd errno=%d: %s", ret, errno, strerror(errno));
 			}
+		} else if (failing_lba_valid) {
+			// The disk told which sector it could not read, only that one is zeroed
+			INFO("Fixing uncorrectable sector by writing zeros, lba=%"PRIu64, failing_lba);
+			memset(data, 0, disk->sector_size);
+			ret = disk_dev_write(&disk->dev, failing_lba * disk->sector_size, disk->sector_size, data, &io_res);
+			PROBE3(fix__zero, failing_lba, 1, ret);
+			if (ret != (ssize_t)disk->sector_size) {
+				ERROR("Error while attempting to overwrite uncorrectable data! ret=%zd errno=%d: %s", ret, errno, strerror(errno));
+			}
 		} else {
 			// When we correct uncorrectable errors we want to zero it out, this should reduce any confusion later on when the data is read
 			unsigned fix_offset = 0;
@@ -552,7 +1327,8 @@ static bool disk_scan_part(disk_t *disk, uint64_t offset, void *data, int data_s
 					INFO("Fixing uncorrectable region by writing zeros, offset=%"PRIu64" size=%d", offset+fix_offset, fix_size);
 					memset(data, 0, fix_size);
 					ret = disk_dev_write(&disk->dev, offset+fix_offset, fix_size, data, &io_res);
-					if (ret != data_size) {
+					PROBE3(fix__zero, (offset+fix_offset)/disk->sector_size, fix_size/disk->sector_size, ret);
+					if (ret != fix_size) {
 						ERROR("Error while attempting to overwrite uncorrectable data! ret=%zd errno=%d: %s", ret, errno, strerror(errno));
 					}
 				}
@@ -560,26 +1336,182 @@ static bool disk_scan_part(disk_t *disk, uint64_t offset, void *data, int data_s
 		}
 	}
 
+	// The sectors before the failing one were read, the rest of the part still needs to be
+	if (failing_lba_valid)
+		*resume_offset = (failing_lba + 1) * disk->sector_size;
 	return true;
 }
 
-static uint64_t calc_latency_stride(disk_t *disk)
+/* A failed read is resumed right after the sector the disk reported as failing instead of giving up on the rest of
+ * the part, each failing sector costs one more read and is found exactly. A transient error is retried, once a
+ * smaller read was needed the rest of the part is read in that size.
+ */
+static bool disk_scan_part(disk_t *disk, uint64_t offset, void *data, int data_size, struct scan_state *state)
 {
-	const uint64_t num_sectors = disk->num_bytes / disk->sector_size;
-	const uint64_t stride_size = num_sectors / disk->latency_graph_len;
-	// At this stage stride_size may have a reminder, we need to distribute the
-	// latencies a bit more to avoid it Since the remainder can never be more
-	// than the latency_graph_len we can just add one entry to all the buckets
-	return stride_size + 1;
+	const uint64_t start_offset = offset;
+	const uint64_t end_offset = offset + data_size;
+	void * const start_data = data;
+	const uint64_t range_errors = state->range->num_errors;
+
+	state->io_retries = 0;
+	state->io_size_limit = data_size;
+	while (offset < end_offset) {
+		uint64_t resume_offset;
+		uint64_t io_size = end_offset - offset;
+
+		if (io_size > state->io_size_limit)
+			io_size = state->io_size_limit;
+		if (!disk_scan_io(disk, offset, data, io_size, state, &resume_offset))
+			return false;
+		if (!disk->run)
+			break;
+		data = (char *)data + (resume_offset - offset);
+		offset = resume_offset;
+	}
+
+	// Hand the data over for classification once the whole part is in the buffer, the next part goes to a free one
+	if (disk->content_map.running && start_data == state->data && offset >= end_offset && state->range->num_errors == range_errors) {
+		const uint64_t cost_start = cost_ticks();
+		state->data = content_map_submit(&disk->content_map, start_offset, data_size, start_data);
+		cost_add(COST_CONTENT, cost_start);
+	}
+
+	return true;
 }
 
-static uint32_t *calc_scan_order_seq(disk_t *disk, uint64_t stride_size, int read_size_sectors)
+/* Keep the scan within its bandwidth limit, the limit is split evenly between the IO streams of the disk */
+static void scan_throttle(disk_t *disk, struct scan_state *state, uint64_t bytes)
 {
-	uint64_t num_reads = stride_size / read_size_sectors + 2;
-	uint32_t *order = malloc(sizeof(uint32_t) * num_reads);
+	const uint64_t limit = disk->max_bytes_per_sec / disk->num_ranges;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (limit != state->throttle_limit) {
+		// Restart the measurement when the limit changes to avoid bursts or stalls to settle the past
+		state->throttle_limit = limit;
+		state->throttle_start = now;
+		state->throttle_bytes = 0;
+	}
+	if (limit == 0)
+		return;
+
+	state->throttle_bytes += bytes;
+	const uint64_t elapsed_nsec = (now.tv_sec - state->throttle_start.tv_sec) * 1000000000ULL + now.tv_nsec - state->throttle_start.tv_nsec;
+	const uint64_t expected_nsec = state->throttle_bytes * 1000000000ULL / limit;
+	if (expected_nsec > elapsed_nsec) {
+		const uint64_t sleep_nsec = expected_nsec - elapsed_nsec;
+		struct timespec ts = {.tv_sec = sleep_nsec / 1000000000, .tv_nsec = sleep_nsec % 1000000000};
+		nanosleep(&ts, NULL);
+	}
+}
 
-	uint64_t i;
-	for (i = 0; i < num_reads-1; i++)
+/* Scan the written part of each zone that the range touches, reads beyond the write pointer are meaningless */
+static bool disk_scan_zones_part(disk_t *disk, uint64_t offset, uint64_t data_size, struct scan_state *state)
+{
+	uint64_t lba = offset / disk->sector_size;
+	const uint64_t end_lba = lba + data_size / disk->sector_size;
+	unsigned idx;
+
+	for (idx = zone_find(disk, lba); lba < end_lba && idx < disk->num_zones; idx++) {
+		zone_t *zone = &disk->zones[idx];
+		const uint64_t zone_end = zone->start_lba + zone->num_blocks;
+		uint64_t read_end = zone->start_lba + zone_readable_blocks(zone);
+
+		if (read_end > end_lba)
+			read_end = end_lba;
+
+		if (read_end > lba) {
+			state->zone_type = zone->type < ZONE_TYPE_NUM ? zone->type : ZONE_TYPE_RESERVED;
+			scan_throttle(disk, state, (read_end - lba) * disk->sector_size);
+			if (!disk_scan_part(disk, lba * disk->sector_size, state->data, (read_end - lba) * disk->sector_size, state))
+				return false;
+			lba = read_end;
+		}
+
+		const uint64_t skip_end = zone_end < end_lba ? zone_end : end_lba;
+		if (skip_end > lba) {
+			VVVERBOSE("Skipping unwritten range at lba %"PRIu64" len %"PRIu64, lba, skip_end - lba);
+			state->unwritten_bytes += (skip_end - lba) * disk->sector_size;
+		}
+		lba = skip_end;
+	}
+
+	return true;
+}
+
+/* Every word holds its own offset so that data written to the wrong place is caught, the seed changes every pass so
+ * that data left by an earlier pass is caught as well.
+ */
+static void write_verify_pattern(uint64_t *buf, unsigned len, uint64_t offset, uint64_t seed)
+{
+	unsigned i;
+
+	for (i = 0; i < len / sizeof(uint64_t); i++)
+		buf[i] = (offset + i * sizeof(uint64_t)) ^ seed;
+}
+
+static bool write_verify_check(const uint64_t *buf, unsigned len, uint64_t offset, uint64_t seed)
+{
+	unsigned i;
+
+	for (i = 0; i < len / sizeof(uint64_t); i++) {
+		if (buf[i] != ((offset + i * sizeof(uint64_t)) ^ seed))
+			return false;
+	}
+	return true;
+}
+
+/* The read back is accounted as a read of a read pass, the write is only checked for errors */
+static bool disk_write_verify_part(disk_t *disk, uint64_t offset, int data_size, struct scan_state *state)
+{
+	const uint64_t seed = (disk->num_passes + 1) * 0x9E3779B97F4A7C15ULL;
+	const uint64_t range_errors = state->range->num_errors;
+	io_result_t io_res;
+	ssize_t ret;
+
+	write_verify_pattern(state->data, data_size, offset, seed);
+	ret = disk_dev_write(&disk->dev, offset, data_size, state->data, &io_res);
+	if (ret != data_size || io_res.error != ERROR_NONE) {
+		ERROR("Error when writing at offset %"PRIu64" size %d wrote %zd, errno=%d: %s", offset, data_size, ret, errno, strerror(errno));
+		disk_lock(disk);
+		disk->num_errors++;
+		disk_unlock(disk);
+		state->range->num_errors++;
+		return error_policy_action(&io_res) != ERROR_ACTION_ABORT;
+	}
+
+	if (!disk_scan_part(disk, offset, state->data, data_size, state))
+		return false;
+
+	// A failed read is already counted as an error
+	if (state->range->num_errors == range_errors && !write_verify_check(state->data, data_size, offset, seed)) {
+		ERROR("Data read back differs from the data written at offset %"PRIu64" size %d", offset, data_size);
+		disk_lock(disk);
+		disk->num_errors++;
+		disk_unlock(disk);
+		state->range->num_errors++;
+	}
+
+	return true;
+}
+
+static uint64_t calc_latency_stride(disk_t *disk, struct scan_state *state)
+{
+	const uint64_t num_sectors = (state->end_bytes - state->start_bytes) / disk->sector_size;
+	const uint64_t stride_size = num_sectors / state->range->latency_graph_len;
+	// At this stage stride_size may have a reminder, we need to distribute the
+	// latencies a bit more to avoid it Since the remainder can never be more
+	// than the latency_graph_len we can just add one entry to all the buckets
+	return stride_size + 1;
+}
+
+static uint32_t *calc_scan_order_seq(disk_t *disk, uint64_t stride_size, int read_size_sectors)
+{
+	uint64_t num_reads = stride_size / read_size_sectors + 2;
+	uint32_t *order = malloc(sizeof(uint32_t) * num_reads);
+
+	uint64_t i;
+	for (i = 0; i < num_reads-1; i++)
 		order[i] = i * read_size_sectors * disk->sector_size;
 	order[i] = UINT32_MAX;
 
@@ -597,10 +1529,10 @@ static uint32_t *calc_scan_order_random(disk_t *disk, uint64_t stride_size, int
 		order[i] = i * read_size_sectors * disk->sector_size;
 	order[i] = UINT32_MAX;
 
-	// Shuffle it
+	// Shuffle it, the end marker stays last
 	srand(time(NULL));
 	for (i = 0; i < num_reads - 1; i++) {
-		uint64_t j = rand() % num_reads;
+		uint64_t j = rand() % (num_reads - 1);
 		if (i == j)
 			continue;
 
@@ -626,42 +1558,65 @@ static uint32_t *calc_scan_order(disk_t *disk, enum scan_mode mode, uint64_t str
 
 static void progress_calc(disk_t *disk, struct scan_state *state, uint64_t add)
 {
+	struct scan_progress *progress = state->progress;
+	const uint64_t cost_start = cost_ticks();
 	bool do_update;
 
+	disk_lock(disk);
 	if (add != 0) {
-		state->progress_bytes += add;
-		int progress_part_new = state->progress_bytes * state->progress_full / disk->num_bytes;
-		do_update = progress_part_new != state->progress_part;
-		state->progress_part = progress_part_new;
+		progress->bytes += add;
+		int progress_part_new = progress->bytes * progress->full / progress->total;
+		do_update = progress_part_new != progress->part;
+		progress->part = progress_part_new;
 	} else {
 		do_update = true;
 	}
-
-	if (do_update) {
-		report_progress(disk, state->progress_part, state->progress_full);
-	}
+	scan_event_t event = {
+		.type = SCAN_EVENT_PROGRESS,
+		.progress_part = progress->part,
+		.progress_full = progress->full,
+	};
+	disk_unlock(disk);
+
+	if (do_update)
+		disk_publish(disk, &event);
+	cost_add(COST_PROGRESS, cost_start);
 }
 
-static bool disk_scan_latency_stride(disk_t *disk, struct scan_state *state, uint64_t base_offset, uint64_t data_size, uint32_t *scan_order)
+static bool disk_scan_latency_stride(disk_t *disk, struct scan_state *state, uint64_t base_offset, uint64_t stride_end)
 {
 	unsigned i;
-	uint64_t stride_end = base_offset + state->latency_stride * disk->sector_size;
-	if (stride_end > disk->num_bytes)
-		stride_end = disk->num_bytes;
+	uint32_t *scan_order = state->scan_order;
 
 	for (i = 0; disk->run && scan_order[i] != UINT32_MAX; i++) {
 		uint64_t offset = base_offset + scan_order[i];
+		uint64_t data_size = state->data_size;
 
 		progress_calc(disk, state, data_size);
 
 		VVVERBOSE("Scanning at offset %"PRIu64" index %u", offset, i);
-		int64_t remainder = stride_end - offset;
-		if (remainder < (int64_t)data_size) {
-			data_size = remainder;
+		if (offset >= stride_end)
+			continue;
+		if (stride_end - offset < data_size) {
+			data_size = stride_end - offset;
 			VERBOSE("Last part scanning size %"PRIu64, data_size);
 		}
-		if (offset > disk->num_bytes || (offset+remainder) > disk->num_bytes)
+		if (state->lba_map_len > 0 && lba_map_is_unmapped(state, offset / disk->sector_size, data_size / disk->sector_size)) {
+			VVVERBOSE("Skipping unmapped range at offset %"PRIu64, offset);
+			continue;
+		}
+		if (disk->num_zones > 0) {
+			// Throttled by the zone scan, the unwritten ranges it skips do not count
+			if (!disk_scan_zones_part(disk, offset, data_size, state))
+				return false;
+			continue;
+		}
+		scan_throttle(disk, state, data_size);
+		if (disk->write_verify) {
+			if (!disk_write_verify_part(disk, offset, data_size, state))
+				return false;
 			continue;
+		}
 		if (!disk_scan_part(disk, offset, state->data, data_size, state))
 			return false;
 	}
@@ -686,28 +1641,259 @@ static enum conclusion conclusion_calc(disk_t *disk)
 	if (disk->num_errors > 0)
 		return CONCLUSION_FAILED_IO_ERRORS;
 
-	if (hdr_max(disk->histogram) > 10000000)
+	// Judge the disk by its own latency, host scheduling and logging jitter should not fail a disk
+	if (hdr_max(disk->device_histogram) > 10000000)
 		return CONCLUSION_FAILED_MAX_LATENCY;
 
-	if (hdr_value_at_percentile(disk->histogram, 99.99) > 8000000)
+	if (hdr_value_at_percentile(disk->device_histogram, 99.99) > 8000000)
 		return CONCLUSION_FAILED_LATENCY_PERCENTILE;
 
+	if (disk->num_slow_regions > 0)
+		return CONCLUSION_FAILED_SLOW_REGION;
+
 	VERBOSE("Disk has passed the test");
 	return CONCLUSION_PASSED;
 }
 
+/* Spin up a disk that is not active with a single read, the time it takes is kept out of the latency statistics.
+ * Scans that share the spin-up lock file spin up their disks one at a time to stay in the power budget of the chassis.
+ */
+static bool disk_spinup(disk_t *disk)
+{
+	struct timespec t_start;
+	struct timespec t_end;
+	io_result_t io_res;
+	void *data;
+	int lock_fd = -1;
+	bool result = false;
+
+	if (disk->power_state == DISK_POWER_ACTIVE)
+		return true;
+
+	data = allocate_buffer(disk->sector_size);
+	if (data == NULL) {
+		ERROR("Failed to allocate spin-up buffer, errno=%d: %s", errno, strerror(errno));
+		return false;
+	}
+
+	if (disk->spinup_lock && disk->power_state == DISK_POWER_STANDBY) {
+		lock_fd = open(disk->spinup_lock, O_RDWR|O_CREAT, 0644);
+		if (lock_fd < 0) {
+			ERROR("Failed to open spin-up lock file %s, errno=%d: %s", disk->spinup_lock, errno, strerror(errno));
+			goto Exit;
+		}
+		INFO("Waiting for other disks to spin up");
+		if (flock(lock_fd, LOCK_EX) < 0) {
+			ERROR("Failed to lock spin-up lock file %s, errno=%d: %s", disk->spinup_lock, errno, strerror(errno));
+			goto Exit;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	disk_dev_read(&disk->dev, 0, disk->sector_size, data, &io_res);
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+	disk->spinup_nsec = (t_end.tv_sec - t_start.tv_sec) * 1000000000 + t_end.tv_nsec - t_start.tv_nsec;
+	INFO("Disk spin-up from %s took %"PRIu64" msec", power_state_to_str(disk->power_state), disk->spinup_nsec / 1000000);
+	result = true;
+
+Exit:
+	if (lock_fd >= 0)
+		close(lock_fd); // Releases the lock as well
+	free_buffer(data, disk->sector_size);
+	return result;
+}
+
+static void disk_numa_bind(disk_t *disk)
+{
+	if (disk->numa_node < 0) {
+		VERBOSE("NUMA node of the disk is not known, the scan is not bound to a node");
+		return;
+	}
+
+	if (numa_node_bind(disk->numa_node))
+		INFO("Scan bound to NUMA node %d of the disk controller", disk->numa_node);
+	else
+		VERBOSE("Failed to bind the scan to NUMA node %d", disk->numa_node);
+}
+
+static void disk_monitor(disk_t *disk)
+{
+	const uint64_t cost_start = cost_ticks();
+	const uint64_t pause_before = cost_thread ? cost_thread->ticks[COST_TEMP_PAUSE] : 0;
+
+	disk_lock(disk);
+	if (disk->is_ata)
+		disk_ata_monitor(disk);
+	else
+		disk_scsi_monitor(disk);
+	disk_unlock(disk);
+
+	// The temperature pause is accounted on its own
+	cost_add(COST_MONITOR, cost_start);
+	if (cost_thread)
+		cost_thread->ticks[COST_MONITOR] -= cost_thread->ticks[COST_TEMP_PAUSE] - pause_before;
+}
+
+static bool disk_scan_range(disk_t *disk, struct scan_state *state)
+{
+	const uint64_t stride_bytes = state->latency_stride * disk->sector_size;
+	uint64_t offset;
+
+	for (offset = state->start_bytes; disk->run && offset < state->end_bytes; offset += stride_bytes) {
+		uint64_t stride_end = offset + stride_bytes;
+		if (stride_end > state->end_bytes)
+			stride_end = state->end_bytes;
+
+		VERBOSE("Scanning stride starting at %"PRIu64" done %"PRIu64"%%", offset,
+				(offset - state->start_bytes) * 100 / (state->end_bytes - state->start_bytes));
+		progress_calc(disk, state, 0);
+		latency_bucket_prepare(disk, state, offset);
+		if (state->lbp_enabled) {
+			if (!lba_map_load(disk, state, offset / disk->sector_size, stride_end / disk->sector_size)) {
+				INFO("Failed to read the allocation map, scanning all blocks from now on");
+				state->lba_map_len = 0;
+				state->lbp_enabled = false;
+			}
+		}
+		if (!disk_scan_latency_stride(disk, state, offset, stride_end))
+			return false;
+		latency_bucket_finish(disk, state, stride_end);
+		// A random scan completes its buckets only with the stride, the bucket that continues in the next stride is
+		// carried over. An interrupted stride leaves its buckets incomplete, they are not recorded.
+		if (disk->heatmap.records && disk->run && state->mode != SCAN_MODE_SEQ)
+			heatmap_flush(disk, state, stride_end < state->end_bytes ? stride_end / disk->heatmap.header->bucket_bytes : UINT64_MAX);
+
+		disk_monitor(disk);
+	}
+
+	// A sequential scan completed its buckets as it went, all but the last one
+	if (disk->heatmap.records && disk->run && state->mode == SCAN_MODE_SEQ)
+		heatmap_flush(disk, state, UINT64_MAX);
+	anomaly_finish(&state->anomaly);
+	return true;
+}
+
+static void *disk_scan_range_thread(void *arg)
+{
+	struct scan_state *state = arg;
+
+	cost_thread = &state->cost;
+	state->result = disk_scan_range(state->disk, state);
+	cost_thread = NULL;
+	return NULL;
+}
+
+static bool scan_state_init(disk_t *disk, struct scan_state *state, disk_range_t *range, uint64_t start_bytes, uint64_t end_bytes,
+		enum scan_mode mode, unsigned data_size)
+{
+	state->disk = disk;
+	state->range = range;
+	state->start_bytes = start_bytes;
+	state->end_bytes = end_bytes;
+	state->mode = mode;
+	state->data_size = data_size;
+	state->latency_bucket = 0;
+	state->latency_stride = calc_latency_stride(disk, state);
+	state->latency_count = 0;
+	// Written blocks get mapped, a write-verify pass covers the whole range
+	state->lbp_enabled = disk->lbp_supported && !disk->scan_unmapped && !disk->write_verify;
+	VVERBOSE("latency stride is %"PRIu64" for range starting at %"PRIu64, state->latency_stride, state->start_bytes);
+
+	state->latency = malloc(sizeof(uint32_t) * state->latency_stride);
+	if (state->latency == NULL) {
+		ERROR("Failed to allocate latency buffer");
+		return false;
+	}
+
+	state->data = allocate_buffer(data_size);
+	if (state->data == NULL) {
+		ERROR("Failed to allocate data buffer, errno=%d: %s", errno, strerror(errno));
+		return false;
+	}
+
+	state->scan_order = calc_scan_order(disk, mode, state->latency_stride, data_size);
+	if (!state->scan_order) {
+		ERROR("Failed to generate scan order");
+		return false;
+	}
+
+	return true;
+}
+
+static void scan_state_done(disk_t *disk, struct scan_state *state)
+{
+	int phase;
+
+	for (phase = 0; phase < COST_PHASE_NUM; phase++)
+		disk->cost.ticks[phase] += state->cost.ticks[phase];
+	disk->cost.num_ios += state->cost.num_ios;
+
+	disk->mapped_bytes += state->mapped_bytes;
+	disk->unmapped_bytes += state->unmapped_bytes;
+	disk->unwritten_bytes += state->unwritten_bytes;
+
+	// The disk histogram is shared with the range when there is only one
+	if (state->range->histogram != disk->histogram)
+		hdr_add(disk->histogram, state->range->histogram);
+
+	free(state->scan_order);
+	if (state->data)
+		free_buffer(state->data, state->data_size);
+	free(state->latency);
+	free(state->lba_map);
+	free(state->heatmap_ios);
+	anomaly_collect(disk, state);
+}
+
+static uint64_t timeval_to_nsec(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+/* Calibrate the cycle counter against the wall clock over the whole scan and find the CPU time it took */
+static void scan_cost_finish(disk_t *disk, const struct timespec *ts_start, uint64_t ticks_start, const struct rusage *ru_start)
+{
+	struct timespec ts_end;
+	struct rusage ru_end;
+	const uint64_t ticks_end = cost_ticks();
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	disk->cost.wall_nsec = (ts_end.tv_sec - ts_start->tv_sec) * 1000000000ULL + ts_end.tv_nsec - ts_start->tv_nsec;
+	disk->cost.nsec_per_tick = ticks_end > ticks_start ? (double)disk->cost.wall_nsec / (ticks_end - ticks_start) : 1.0;
+	disk->cost.cpu_nsec = timeval_to_nsec(&ru_end.ru_utime) + timeval_to_nsec(&ru_end.ru_stime)
+		- timeval_to_nsec(&ru_start->ru_utime) - timeval_to_nsec(&ru_start->ru_stime);
+}
+
 int disk_scan(disk_t *disk, enum scan_mode mode, unsigned data_size)
 {
 	disk->run = 1;
-	void *data = allocate_buffer(data_size);
-	uint32_t *scan_order = NULL;
 	int result = 0;
-	struct scan_state state = {.latency = NULL, .progress_bytes = 0, .progress_full = 1000};
+	struct scan_progress progress = {.bytes = 0, .total = 0, .part = 0, .full = 1000};
+	struct scan_state states[DISK_MAX_RANGES];
+	unsigned num_states = 0;
+	unsigned i;
 	struct timespec ts_start;
 	struct timespec ts_end;
+	uint64_t ticks_start;
+	struct rusage ru_start;
 	time_t scan_time;
 
 	disk->conclusion = CONCLUSION_SCAN_PROBLEM;
+	disk->num_slow_regions = 0;
+	disk->num_bad_sectors = 0;
+	memset(&disk->cost, 0, sizeof(disk->cost));
+	memset(states, 0, sizeof(states));
+	flight_recorder_start(&disk->flight_recorder);
+
+	if (disk->power_state == DISK_POWER_STANDBY && disk->defer_standby) {
+		INFO("Disk %s is in standby, deferring the scan", disk->path);
+		disk->conclusion = CONCLUSION_DEFERRED;
+		disk->run = 0;
+		return 0;
+	}
 
 	if (data_size % disk->sector_size != 0) {
 		data_size -= data_size % disk->sector_size;
@@ -716,71 +1902,503 @@ int disk_scan(disk_t *disk, enum scan_mode mode, unsigned data_size)
 		ERROR("Cannot scan data not in multiples of the sector size, adjusted scan size to %u", data_size);
 	}
 
+	// Bind before any buffer is allocated or scan thread created, both follow the binding
+	disk_numa_bind(disk);
+	// The classifier starts before the scan turns realtime, it should not compete with the IO threads
+	if (disk->content_map.enabled && !content_map_start(&disk->content_map, disk->num_bytes, data_size))
+		INFO("Scanning without a content map");
 	set_realtime(true);
 	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	ticks_start = cost_ticks();
+	getrusage(RUSAGE_SELF, &ru_start);
+
+	if (!disk_spinup(disk)) {
+		ERROR("Failed to spin up the disk");
+		result = 1;
+		goto Exit;
+	}
 
 	INFO("Scanning disk %s in %u byte steps", disk->path, data_size);
 	scan_time = time(NULL);
 	INFO("Scan started at: %s", ctime(&scan_time));
 	VVVERBOSE("Using buffer of size %d", data_size);
 
-	if (data == NULL) {
-		ERROR("Failed to allocate data buffer, errno=%d: %s", errno, strerror(errno));
-		result = 1;
-		goto Exit;
-	}
+	const uint64_t scan_end_bytes = disk->scan_end_bytes ? disk->scan_end_bytes : disk->num_bytes;
+	for (i = 0; i < disk->num_ranges; i++) {
+		disk_range_t *range = &disk->ranges[i];
+		const uint64_t start_bytes = range->start_bytes > disk->scan_start_bytes ? range->start_bytes : disk->scan_start_bytes;
+		const uint64_t end_bytes = range->end_bytes < scan_end_bytes ? range->end_bytes : scan_end_bytes;
+		struct scan_state *state = &states[num_states];
 
-	uint64_t offset;
-	const uint64_t disk_size_bytes = disk->num_bytes;
-	const uint64_t latency_stride = calc_latency_stride(disk);
-	VVERBOSE("latency stride is %"PRIu64, latency_stride);
-
-	state.latency_bucket = 0;
-	state.latency_stride = latency_stride;
-	state.latency_count = 0;
-	state.latency = malloc(sizeof(uint32_t) * latency_stride);
-	state.data = data;
-
-	scan_order = calc_scan_order(disk, mode, latency_stride, data_size);
-	if (!scan_order) {
+		if (start_bytes >= end_bytes)
+			continue;
+
+		num_states++;
+		state->progress = &progress;
+		progress.total += end_bytes - start_bytes;
+		if (!scan_state_init(disk, state, range, start_bytes, end_bytes, mode, data_size)) {
+			result = 1;
+			goto Exit;
+		}
+	}
+	if (num_states == 0) {
+		ERROR("Nothing to scan between offsets %"PRIu64" and %"PRIu64, disk->scan_start_bytes, scan_end_bytes);
 		result = 1;
-		ERROR("Failed to generate scan order");
 		goto Exit;
 	}
+	if (disk->scan_start_bytes > 0 || scan_end_bytes < disk->num_bytes)
+		INFO("Scanning only offsets %"PRIu64" to %"PRIu64, disk->scan_start_bytes, scan_end_bytes);
 
 	verbose_extra_newline = 1;
-	for (offset = 0; disk->run && offset < disk_size_bytes; offset += latency_stride * disk->sector_size) {
-		VERBOSE("Scanning stride starting at %"PRIu64" done %"PRIu64"%%", offset, offset*100/disk_size_bytes);
-		progress_calc(disk, &state, 0);
-		latency_bucket_prepare(disk, &state, offset);
-		if (!disk_scan_latency_stride(disk, &state, offset, data_size, scan_order))
-			break;
-		latency_bucket_finish(disk, &state, offset + latency_stride * disk->sector_size);
-
-		if (disk->is_ata)
-			disk_ata_monitor(disk);
-		else
-			disk_scsi_monitor(disk);
+	if (num_states == 1) {
+		cost_thread = &states[0].cost;
+		states[0].result = disk_scan_range(disk, &states[0]);
+		cost_thread = NULL;
+	} else {
+		// Each actuator streams at its full rate, drive each of them from its own thread
+		for (i = 0; i < num_states; i++) {
+			if (pthread_create(&states[i].thread, NULL, disk_scan_range_thread, &states[i]) != 0) {
+				ERROR("Failed to start scan thread for range %u, errno=%d: %s", i, errno, strerror(errno));
+				disk->run = 0;
+				break;
+			}
+		}
+		num_states = i;
+		for (i = 0; i < num_states; i++)
+			pthread_join(states[i].thread, NULL);
 	}
 	verbose_extra_newline = 0;
 
 	if (!disk->run) {
 		INFO("Disk scan interrupted");
 		disk->conclusion = CONCLUSION_ABORTED;
-	} else {
-		disk->conclusion = conclusion_calc(disk);
 	}
-	report_scan_done(disk);
 
 Exit:
+	content_map_stop(&disk->content_map);
+	for (i = 0; i < num_states; i++)
+		scan_state_done(disk, &states[i]);
+	scan_cost_finish(disk, &ts_start, ticks_start, &ru_start);
+	if (result == 0) {
+		if (disk->conclusion != CONCLUSION_ABORTED)
+			disk->conclusion = conclusion_calc(disk);
+		scan_event_t event = { .type = SCAN_EVENT_DONE };
+		disk_publish(disk, &event);
+	}
+	// The results of the disk are only valid until the next scan, the subscribers are done with them by then
+	for (i = 0; i < disk->num_subscriptions; i++)
+		scan_subscription_flush(disk->subscriptions[i]);
+
 	clock_gettime(CLOCK_MONOTONIC, &ts_end);
 	set_realtime(false);
-	free(scan_order);
-	free_buffer(data, data_size);
-	free(state.latency);
 	disk->run = 0;
 	scan_time = time(NULL);
 	INFO("Scan ended at: %s", ctime(&scan_time));
 	INFO("Scan took %d second", (int)(ts_end.tv_sec - ts_start.tv_sec));
 	return result;
 }
+
+/* A pass repeats the one before it when its latencies are within this of the earlier ones */
+#define BURNIN_CONVERGE_PCT 10
+#define BURNIN_CONVERGE_MIN_USEC 2000
+
+/* Every pass starts from a clean slate, only the results kept in the passes carry over */
+static void disk_scan_reset(disk_t *disk)
+{
+	unsigned i;
+
+	hdr_reset(disk->histogram);
+	hdr_reset(disk->device_histogram);
+	for (i = 0; i < ZONE_TYPE_NUM; i++) {
+		if (disk->zone_histogram[i])
+			hdr_reset(disk->zone_histogram[i]);
+	}
+	for (i = 0; i < disk->num_ranges; i++) {
+		if (disk->ranges[i].histogram != disk->histogram)
+			hdr_reset(disk->ranges[i].histogram);
+		disk->ranges[i].num_errors = 0;
+	}
+	memset(disk->latency_graph, 0, disk->latency_graph_len * sizeof(latency_t));
+	if (disk->heatmap.records)
+		memset(disk->heatmap.records, 0, disk->heatmap.header->num_buckets * sizeof(heatmap_record_t));
+	disk->num_errors = 0;
+	disk->mapped_bytes = 0;
+	disk->unmapped_bytes = 0;
+	disk->unwritten_bytes = 0;
+}
+
+static bool disk_pass_record(disk_t *disk, disk_pass_t *pass)
+{
+	pass->write_verify = disk->write_verify;
+	pass->conclusion = disk->conclusion;
+	pass->num_errors = disk->num_errors;
+	pass->wall_nsec = disk->cost.wall_nsec;
+	if (disk->is_ata && disk->state.ata.smart_num > 0) {
+		pass->has_smart = true;
+		pass->temp = disk->state.ata.last_temp;
+		pass->reallocs = disk->state.ata.last_reallocs;
+		pass->pending_reallocs = disk->state.ata.last_pending_reallocs;
+		pass->crc_errors = disk->state.ata.last_crc_errors;
+	}
+
+	if (hdr_init(1, 60*1000*1000, 3, &pass->device_histogram) != 0)
+		return false;
+	hdr_add(pass->device_histogram, disk->device_histogram);
+
+	pass->latency_graph = malloc(disk->latency_graph_len * sizeof(latency_t));
+	if (pass->latency_graph == NULL)
+		return false;
+	memcpy(pass->latency_graph, disk->latency_graph, disk->latency_graph_len * sizeof(latency_t));
+	return true;
+}
+
+static bool burnin_close(int64_t prev, int64_t cur)
+{
+	const int64_t diff = cur > prev ? cur - prev : prev - cur;
+	return diff <= BURNIN_CONVERGE_MIN_USEC || diff * 100 <= prev * BURNIN_CONVERGE_PCT;
+}
+
+/* The last pass converged when it found nothing new and its latencies, overall and in every zone, are close to those
+ * of the last pass of the same kind.
+ */
+static bool disk_burnin_converged(disk_t *disk)
+{
+	disk_pass_t *cur = &disk->passes[disk->num_passes - 1];
+	disk_pass_t *prev = NULL;
+	unsigned i;
+
+	for (i = disk->num_passes - 1; i > 0; i--) {
+		if (disk->passes[i - 1].write_verify == cur->write_verify) {
+			prev = &disk->passes[i - 1];
+			break;
+		}
+	}
+	if (prev == NULL)
+		return false;
+
+	if (cur->num_errors > 0)
+		return false;
+	if (cur->has_smart && prev->has_smart &&
+			(cur->reallocs != prev->reallocs || cur->pending_reallocs != prev->pending_reallocs)) {
+		VERBOSE("Reallocations changed from %d/%d to %d/%d, not converged", prev->reallocs, prev->pending_reallocs,
+				cur->reallocs, cur->pending_reallocs);
+		return false;
+	}
+
+	if (!burnin_close(hdr_value_at_percentile(prev->device_histogram, 99.0), hdr_value_at_percentile(cur->device_histogram, 99.0)) ||
+		!burnin_close(hdr_value_at_percentile(prev->device_histogram, 99.99), hdr_value_at_percentile(cur->device_histogram, 99.99))) {
+		VERBOSE("Device latency percentiles still change, not converged");
+		return false;
+	}
+
+	for (i = 0; i < disk->latency_graph_len; i++) {
+		if (!burnin_close(prev->latency_graph[i].latency_median_msec * 1000, cur->latency_graph[i].latency_median_msec * 1000)) {
+			VERBOSE("Zone %u median latency changed from %u to %u msec, not converged", i,
+					prev->latency_graph[i].latency_median_msec, cur->latency_graph[i].latency_median_msec);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int disk_burnin(disk_t *disk, enum scan_mode mode, unsigned data_size, unsigned max_passes, bool write_verify)
+{
+	unsigned pass;
+	int result = 0;
+
+	if (write_verify && disk->num_zones > 0) {
+		ERROR("Zoned disks can only be written sequentially, write-verify is not supported");
+		return 1;
+	}
+	if (max_passes > DISK_MAX_PASSES) {
+		ERROR("At most %u passes are supported, limiting the burn-in to it", DISK_MAX_PASSES);
+		max_passes = DISK_MAX_PASSES;
+	}
+
+	disk->burnin = BURNIN_NOT_CONVERGED;
+	for (pass = 0; pass < max_passes; pass++) {
+		// Read first to see the disk as it came, then alternate so that every read pass follows a write
+		disk->write_verify = write_verify && pass % 2 == 1;
+		// Once written the disk only holds the test pattern, the content map of the first pass is kept
+		if (disk->write_verify)
+			disk->content_map.enabled = false;
+		if (pass > 0)
+			disk_scan_reset(disk);
+
+		INFO("Burn-in pass %u of %u, %s", pass + 1, max_passes, disk->write_verify ? "write-verify" : "read");
+		if (disk_scan(disk, mode, data_size)) {
+			result = 1;
+			break;
+		}
+		// A pass that did not cover the disk has nothing to compare
+		if (disk->conclusion < CONCLUSION_PASSED) {
+			disk->burnin = BURNIN_ABORTED;
+			break;
+		}
+
+		if (!disk_pass_record(disk, &disk->passes[disk->num_passes++])) {
+			ERROR("Failed to allocate memory for the results of pass %u", pass + 1);
+			result = 1;
+			break;
+		}
+
+		if (disk->conclusion != CONCLUSION_PASSED) {
+			INFO("Disk %s in pass %u, stopping the burn-in", conclusion_to_str(disk->conclusion), pass + 1);
+			disk->burnin = BURNIN_FAILED;
+			break;
+		}
+		if (disk_burnin_converged(disk)) {
+			INFO("Disk results converged in pass %u, stopping the burn-in", pass + 1);
+			disk->burnin = BURNIN_CONVERGED;
+			break;
+		}
+	}
+
+	disk->write_verify = false;
+	return result;
+}
+
+#define REPLAY_LINE_LEN 4096
+
+static enum result_error_e replay_error_from_name(const char *name)
+{
+	if (strcmp(name, "error_none") == 0)
+		return ERROR_NONE;
+	else if (strcmp(name, "error_corrected") == 0)
+		return ERROR_CORRECTED;
+	else if (strcmp(name, "error_uncorrected") == 0)
+		return ERROR_UNCORRECTED;
+	else if (strcmp(name, "error_need_retry") == 0)
+		return ERROR_NEED_RETRY;
+	else if (strcmp(name, "error_fatal") == 0)
+		return ERROR_FATAL;
+	return ERROR_UNKNOWN;
+}
+
+static void replay_parse_ranges(const char *s, lba_range_t *ranges, int *num_ranges)
+{
+	uint64_t start;
+	uint64_t end;
+
+	*num_ranges = 0;
+	while ((s = strstr(s, "{\"StartSector\"")) != NULL && *num_ranges < DISK_MAX_RANGES) {
+		if (sscanf(s, "{\"StartSector\": %"SCNu64", \"EndSector\": %"SCNu64"}", &start, &end) != 2 || end < start)
+			break;
+		ranges[*num_ranges].start_lba = start;
+		ranges[*num_ranges].num_blocks = end - start;
+		(*num_ranges)++;
+		s++;
+	}
+}
+
+static void replay_parse_disk(const char *line, disk_t *disk, uint64_t *num_sectors, lba_range_t *ranges, int *num_ranges)
+{
+	const char *s = line + strspn(line, " \t");
+
+	if (strncmp(s, "\"Ranges\": [", 11) == 0) {
+		replay_parse_ranges(s, ranges, num_ranges);
+		return;
+	}
+	sscanf(s, "\"Vendor\": \"%63[^\"]\"", disk->vendor);
+	sscanf(s, "\"Model\": \"%63[^\"]\"", disk->model);
+	sscanf(s, "\"FwRev\": \"%63[^\"]\"", disk->fw_rev);
+	sscanf(s, "\"Serial\": \"%63[^\"]\"", disk->serial);
+	sscanf(s, "\"NumSectors\": %"SCNu64, num_sectors);
+	sscanf(s, "\"SectorSize\": %"SCNu64, &disk->sector_size);
+}
+
+/* The raw log has an IO per line, as written by data_log_raw() */
+static bool replay_parse_io(const char *line, uint64_t *lba, uint32_t *len, uint64_t *t_nsec, io_result_t *io_res)
+{
+	char data[32];
+	char error[32];
+	const char *s = strstr(line, "{\"LBA\"");
+	const char *device;
+
+	if (s == NULL)
+		return false;
+	if (sscanf(s, "{\"LBA\": %"SCNu64", \"Len\": %"SCNu32", \"LatencyNSec\": %"SCNu64", \"Data\": \"%31[^\"]\", \"Error\": \"%31[^\"]\"",
+				lba, len, t_nsec, data, error) != 5)
+		return false;
+
+	memset(io_res, 0, sizeof(*io_res));
+	if (strcmp(data, "data_full") == 0)
+		io_res->data = DATA_FULL;
+	else if (strcmp(data, "data_partial") == 0)
+		io_res->data = DATA_PARTIAL;
+	else
+		io_res->data = DATA_NONE;
+	io_res->error = replay_error_from_name(error);
+
+	// Older logs have no device latency, the end-to-end latency stands in for it
+	device = strstr(s, "\"DeviceNSec\": ");
+	if (device == NULL || sscanf(device, "\"DeviceNSec\": %"SCNu64, &io_res->device_nsec) != 1)
+		io_res->device_nsec = *t_nsec;
+	return true;
+}
+
+/* The log is read a line at a time so that logs of any size are replayed in bounded memory */
+int disk_replay(disk_t *disk, const char *raw_log, unsigned latency_graph_len)
+{
+	char line[REPLAY_LINE_LEN];
+	struct scan_state states[DISK_MAX_RANGES];
+	lba_range_t ranges[DISK_MAX_RANGES];
+	int num_ranges = 0;
+	uint64_t num_sectors = 0;
+	uint64_t num_ios = 0;
+	bool has_raw = false;
+	int result = 1;
+	unsigned i;
+	FILE *f;
+
+	memset(disk, 0, sizeof(*disk));
+	memset(states, 0, sizeof(states));
+	pthread_mutex_init(&disk->lock, NULL);
+	disk->conclusion = CONCLUSION_SCAN_PROBLEM;
+	strncpy(disk->path, raw_log, sizeof(disk->path));
+	disk->path[sizeof(disk->path)-1] = 0;
+
+	f = fopen(raw_log, "r");
+	if (f == NULL) {
+		ERROR("Failed to open raw log %s, errno=%d: %s", raw_log, errno, strerror(errno));
+		return 1;
+	}
+
+	// The raw log is only ever json, do not go through all of a binary file looking for its lines
+	const int first = fgetc(f);
+	if (first != '{') {
+		ERROR("%s is not a raw log of diskscan, only the json raw log written with --raw-log can be replayed", raw_log);
+		goto Exit;
+	}
+	ungetc(first, f);
+
+	// The disk description comes first, then the IOs
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strstr(line, "\"Raw\": [") != NULL) {
+			has_raw = true;
+			break;
+		}
+		replay_parse_disk(line, disk, &num_sectors, ranges, &num_ranges);
+	}
+	if (!has_raw || num_sectors == 0 || disk->sector_size == 0) {
+		ERROR("%s is not a raw log of diskscan", raw_log);
+		goto Exit;
+	}
+
+	disk->num_bytes = num_sectors * disk->sector_size;
+	hdr_init(1, 60*1000*1000, 3, &disk->histogram);
+	hdr_init(1, 60*1000*1000, 3, &disk->device_histogram);
+	disk->latency_graph_len = latency_graph_len;
+	disk->latency_graph = calloc(latency_graph_len, sizeof(latency_t));
+	if (disk->histogram == NULL || disk->device_histogram == NULL || disk->latency_graph == NULL) {
+		ERROR("Failed to allocate memory to replay %s", raw_log);
+		goto Exit;
+	}
+
+	// Logs from before the ranges were recorded are replayed as a whole
+	if (num_ranges < 1 || (unsigned)num_ranges > latency_graph_len || !disk_ranges_valid(ranges, num_ranges, num_sectors)) {
+		num_ranges = 1;
+		ranges[0].start_lba = 0;
+		ranges[0].num_blocks = num_sectors;
+	}
+	if (!disk_ranges_init(disk, ranges, num_ranges)) {
+		ERROR("Failed to allocate memory to replay %s", raw_log);
+		goto Exit;
+	}
+
+	for (i = 0; i < disk->num_ranges; i++) {
+		struct scan_state *state = &states[i];
+
+		state->disk = disk;
+		state->range = &disk->ranges[i];
+		state->start_bytes = state->range->start_bytes;
+		state->end_bytes = state->range->end_bytes;
+		state->latency_stride = calc_latency_stride(disk, state);
+		state->latency = malloc(sizeof(uint32_t) * state->latency_stride);
+		if (state->latency == NULL) {
+			ERROR("Failed to allocate latency buffer");
+			goto Exit;
+		}
+		latency_bucket_prepare(disk, state, state->start_bytes);
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		io_result_t io_res;
+		uint64_t lba;
+		uint32_t len;
+		uint64_t t_nsec;
+
+		if (!replay_parse_io(line, &lba, &len, &t_nsec, &io_res))
+			continue;
+		// The live scan holds only the final result of a retried IO against the disk
+		if (strstr(line, "\"Retry\": ") != NULL)
+			continue;
+
+		// The ranges are scanned concurrently, each one in order and only the IOs in a stride may be out of order
+		const uint64_t offset = lba * disk->sector_size;
+		for (i = 0; i + 1 < disk->num_ranges && offset >= disk->ranges[i].end_bytes; i++)
+			;
+		struct scan_state *state = &states[i];
+		disk_range_t *range = state->range;
+		const uint64_t stride_bytes = state->latency_stride * disk->sector_size;
+		const uint64_t bucket = offset > state->start_bytes ? (offset - state->start_bytes) / stride_bytes : 0;
+		while (state->latency_bucket < bucket && state->latency_bucket + 1 < range->latency_graph_len) {
+			latency_bucket_finish(disk, state, state->start_bytes + (state->latency_bucket + 1) * stride_bytes);
+			latency_bucket_prepare(disk, state, state->start_bytes + state->latency_bucket * stride_bytes);
+		}
+
+		hdr_record_value(disk->device_histogram, io_res.device_nsec / 1000);
+		if (io_res.data != DATA_FULL || io_res.error != ERROR_NONE) {
+			disk->num_errors++;
+			range->num_errors++;
+		}
+		// A log that is not from a single scan could overflow the median buffer of the stride
+		if (state->latency_count < state->latency_stride)
+			scan_latency_account(state, t_nsec, io_res.device_nsec);
+		num_ios++;
+	}
+	if (ferror(f)) {
+		ERROR("Failed to read raw log %s, errno=%d: %s", raw_log, errno, strerror(errno));
+		goto Exit;
+	}
+
+	for (i = 0; i < disk->num_ranges; i++) {
+		struct scan_state *state = &states[i];
+		const uint64_t last_end = state->start_bytes + (state->latency_bucket + 1) * state->latency_stride * disk->sector_size;
+
+		latency_bucket_finish(disk, state, last_end < state->end_bytes ? last_end : state->end_bytes);
+		anomaly_finish(&state->anomaly);
+		anomaly_collect(disk, state);
+		// Merge the ranges, as the live scan does
+		if (state->range->histogram != disk->histogram)
+			hdr_add(disk->histogram, state->range->histogram);
+	}
+
+	disk->conclusion = conclusion_calc(disk);
+	INFO("Replayed %"PRIu64" IOs of %s in %u ranges: %s", num_ios, raw_log, disk->num_ranges, conclusion_to_str(disk->conclusion));
+	result = 0;
+
+Exit:
+	for (i = 0; i < DISK_MAX_RANGES; i++)
+		free(states[i].latency);
+	fclose(f);
+	return result;
+}
+
+void disk_replay_close(disk_t *disk)
+{
+	free(disk->histogram);
+	disk->histogram = NULL;
+	free(disk->device_histogram);
+	disk->device_histogram = NULL;
+	free(disk->latency_graph);
+	disk->latency_graph = NULL;
+	if (disk->num_ranges > 1) {
+		unsigned i;
+		for (i = 0; i < disk->num_ranges; i++)
+			free(disk->ranges[i].histogram);
+	}
+	disk->num_ranges = 0;
+	pthread_mutex_destroy(&disk->lock);
+}
@@ -0,0 +1,145 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "error_policy.h"
+
+#define ANY ERROR_POLICY_ANY
+#define SENSE(key, asc, ascq, error, action) { SENSE_KEY_##key, asc, ascq, TRANSPORT_OK, ERROR_##error, ERROR_ACTION_##action }
+#define TRANSPORT(transport, error, action) { ANY, ANY, ANY, TRANSPORT_##transport, ERROR_##error, ERROR_ACTION_##action }
+
+static const error_policy_t error_policy[] = {
+	// The command never got a proper answer from the device
+	TRANSPORT(BUSY,         NEED_RETRY, RETRY),
+	TRANSPORT(RESET,        NEED_RETRY, RETRY),
+	TRANSPORT(DISRUPTED,    NEED_RETRY, RETRY),
+	TRANSPORT(TIMEOUT,      NEED_RETRY, RETRY_SMALLER),
+	TRANSPORT(ERROR,        UNKNOWN,    RETRY_SMALLER),
+	TRANSPORT(NO_CONNECT,   FATAL,      ABORT),
+
+	SENSE(NO_SENSE,        ANY,  ANY,  NONE,        CONTINUE),
+	SENSE(RECOVERED_ERROR, ANY,  ANY,  CORRECTED,   CONTINUE),
+
+	SENSE(NOT_READY,       0x04, 0x03, FATAL,       ABORT), // Manual intervention required
+	SENSE(NOT_READY,       0x3A, ANY,  FATAL,       ABORT), // Medium not present
+	SENSE(NOT_READY,       0x4C, ANY,  FATAL,       ABORT), // Logical unit failed self-configuration
+	SENSE(NOT_READY,       ANY,  ANY,  NEED_RETRY,  RETRY), // Becoming ready, spinning up, in process of...
+
+	SENSE(MEDIUM_ERROR,    0x31, ANY,  FATAL,       ABORT), // Medium format corrupted
+	SENSE(MEDIUM_ERROR,    ANY,  ANY,  UNCORRECTED, MEDIA),
+
+	SENSE(HARDWARE_ERROR,  0x47, ANY,  NEED_RETRY,  RETRY), // Parity or CRC error on the link
+	SENSE(HARDWARE_ERROR,  0x11, ANY,  UNCORRECTED, MEDIA), // Unrecovered read error reported as hardware
+	SENSE(HARDWARE_ERROR,  ANY,  ANY,  FATAL,       ABORT),
+
+	SENSE(ILLEGAL_REQUEST, 0x21, ANY,  UNKNOWN,     SKIP), // LBA out of range, the disk is smaller than reported
+	SENSE(ILLEGAL_REQUEST, 0x24, 0x00, NEED_RETRY,  RETRY_SMALLER), // Invalid field in CDB, the transfer length may be too long
+	SENSE(ILLEGAL_REQUEST, ANY,  ANY,  FATAL,       ABORT),
+
+	SENSE(UNIT_ATTENTION,  ANY,  ANY,  NEED_RETRY,  RETRY), // Reset, power on, parameters changed
+
+	SENSE(ABORTED_COMMAND, 0x10, ANY,  UNCORRECTED, MEDIA), // Protection information check failed
+	SENSE(ABORTED_COMMAND, 0x11, ANY,  UNCORRECTED, MEDIA), // Unrecovered read error as reported by some SAT layers
+	SENSE(ABORTED_COMMAND, 0x4B, ANY,  NEED_RETRY,  RETRY_SMALLER), // Data phase error
+	SENSE(ABORTED_COMMAND, ANY,  ANY,  NEED_RETRY,  RETRY), // Link CRC, overlapped commands, ATA passthrough aborts
+
+	SENSE(DATA_PROTECT,    ANY,  ANY,  FATAL,       ABORT),
+	SENSE(BLANK_CHECK,     ANY,  ANY,  FATAL,       ABORT),
+	SENSE(VENDOR_SPECIFIC, ANY,  ANY,  FATAL,       ABORT),
+	SENSE(COPY_ABORTED,    ANY,  ANY,  FATAL,       ABORT),
+	SENSE(RESERVED_C,      ANY,  ANY,  FATAL,       ABORT),
+	SENSE(VOLUME_OVERFLOW, ANY,  ANY,  FATAL,       ABORT),
+	SENSE(MISCOMPARE,      ANY,  ANY,  FATAL,       ABORT),
+	SENSE(COMPLETED,       ANY,  ANY,  FATAL,       ABORT),
+};
+
+#define NUM_POLICIES (sizeof(error_policy) / sizeof(error_policy[0]))
+
+// Sense that the table does not know, parsed from a broken device or with a sense key beyond the standard ones
+static const error_policy_t error_policy_unknown = { ANY, ANY, ANY, TRANSPORT_OK, ERROR_UNKNOWN, ERROR_ACTION_SKIP };
+
+static inline bool field_match(int field, int val)
+{
+	return field == ANY || field == val;
+}
+
+const error_policy_t *error_policy_sense(const sense_info_t *info)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_POLICIES; i++) {
+		const error_policy_t *p = &error_policy[i];
+
+		if (p->transport == TRANSPORT_OK && field_match(p->sense_key, info->sense_key) &&
+				field_match(p->asc, info->asc) && field_match(p->ascq, info->ascq))
+			return p;
+	}
+
+	return &error_policy_unknown;
+}
+
+const error_policy_t *error_policy_transport(enum result_transport_e transport)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_POLICIES; i++) {
+		if (error_policy[i].transport == transport)
+			return &error_policy[i];
+	}
+
+	return &error_policy_unknown;
+}
+
+error_action_e error_policy_action(const io_result_t *io_res)
+{
+	// The common case stays out of the table
+	if (io_res->data == DATA_FULL && io_res->error == ERROR_NONE)
+		return ERROR_ACTION_CONTINUE;
+
+	if (io_res->transport != TRANSPORT_OK)
+		return error_policy_transport(io_res->transport)->action;
+	if (io_res->sense_len > 0 && io_res->error != ERROR_UNKNOWN)
+		return error_policy_sense(&io_res->info)->action;
+
+	// No sense to go by, only the platform's view of the error
+	switch (io_res->error) {
+		case ERROR_NONE: return ERROR_ACTION_RETRY; // Short transfer without a reason
+		case ERROR_CORRECTED: return ERROR_ACTION_CONTINUE;
+		case ERROR_UNCORRECTED: return ERROR_ACTION_MEDIA;
+		case ERROR_NEED_RETRY: return ERROR_ACTION_RETRY;
+		case ERROR_FATAL: return ERROR_ACTION_ABORT;
+		case ERROR_UNKNOWN: return ERROR_ACTION_SKIP;
+	}
+
+	return ERROR_ACTION_SKIP;
+}
+
+const char *error_action_to_str(error_action_e action)
+{
+	switch (action) {
+		case ERROR_ACTION_CONTINUE: return "continue";
+		case ERROR_ACTION_RETRY: return "retry";
+		case ERROR_ACTION_RETRY_SMALLER: return "retry smaller";
+		case ERROR_ACTION_SKIP: return "skip";
+		case ERROR_ACTION_MEDIA: return "media defect";
+		case ERROR_ACTION_ABORT: return "abort";
+	}
+
+	return "unknown";
+}
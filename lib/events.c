@@ -0,0 +1,205 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "events.h"
+#include "verbose.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Events that are fewer than a batch are still delivered after this long */
+#define SCAN_EVENT_LINGER_MSEC 100
+
+struct scan_subscription_t {
+	scan_filter_t filter;
+	unsigned batch;
+	scan_event_cb_t cb;
+	void *ctx;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;      /* New events, a flush or stop for the thread */
+	pthread_cond_t delivered; /* The thread delivered a batch */
+	bool stop;
+	bool flush;
+
+	scan_event_t ring[SCAN_EVENT_RING_LEN];
+	uint64_t head; /* Next event to deliver */
+	uint64_t tail; /* Next free slot, head and tail only grow and are taken modulo the ring length */
+	uint64_t num_delivered;
+	uint64_t num_dropped;
+};
+
+static bool event_filter(const scan_filter_t *filter, const scan_event_t *event)
+{
+	if (!(filter->types & SCAN_EVENT_MASK(event->type)))
+		return false;
+	if (event->type != SCAN_EVENT_IO || (!filter->io_errors && filter->io_min_latency_nsec == 0))
+		return true;
+
+	if (filter->io_errors && (event->data != DATA_FULL || event->error != ERROR_NONE))
+		return true;
+	if (filter->io_min_latency_nsec > 0 && event->latency_nsec >= filter->io_min_latency_nsec)
+		return true;
+	return false;
+}
+
+static void linger_deadline(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec += SCAN_EVENT_LINGER_MSEC * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static void *subscription_thread(void *arg)
+{
+	scan_subscription_t *sub = arg;
+	scan_event_t batch[SCAN_EVENT_MAX_BATCH];
+
+	pthread_mutex_lock(&sub->lock);
+	while (1) {
+		struct timespec deadline;
+
+		while (!sub->stop && !sub->flush && sub->tail == sub->head)
+			pthread_cond_wait(&sub->cond, &sub->lock);
+
+		// Wait for a full batch, but not longer than the linger time from the first event
+		linger_deadline(&deadline);
+		while (!sub->stop && !sub->flush && sub->tail - sub->head < sub->batch) {
+			if (pthread_cond_timedwait(&sub->cond, &sub->lock, &deadline) == ETIMEDOUT)
+				break;
+		}
+
+		if (sub->tail == sub->head) {
+			sub->flush = false;
+			pthread_cond_broadcast(&sub->delivered);
+			if (sub->stop)
+				break;
+			continue;
+		}
+
+		unsigned num = 0;
+		while (num < sub->batch && sub->head != sub->tail)
+			batch[num++] = sub->ring[sub->head++ % SCAN_EVENT_RING_LEN];
+		pthread_mutex_unlock(&sub->lock);
+
+		sub->cb(sub->ctx, batch, num);
+
+		pthread_mutex_lock(&sub->lock);
+		sub->num_delivered += num;
+		pthread_cond_broadcast(&sub->delivered);
+	}
+	pthread_mutex_unlock(&sub->lock);
+
+	return NULL;
+}
+
+scan_subscription_t *scan_subscription_new(const scan_filter_t *filter, unsigned batch, scan_event_cb_t cb, void *ctx)
+{
+	scan_subscription_t *sub = calloc(1, sizeof(*sub));
+
+	if (sub == NULL) {
+		ERROR("Failed to allocate memory for a subscription");
+		return NULL;
+	}
+
+	sub->filter = *filter;
+	sub->batch = batch == 0 ? 1 : batch > SCAN_EVENT_MAX_BATCH ? SCAN_EVENT_MAX_BATCH : batch;
+	sub->cb = cb;
+	sub->ctx = ctx;
+	pthread_mutex_init(&sub->lock, NULL);
+	pthread_cond_init(&sub->cond, NULL);
+	pthread_cond_init(&sub->delivered, NULL);
+
+	if (pthread_create(&sub->thread, NULL, subscription_thread, sub) != 0) {
+		ERROR("Failed to start the thread of a subscription, errno=%d: %s", errno, strerror(errno));
+		pthread_cond_destroy(&sub->delivered);
+		pthread_cond_destroy(&sub->cond);
+		pthread_mutex_destroy(&sub->lock);
+		free(sub);
+		return NULL;
+	}
+
+	return sub;
+}
+
+void scan_subscription_free(scan_subscription_t *sub)
+{
+	if (sub == NULL)
+		return;
+
+	pthread_mutex_lock(&sub->lock);
+	sub->stop = true;
+	pthread_cond_signal(&sub->cond);
+	pthread_mutex_unlock(&sub->lock);
+	pthread_join(sub->thread, NULL);
+
+	if (sub->num_dropped > 0)
+		VERBOSE("Subscription dropped %"PRIu64" events that did not fit in its ring", sub->num_dropped);
+	pthread_cond_destroy(&sub->delivered);
+	pthread_cond_destroy(&sub->cond);
+	pthread_mutex_destroy(&sub->lock);
+	free(sub);
+}
+
+void scan_subscription_publish(scan_subscription_t *sub, const scan_event_t *event)
+{
+	if (!event_filter(&sub->filter, event))
+		return;
+
+	pthread_mutex_lock(&sub->lock);
+	if (sub->tail - sub->head == SCAN_EVENT_RING_LEN) {
+		sub->num_dropped++;
+	} else {
+		sub->ring[sub->tail++ % SCAN_EVENT_RING_LEN] = *event;
+		// The thread is woken by the first event to start the linger time and again for a full batch
+		if (sub->tail - sub->head == 1 || sub->tail - sub->head == sub->batch || event->type == SCAN_EVENT_DONE)
+			pthread_cond_signal(&sub->cond);
+	}
+	pthread_mutex_unlock(&sub->lock);
+}
+
+void scan_subscription_flush(scan_subscription_t *sub)
+{
+	pthread_mutex_lock(&sub->lock);
+	const uint64_t target = sub->tail;
+	sub->flush = true;
+	pthread_cond_signal(&sub->cond);
+	while (sub->num_delivered < target)
+		pthread_cond_wait(&sub->delivered, &sub->lock);
+	pthread_mutex_unlock(&sub->lock);
+}
+
+uint64_t scan_subscription_dropped(scan_subscription_t *sub)
+{
+	uint64_t dropped;
+
+	pthread_mutex_lock(&sub->lock);
+	dropped = sub->num_dropped;
+	pthread_mutex_unlock(&sub->lock);
+	return dropped;
+}
@@ -0,0 +1,207 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "heatmap.h"
+#include "verbose.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(heatmap_header_t) <= HEATMAP_HEADER_SIZE, "heatmap header does not fit");
+
+bool heatmap_create(heatmap_t *hm, const char *path, uint64_t bucket_bytes, uint64_t disk_bytes, uint32_t sector_size,
+		const char *vendor, const char *model, const char *serial)
+{
+	// Buckets end on sector boundaries so that no IO is split between them
+	bucket_bytes = (bucket_bytes + sector_size - 1) / sector_size * sector_size;
+	const uint64_t num_buckets = (disk_bytes + bucket_bytes - 1) / bucket_bytes;
+
+	if (num_buckets > HEATMAP_MAX_BUCKETS) {
+		ERROR("Heatmap bucket of %"PRIu64" bytes makes %"PRIu64" buckets, at most %u are supported", bucket_bytes,
+				num_buckets, HEATMAP_MAX_BUCKETS);
+		return false;
+	}
+
+	memset(hm, 0, sizeof(*hm));
+	snprintf(hm->path, sizeof(hm->path), "%s", path);
+	hm->map_len = HEATMAP_HEADER_SIZE + num_buckets * sizeof(heatmap_record_t);
+	hm->fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (hm->fd < 0) {
+		ERROR("Failed to create heatmap file %s, errno=%d: %s", path, errno, strerror(errno));
+		return false;
+	}
+	if (ftruncate(hm->fd, hm->map_len) < 0) {
+		ERROR("Failed to size heatmap file %s, errno=%d: %s", path, errno, strerror(errno));
+		goto Error;
+	}
+
+	hm->header = mmap(NULL, hm->map_len, PROT_READ|PROT_WRITE, MAP_SHARED, hm->fd, 0);
+	if (hm->header == MAP_FAILED) {
+		ERROR("Failed to map heatmap file %s, errno=%d: %s", path, errno, strerror(errno));
+		hm->header = NULL;
+		goto Error;
+	}
+
+	hm->header->version = HEATMAP_VERSION;
+	hm->header->header_size = HEATMAP_HEADER_SIZE;
+	hm->header->record_size = sizeof(heatmap_record_t);
+	hm->header->sector_size = sector_size;
+	hm->header->bucket_bytes = bucket_bytes;
+	hm->header->num_buckets = num_buckets;
+	hm->header->disk_bytes = disk_bytes;
+	hm->header->start_time = time(NULL);
+	snprintf(hm->header->vendor, sizeof(hm->header->vendor), "%s", vendor);
+	snprintf(hm->header->model, sizeof(hm->header->model), "%s", model);
+	snprintf(hm->header->serial, sizeof(hm->header->serial), "%s", serial);
+	// The magic goes in last, a reader never sees a half written header as valid
+	memcpy(hm->header->magic, HEATMAP_MAGIC, sizeof(hm->header->magic));
+
+	hm->records = (heatmap_record_t *)((char *)hm->header + HEATMAP_HEADER_SIZE);
+	pthread_mutex_init(&hm->lock, NULL);
+	INFO("Heatmap %s has %"PRIu64" buckets of %"PRIu64" MB", path, num_buckets, bucket_bytes / (1024*1024));
+	return true;
+
+Error:
+	close(hm->fd);
+	unlink(path);
+	hm->fd = -1;
+	return false;
+}
+
+bool heatmap_open(heatmap_t *hm, const char *path)
+{
+	struct stat st;
+
+	memset(hm, 0, sizeof(*hm));
+	snprintf(hm->path, sizeof(hm->path), "%s", path);
+	hm->fd = open(path, O_RDONLY);
+	if (hm->fd < 0) {
+		ERROR("Failed to open heatmap file %s, errno=%d: %s", path, errno, strerror(errno));
+		return false;
+	}
+	if (fstat(hm->fd, &st) < 0 || st.st_size < HEATMAP_HEADER_SIZE) {
+		ERROR("Heatmap file %s is too short", path);
+		goto Error;
+	}
+
+	hm->map_len = st.st_size;
+	hm->header = mmap(NULL, hm->map_len, PROT_READ, MAP_SHARED, hm->fd, 0);
+	if (hm->header == MAP_FAILED) {
+		ERROR("Failed to map heatmap file %s, errno=%d: %s", path, errno, strerror(errno));
+		hm->header = NULL;
+		goto Error;
+	}
+
+	if (memcmp(hm->header->magic, HEATMAP_MAGIC, sizeof(hm->header->magic)) != 0 ||
+			hm->header->version != HEATMAP_VERSION ||
+			hm->header->record_size != sizeof(heatmap_record_t) ||
+			hm->header->header_size + hm->header->num_buckets * sizeof(heatmap_record_t) > hm->map_len) {
+		ERROR("File %s is not a heatmap of this version", path);
+		goto Error;
+	}
+
+	hm->records = (heatmap_record_t *)((char *)hm->header + hm->header->header_size);
+	pthread_mutex_init(&hm->lock, NULL);
+	return true;
+
+Error:
+	if (hm->header)
+		munmap(hm->header, hm->map_len);
+	hm->header = NULL;
+	close(hm->fd);
+	hm->fd = -1;
+	return false;
+}
+
+void heatmap_close(heatmap_t *hm)
+{
+	if (hm->records == NULL)
+		return;
+
+	msync(hm->header, hm->map_len, MS_SYNC);
+	munmap(hm->header, hm->map_len);
+	close(hm->fd);
+	pthread_mutex_destroy(&hm->lock);
+	hm->header = NULL;
+	hm->records = NULL;
+	hm->fd = -1;
+}
+
+void heatmap_bucket_done(heatmap_t *hm, uint64_t bucket, const heatmap_record_t *record)
+{
+	heatmap_record_t *r;
+
+	if (bucket >= hm->header->num_buckets)
+		return;
+
+	r = &hm->records[bucket];
+	pthread_mutex_lock(&hm->lock);
+	if (r->flags & HEATMAP_RECORD_DONE) {
+		r->num_ios += record->num_ios;
+		r->num_errors += record->num_errors;
+		r->num_retries += record->num_retries;
+		if (record->min_usec < r->min_usec)
+			r->min_usec = record->min_usec;
+		if (record->median_usec > r->median_usec)
+			r->median_usec = record->median_usec;
+		if (record->p99_usec > r->p99_usec)
+			r->p99_usec = record->p99_usec;
+		if (record->max_usec > r->max_usec)
+			r->max_usec = record->max_usec;
+	} else {
+		// The flag is set last so that a reader never takes a partly written record as done
+		*r = *record;
+		r->flags = 0;
+		__atomic_store_n(&r->flags, record->flags | HEATMAP_RECORD_DONE, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&hm->lock);
+}
+
+uint64_t heatmap_str_to_bytes(const char *str)
+{
+	char *endptr;
+	unsigned long long val;
+
+	errno = 0;
+	val = strtoull(str, &endptr, 0);
+	if (errno != 0 || val == 0)
+		return 0;
+
+	switch (*endptr) {
+		case 0: break;
+		case 'k': case 'K': val *= 1024ULL; endptr++; break;
+		case 'm': case 'M': val *= 1024ULL*1024; endptr++; break;
+		case 'g': case 'G': val *= 1024ULL*1024*1024; endptr++; break;
+		case 't': case 'T': val *= 1024ULL*1024*1024*1024; endptr++; break;
+		default: return 0;
+	}
+	if (*endptr == 'b' || *endptr == 'B')
+		endptr++;
+
+	return *endptr == 0 ? val : 0;
+}
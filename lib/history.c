@@ -0,0 +1,438 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "history.h"
+#include "verbose.h"
+
+#include "hdrhistogram/src/hdr_histogram_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define HISTORY_MAX_LATENCY 1024
+
+/* A zone drifted when its median latency grew by both of these, small latencies are too noisy for a ratio alone */
+#define HISTORY_DRIFT_PCT 50
+#define HISTORY_DRIFT_MIN_MSEC 5
+
+typedef struct history_run_t {
+	time_t time;
+	enum conclusion conclusion;
+	uint64_t num_errors;
+	uint64_t num_sectors;
+	bool has_smart;
+	int temp;
+	int reallocs;
+	int pending_reallocs;
+	int crc_errors;
+	struct hdr_histogram *device_histogram;
+	latency_t latency[HISTORY_MAX_LATENCY];
+	unsigned latency_len;
+} history_run_t;
+
+void history_path(const char *dir, disk_t *disk, char *path, int path_len)
+{
+	char name[sizeof(disk->model) + sizeof(disk->serial)];
+	unsigned i;
+
+	// The serial alone is only unique for a vendor, the model keeps disks of different vendors apart
+	snprintf(name, sizeof(name), "%s_%s", disk->model, disk->serial);
+	for (i = 0; name[i]; i++) {
+		if (!isalnum((unsigned char)name[i]) && name[i] != '.' && name[i] != '-')
+			name[i] = '_';
+	}
+
+	snprintf(path, path_len, "%s/%s.history", dir, name);
+}
+
+/* The conclusion is kept by its name and not the value of the enum, which may change between versions. The name goes
+ * in a single field with its spaces as underscores.
+ */
+static void history_conclusion_output(FILE *f, enum conclusion conclusion)
+{
+	const char *name = conclusion_to_str(conclusion);
+
+	fprintf(f, " conclusion=");
+	for (; *name; name++)
+		fputc(*name == ' ' ? '_' : *name, f);
+}
+
+/* A missing or unknown name, a later version's or the number older versions kept, is a scan problem */
+static enum conclusion history_conclusion_parse(const char *value)
+{
+	int conclusion;
+
+	for (conclusion = 0; conclusion < CONCLUSION_NUM; conclusion++) {
+		const char *name = conclusion_to_str(conclusion);
+		unsigned i;
+
+		for (i = 0; name[i] && (value[i] == name[i] || (value[i] == '_' && name[i] == ' ')); i++)
+			;
+		if (name[i] == 0 && value[i] == 0)
+			return conclusion;
+	}
+
+	return CONCLUSION_SCAN_PROBLEM;
+}
+
+static void history_histogram_output(FILE *f, const char *name, struct hdr_histogram *histogram)
+{
+	char *encoded_histogram;
+
+	if (histogram == NULL || hdr_log_encode(histogram, &encoded_histogram) != 0)
+		return;
+
+	fprintf(f, " %s=%s", name, encoded_histogram);
+	free(encoded_histogram);
+}
+
+int history_append(const char *dir, disk_t *disk)
+{
+	char path[PATH_MAX];
+	char *line = NULL;
+	size_t line_len = 0;
+	size_t written;
+	unsigned i;
+	int fd = -1;
+	int ret = -1;
+	FILE *f;
+
+	f = open_memstream(&line, &line_len);
+	if (f == NULL) {
+		ERROR("Failed to allocate the history line");
+		return -1;
+	}
+
+	fprintf(f, "run time=%"PRIu64, (uint64_t)time(NULL));
+	history_conclusion_output(f, disk->conclusion);
+	fprintf(f, " errors=%"PRIu64" sectors=%"PRIu64, disk->num_errors, disk->num_bytes / disk->sector_size);
+	if (disk->is_ata && disk->state.ata.smart_num > 0)
+		fprintf(f, " smart=%d,%d,%d,%d", disk->state.ata.last_temp, disk->state.ata.last_reallocs,
+				disk->state.ata.last_pending_reallocs, disk->state.ata.last_crc_errors);
+	history_histogram_output(f, "histogram", disk->histogram);
+	history_histogram_output(f, "device_histogram", disk->device_histogram);
+	fprintf(f, " latency=");
+	for (i = 0; i < disk->latency_graph_len; i++) {
+		latency_t *l = &disk->latency_graph[i];
+		fprintf(f, "%s%"PRIu64":%"PRIu64":%u:%u:%u", i ? "," : "", l->start_sector, l->end_sector,
+				l->latency_min_msec, l->latency_max_msec, l->latency_median_msec);
+	}
+	fprintf(f, "\n");
+	if (fclose(f) != 0) {
+		ERROR("Failed to build the history line");
+		goto Exit;
+	}
+
+	// A single append of the whole line, a crash leaves at most a partial last line that the reader skips
+	history_path(dir, disk, path, sizeof(path));
+	fd = open(path, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ERROR("Failed to open history %s, errno=%d: %s", path, errno, strerror(errno));
+		goto Exit;
+	}
+
+	for (written = 0; written < line_len; ) {
+		ssize_t n = write(fd, line + written, line_len - written);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Failed to write history %s, errno=%d: %s", path, errno, strerror(errno));
+			goto Exit;
+		}
+		written += n;
+	}
+
+	VERBOSE("Scan added to history %s", path);
+	ret = 0;
+
+Exit:
+	if (fd >= 0)
+		close(fd);
+	free(line);
+	return ret;
+}
+
+static bool history_parse_latency(char *value, history_run_t *run)
+{
+	char *save = NULL;
+	char *entry;
+
+	for (entry = strtok_r(value, ",", &save); entry; entry = strtok_r(NULL, ",", &save)) {
+		latency_t *l;
+
+		if (run->latency_len == HISTORY_MAX_LATENCY)
+			return false;
+		l = &run->latency[run->latency_len++];
+		if (sscanf(entry, "%"SCNu64":%"SCNu64":%u:%u:%u", &l->start_sector, &l->end_sector,
+					&l->latency_min_msec, &l->latency_max_msec, &l->latency_median_msec) != 5)
+			return false;
+	}
+
+	return true;
+}
+
+static bool history_parse_run(char *line, history_run_t *run)
+{
+	char *save = NULL;
+	char *field;
+	uint64_t t;
+
+	memset(run, 0, sizeof(*run));
+	run->conclusion = CONCLUSION_SCAN_PROBLEM;
+
+	field = strtok_r(line, " \n", &save);
+	if (field == NULL || strcmp(field, "run") != 0)
+		return false;
+
+	while ((field = strtok_r(NULL, " \n", &save)) != NULL) {
+		char *value = strchr(field, '=');
+
+		if (value == NULL)
+			return false;
+		*value++ = 0;
+
+		// Unknown fields are skipped, they come from a later version
+		if (strcmp(field, "time") == 0 && sscanf(value, "%"SCNu64, &t) == 1) {
+			run->time = t;
+		} else if (strcmp(field, "conclusion") == 0) {
+			run->conclusion = history_conclusion_parse(value);
+		} else if (strcmp(field, "errors") == 0) {
+			run->num_errors = strtoull(value, NULL, 10);
+		} else if (strcmp(field, "sectors") == 0) {
+			run->num_sectors = strtoull(value, NULL, 10);
+		} else if (strcmp(field, "smart") == 0) {
+			run->has_smart = sscanf(value, "%d,%d,%d,%d", &run->temp, &run->reallocs,
+					&run->pending_reallocs, &run->crc_errors) == 4;
+		} else if (strcmp(field, "device_histogram") == 0) {
+			if (hdr_log_decode(&run->device_histogram, value, strlen(value)) != 0)
+				run->device_histogram = NULL;
+		} else if (strcmp(field, "latency") == 0) {
+			if (!history_parse_latency(value, run))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void history_run_free(history_run_t *run)
+{
+	free(run->device_histogram);
+	run->device_histogram = NULL;
+}
+
+static bool history_drifted(uint64_t base, uint64_t cur, uint64_t min_diff)
+{
+	return cur > base + min_diff && cur * 100 > base * (100 + HISTORY_DRIFT_PCT);
+}
+
+static void history_time_str(time_t t, char *buf, int buf_len)
+{
+	struct tm tm;
+
+	if (gmtime_r(&t, &tm) == NULL || strftime(buf, buf_len, "%Y-%m-%d %H:%M:%S", &tm) == 0)
+		snprintf(buf, buf_len, "%"PRIu64, (uint64_t)t);
+}
+
+static int history_compare_percentiles(FILE *f, history_run_t *runs[3])
+{
+	static const double percentiles[] = {50.0, 99.0, 99.99, 100.0};
+	static const char *names[] = {"p50", "p99", "p99.99", "max"};
+	const int64_t min_diff_usec = HISTORY_DRIFT_MIN_MSEC * 1000;
+	int num_drifted = 0;
+	unsigned i;
+	int j;
+
+	for (j = 0; j < 3; j++) {
+		if (runs[j]->device_histogram == NULL) {
+			fprintf(f, "\nDevice latency is missing in the history\n");
+			return 0;
+		}
+	}
+
+	fprintf(f, "\nDevice latency (msec):\n");
+	fprintf(f, "%10s %10s %10s %10s\n", "", "Baseline", "Previous", "Last");
+	for (i = 0; i < ARRAY_SIZE(percentiles); i++) {
+		int64_t values[3];
+		bool drifted = false;
+
+		for (j = 0; j < 3; j++)
+			values[j] = hdr_value_at_percentile(runs[j]->device_histogram, percentiles[i]);
+		for (j = 0; j < 2; j++)
+			drifted |= history_drifted(values[j], values[2], min_diff_usec);
+		if (drifted)
+			num_drifted++;
+
+		fprintf(f, "%10s %10.1f %10.1f %10.1f%s\n", names[i], values[0] / 1000.0,
+				values[1] / 1000.0, values[2] / 1000.0, drifted ? "  drifted" : "");
+	}
+
+	return num_drifted;
+}
+
+static int history_compare_zones(FILE *f, history_run_t *runs[3])
+{
+	history_run_t *last = runs[2];
+	int num_drifted = 0;
+	unsigned i;
+	int j;
+
+	// The zones are only comparable when the disk was cut into the same latency graph
+	for (j = 0; j < 2; j++) {
+		if (runs[j]->latency_len != last->latency_len || runs[j]->num_sectors != last->num_sectors) {
+			fprintf(f, "\nLatency graph differs from the earlier scans, zones are not compared\n");
+			return 0;
+		}
+	}
+
+	fprintf(f, "\nZone median latency (msec):\n");
+	fprintf(f, "%6s %16s %16s %10s %10s %10s\n", "Zone", "Start sector", "End sector", "Baseline", "Previous", "Last");
+	for (i = 0; i < last->latency_len; i++) {
+		bool drifted = false;
+
+		for (j = 0; j < 2; j++)
+			drifted |= history_drifted(runs[j]->latency[i].latency_median_msec, last->latency[i].latency_median_msec,
+					HISTORY_DRIFT_MIN_MSEC);
+		if (!drifted)
+			continue;
+
+		num_drifted++;
+		fprintf(f, "%6u %16"PRIu64" %16"PRIu64" %10u %10u %10u\n", i, last->latency[i].start_sector,
+				last->latency[i].end_sector, runs[0]->latency[i].latency_median_msec,
+				runs[1]->latency[i].latency_median_msec, last->latency[i].latency_median_msec);
+	}
+	if (num_drifted == 0)
+		fprintf(f, "No zone drifted\n");
+
+	return num_drifted;
+}
+
+static char *history_line_keep(char *kept, const char *line)
+{
+	free(kept);
+	return strdup(line);
+}
+
+int history_compare(const char *path, FILE *f)
+{
+	history_run_t *runs[3] = {NULL, NULL, NULL};
+	char *kept[3] = {NULL, NULL, NULL}; /* Lines of the baseline, previous and last scans */
+	char time_str[3][32];
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	unsigned num_runs = 0;
+	int num_drifted = 0;
+	int ret = -1;
+	int i;
+	FILE *hf;
+
+	hf = fopen(path, "r");
+	if (hf == NULL) {
+		ERROR("Failed to open history %s, errno=%d: %s", path, errno, strerror(errno));
+		return -1;
+	}
+
+	// Only three scans are needed, the file is streamed so that a long history costs no memory
+	while ((len = getline(&line, &line_size, hf)) > 0) {
+		if (line[len-1] != '\n' || strncmp(line, "run ", 4) != 0)
+			continue;
+
+		if (num_runs == 0)
+			kept[0] = history_line_keep(kept[0], line);
+		if (num_runs > 0) {
+			free(kept[1]);
+			kept[1] = kept[2];
+			kept[2] = NULL;
+		}
+		kept[2] = history_line_keep(kept[2], line);
+		if (kept[0] == NULL || kept[2] == NULL) {
+			ERROR("Failed to allocate memory for the history");
+			goto Exit;
+		}
+		num_runs++;
+	}
+
+	if (num_runs < 2) {
+		fprintf(f, "History %s has %u scans, nothing to compare\n", path, num_runs);
+		ret = 0;
+		goto Exit;
+	}
+	// With two scans the baseline is also the previous one
+	if (kept[1] == NULL && (kept[1] = strdup(kept[0])) == NULL) {
+		ERROR("Failed to allocate memory for the history");
+		goto Exit;
+	}
+
+	for (i = 0; i < 3; i++) {
+		runs[i] = malloc(sizeof(history_run_t));
+		if (runs[i] == NULL) {
+			ERROR("Failed to allocate memory for the history");
+			goto Exit;
+		}
+		if (!history_parse_run(kept[i], runs[i])) {
+			ERROR("Failed to parse history %s", path);
+			goto Exit;
+		}
+		history_time_str(runs[i]->time, time_str[i], sizeof(time_str[i]));
+	}
+
+	fprintf(f, "History %s has %u scans\n", path, num_runs);
+	fprintf(f, "%10s %20s %20s %20s\n", "", "Baseline", "Previous", "Last");
+	fprintf(f, "%10s %20s %20s %20s\n", "Time", time_str[0], time_str[1], time_str[2]);
+	fprintf(f, "%10s %20"PRIu64" %20"PRIu64" %20"PRIu64"\n", "Errors", runs[0]->num_errors, runs[1]->num_errors,
+			runs[2]->num_errors);
+	if (runs[0]->has_smart && runs[1]->has_smart && runs[2]->has_smart) {
+		fprintf(f, "%10s %20d %20d %20d\n", "Temp", runs[0]->temp, runs[1]->temp, runs[2]->temp);
+		fprintf(f, "%10s %20d %20d %20d\n", "Realloc", runs[0]->reallocs, runs[1]->reallocs, runs[2]->reallocs);
+		fprintf(f, "%10s %20d %20d %20d\n", "Pending", runs[0]->pending_reallocs, runs[1]->pending_reallocs,
+				runs[2]->pending_reallocs);
+		fprintf(f, "%10s %20d %20d %20d\n", "CRC", runs[0]->crc_errors, runs[1]->crc_errors, runs[2]->crc_errors);
+	}
+	for (i = 0; i < 3; i++)
+		fprintf(f, "%s%s", i == 0 ? "Conclusions: " : ", ", conclusion_to_str(runs[i]->conclusion));
+	fprintf(f, "\n");
+
+	num_drifted += history_compare_percentiles(f, runs);
+	num_drifted += history_compare_zones(f, runs);
+
+	if (num_drifted > 0)
+		fprintf(f, "\nLatency drifted in %d places since the earlier scans\n", num_drifted);
+	else
+		fprintf(f, "\nNo latency drift since the earlier scans\n");
+	ret = num_drifted;
+
+Exit:
+	for (i = 0; i < 3; i++) {
+		if (runs[i])
+			history_run_free(runs[i]);
+		free(runs[i]);
+		free(kept[i]);
+	}
+	free(line);
+	fclose(hf);
+	return ret;
+}
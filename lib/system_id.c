@@ -8,7 +8,10 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
-#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 
 static void sha1_calc(const unsigned char *src, int src_len, char *out, int out_size)
 {
@@ -26,76 +29,142 @@ static void sha1_calc(const unsigned char *src, int src_len, char *out, int out_
 	}
 }
 
-static bool cmd_str(const char *cmd, char *buf, int len)
+#define DMI_ID_DIR "/sys/class/dmi/id"
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define SYSTEM_ID_CACHE_DIR "/run/diskscan"
+#define SYSTEM_ID_CACHE SYSTEM_ID_CACHE_DIR "/system_id"
+
+static bool file_str(const char *path, char *buf, int len)
 {
-	FILE *f = popen(cmd, "r");
+	FILE *f = fopen(path, "r");
 	if (!f)
 		return false;
 
 	char *ret = fgets(buf, len, f);
-	pclose(f);
-	return ret != NULL;
+	fclose(f);
+	if (ret == NULL)
+		return false;
+
+	buf[strcspn(buf, "\r\n")] = 0;
+	return true;
 }
 
-static void dmidecode_read(const char *field_name, char *buf, int len)
+/* The serials are the same ones dmidecode reports, the kernel exposes them to root only */
+static void dmi_read(const char *field_name, char *buf, int len)
 {
-	char cmd[128];
+	char path[128];
 
 	memset(buf, 0, len);
 
-	snprintf(cmd, sizeof(cmd), "dmidecode -s %s", field_name);
-	if (!cmd_str(cmd, buf, len))
+	snprintf(path, sizeof(path), DMI_ID_DIR "/%s", field_name);
+	if (!file_str(path, buf, len))
 		return;
 
-	int actual_len = strlen(buf);
-	switch (buf[actual_len-1]) {
-		case '\r':
-		case '\n':
-			buf[actual_len-1] = 0;
-			actual_len--;
-			break;
-	}
-
-	sha1_calc((unsigned char *)buf, actual_len, buf, len);
+	sha1_calc((unsigned char *)buf, strlen(buf), buf, len);
 }
 
-static void system_serial_read(char *buf, int len)
+static void os_read(char *buf, int len)
 {
-	dmidecode_read("system-serial-number", buf, len);
-}
+	struct utsname uts;
 
-static void chassis_serial_read(char *buf, int len)
-{
-	dmidecode_read("chassis-serial-number", buf, len);
+	memset(buf, 0, len);
+	if (uname(&uts) == 0)
+		snprintf(buf, len, "%s", uts.sysname);
 }
 
-static void baseboard_serial_read(char *buf, int len)
+/* The identity can only change with the hardware, a reboot is needed for that so the cache is valid for the boot */
+static bool system_identifier_cache_load(system_identifier_t *system_id, const char *boot_id)
 {
-	dmidecode_read("baseboard-serial-number", buf, len);
+	char line[128];
+	bool boot_match = false;
+	FILE *f;
+
+	f = fopen(SYSTEM_ID_CACHE, "r");
+	if (f == NULL)
+		return false;
+
+	// Each line is a key and a value that may be empty
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *key = line;
+		char *val = strchr(line, ' ');
+
+		if (val == NULL)
+			continue;
+		*val++ = 0;
+		val[strcspn(val, "\n")] = 0;
+
+		if (strcmp(key, "boot_id") == 0)
+			boot_match = strcmp(val, boot_id) == 0;
+		else if (strcmp(key, "os") == 0)
+			snprintf(system_id->os, sizeof(system_id->os), "%s", val);
+		else if (strcmp(key, "system") == 0)
+			snprintf(system_id->system, sizeof(system_id->system), "%s", val);
+		else if (strcmp(key, "chassis") == 0)
+			snprintf(system_id->chassis, sizeof(system_id->chassis), "%s", val);
+		else if (strcmp(key, "baseboard") == 0)
+			snprintf(system_id->baseboard, sizeof(system_id->baseboard), "%s", val);
+		else if (strcmp(key, "mac") == 0)
+			snprintf(system_id->mac, sizeof(system_id->mac), "%s", val);
+	}
+	fclose(f);
+
+	if (!boot_match)
+		memset(system_id, 0, sizeof(*system_id));
+	return boot_match;
 }
 
-static void os_read(char *buf, int len)
+static void system_identifier_cache_save(const system_identifier_t *system_id, const char *boot_id)
 {
-	cmd_str("uname -o", buf, len);
+	char tmp_path[sizeof(SYSTEM_ID_CACHE) + 32];
+	FILE *f;
 
-	int i;
-	for (i = strlen(buf) - 1; i >= 0; i--) {
-		if (!isspace(buf[i]))
-			break;
-		buf[i] = 0;
-	}
+	// Caching is only an optimization, failing to save is fine
+	if (mkdir(SYSTEM_ID_CACHE_DIR, 0755) != 0 && errno != EEXIST)
+		return;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", SYSTEM_ID_CACHE, (int)getpid());
+	f = fopen(tmp_path, "w");
+	if (f == NULL)
+		return;
+
+	fprintf(f, "boot_id %s\n", boot_id);
+	fprintf(f, "os %s\n", system_id->os);
+	fprintf(f, "system %s\n", system_id->system);
+	fprintf(f, "chassis %s\n", system_id->chassis);
+	fprintf(f, "baseboard %s\n", system_id->baseboard);
+	fprintf(f, "mac %s\n", system_id->mac);
+	if (fclose(f) != 0 || rename(tmp_path, SYSTEM_ID_CACHE) != 0)
+		unlink(tmp_path);
 }
 
-bool system_identifier_read(system_identifier_t *system_id)
+static system_identifier_t system_id_cached;
+static pthread_once_t system_id_once = PTHREAD_ONCE_INIT;
+
+static void system_identifier_init(void)
 {
+	system_identifier_t *system_id = &system_id_cached;
+	char boot_id[64];
+	bool has_boot_id = file_str(BOOT_ID_PATH, boot_id, sizeof(boot_id));
+
+	if (has_boot_id && system_identifier_cache_load(system_id, boot_id))
+		return;
+
 	os_read(system_id->os, sizeof(system_id->os));
-	system_serial_read(system_id->system, sizeof(system_id->system));
-	chassis_serial_read(system_id->chassis, sizeof(system_id->chassis));
-	baseboard_serial_read(system_id->baseboard, sizeof(system_id->baseboard));
+	dmi_read("product_serial", system_id->system, sizeof(system_id->system));
+	dmi_read("chassis_serial", system_id->chassis, sizeof(system_id->chassis));
+	dmi_read("board_serial", system_id->baseboard, sizeof(system_id->baseboard));
 
 	unsigned char mac[6];
 	mac_read(mac, sizeof(mac));
 	sha1_calc(mac, sizeof(mac), system_id->mac, sizeof(system_id->mac));
 
+	if (has_boot_id)
+		system_identifier_cache_save(system_id, boot_id);
+}
+
+bool system_identifier_read(system_identifier_t *system_id)
+{
+	pthread_once(&system_id_once, system_identifier_init);
+	*system_id = system_id_cached;
 	return true;
 }
@@ -0,0 +1,169 @@
+#include "topology.h"
+
+#include "verbose.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <inttypes.h>
+
+#define SYSFS_BLOCK "/sys/block"
+
+static bool sysfs_read_str(const char *path, char *buf, int buf_len)
+{
+	FILE *f = fopen(path, "r");
+	char *ret;
+
+	if (f == NULL)
+		return false;
+	ret = fgets(buf, buf_len, f);
+	fclose(f);
+	if (ret == NULL)
+		return false;
+
+	buf[strcspn(buf, "\n")] = 0;
+	return true;
+}
+
+static void str_copy(char *dst, const char *src, size_t dst_len)
+{
+	strncpy(dst, src, dst_len);
+	dst[dst_len-1] = 0;
+}
+
+/* The device path of a SAS disk is like:
+ * /sys/devices/pci0000:00/0000:00:03.0/0000:02:00.0/host0/port-0:0/expander-0:0/port-0:0:4/end_device-0:0:4/target0:0:4/0:0:4:0
+ */
+static void topology_parse_path(char *dev_path, disk_topology_t *disk)
+{
+	char *save = NULL;
+	char *comp;
+
+	for (comp = strtok_r(dev_path, "/", &save); comp; comp = strtok_r(NULL, "/", &save)) {
+		if (disk->host[0] == 0 && strncmp(comp, "host", 4) == 0 && isdigit(comp[4]))
+			str_copy(disk->host, comp, sizeof(disk->host));
+		else if (disk->expander[0] == 0 && strncmp(comp, "expander-", 9) == 0)
+			str_copy(disk->expander, comp, sizeof(disk->expander));
+	}
+}
+
+/* The SES driver links the disk to its slot in the enclosure, the slot directory is under the enclosure device */
+static void topology_find_enclosure(const char *name, disk_topology_t *disk)
+{
+	char path[PATH_MAX];
+	char slot_path[PATH_MAX];
+	DIR *dir;
+	struct dirent *entry;
+
+	snprintf(path, sizeof(path), SYSFS_BLOCK "/%s/device", name);
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		char link_path[PATH_MAX + 256];
+		char *slash;
+
+		if (strncmp(entry->d_name, "enclosure_device:", 17) != 0)
+			continue;
+
+		snprintf(link_path, sizeof(link_path), "%s/%s", path, entry->d_name);
+		if (realpath(link_path, slot_path) == NULL)
+			continue;
+
+		slash = strrchr(slot_path, '/');
+		if (slash == NULL)
+			continue;
+		*slash = 0;
+		slash = strrchr(slot_path, '/');
+		str_copy(disk->enclosure, slash ? slash + 1 : slot_path, sizeof(disk->enclosure));
+		break;
+	}
+
+	closedir(dir);
+}
+
+static bool topology_disk_read(const char *name, disk_topology_t *disk)
+{
+	char path[PATH_MAX];
+	char dev_path[PATH_MAX];
+	char buf[128];
+	int type;
+
+	memset(disk, 0, sizeof(*disk));
+
+	// Only disks and zoned disks, skip CD-ROMs and the likes
+	snprintf(path, sizeof(path), SYSFS_BLOCK "/%s/device/type", name);
+	if (!sysfs_read_str(path, buf, sizeof(buf)))
+		return false;
+	type = atoi(buf);
+	if (type != 0x00 && type != 0x14)
+		return false;
+
+	snprintf(path, sizeof(path), SYSFS_BLOCK "/%s/device", name);
+	if (realpath(path, dev_path) == NULL)
+		return false;
+
+	str_copy(disk->name, name, sizeof(disk->name));
+	snprintf(disk->dev_path, sizeof(disk->dev_path), "/dev/%s", name);
+
+	snprintf(path, sizeof(path), SYSFS_BLOCK "/%s/device/wwid", name);
+	if (!sysfs_read_str(path, disk->wwid, sizeof(disk->wwid)))
+		str_copy(disk->wwid, name, sizeof(disk->wwid));
+
+	// The size is always in 512 byte units
+	snprintf(path, sizeof(path), SYSFS_BLOCK "/%s/size", name);
+	if (sysfs_read_str(path, buf, sizeof(buf)))
+		disk->num_bytes = strtoull(buf, NULL, 10) * 512;
+
+	snprintf(path, sizeof(path), SYSFS_BLOCK "/%s/diskseq", name);
+	if (sysfs_read_str(path, buf, sizeof(buf)))
+		disk->diskseq = strtoull(buf, NULL, 10);
+
+	topology_parse_path(dev_path, disk);
+	topology_find_enclosure(name, disk);
+
+	VERBOSE("Found disk %s wwid %s host %s expander %s enclosure %s", disk->name, disk->wwid,
+			disk->host, disk->expander[0] ? disk->expander : "none", disk->enclosure[0] ? disk->enclosure : "none");
+	return true;
+}
+
+bool topology_for_path(const char *path, disk_topology_t *disk)
+{
+	char real_path[PATH_MAX];
+	const char *name;
+
+	// Links such as /dev/disk/by-id are resolved to the kernel name
+	if (realpath(path, real_path) == NULL)
+		return false;
+	name = strrchr(real_path, '/');
+	name = name ? name + 1 : real_path;
+
+	return topology_disk_read(name, disk);
+}
+
+int topology_discover(disk_topology_t *disks, int max_disks)
+{
+	DIR *dir;
+	struct dirent *entry;
+	int num_disks = 0;
+
+	dir = opendir(SYSFS_BLOCK);
+	if (dir == NULL) {
+		ERROR("Failed to open %s to find the disks", SYSFS_BLOCK);
+		return -1;
+	}
+
+	while ((entry = readdir(dir)) != NULL && num_disks < max_disks) {
+		if (entry->d_name[0] == '.')
+			continue;
+		if (topology_disk_read(entry->d_name, &disks[num_disks]))
+			num_disks++;
+	}
+
+	closedir(dir);
+	return num_disks;
+}
@@ -219,6 +219,28 @@ static inline int cdb_ata_check_power_mode(unsigned char *cdb)
 	return cdb_ata_passthrough_12(cdb, 0xE5, 0, 0, 0, PT_PROTO_NON_DATA, true, 1);
 }
 
+/* Power mode values returned in the count field of CHECK POWER MODE */
+typedef enum {
+	ATA_POWER_MODE_STANDBY = 0x00,
+	ATA_POWER_MODE_NV_CACHE_SPUN_DOWN = 0x40,
+	ATA_POWER_MODE_NV_CACHE_SPUN_UP = 0x41,
+	ATA_POWER_MODE_IDLE = 0x80,
+	ATA_POWER_MODE_IDLE_A = 0x81,
+	ATA_POWER_MODE_IDLE_B = 0x82,
+	ATA_POWER_MODE_IDLE_C = 0x83,
+	ATA_POWER_MODE_ACTIVE_OR_IDLE = 0xFF,
+} ata_power_mode_e;
+
+static inline bool ata_check_power_mode_result(unsigned char *sense, int sense_len, uint8_t *power_mode)
+{
+	ata_status_t status;
+	if (!ata_status_from_scsi_sense(sense, sense_len, &status))
+		return false;
+
+	*power_mode = status.sector_count & 0xFF;
+	return true;
+}
+
 static inline int cdb_ata_read_log_ext(unsigned char *cdb, uint16_t block_count, uint16_t page_number, uint8_t log_address)
 {
 	uint64_t lba = ((page_number & 0xFF00) << 24) | ((page_number & 0xFF) << 8) | log_address;
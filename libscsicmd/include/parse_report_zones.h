@@ -0,0 +1,119 @@
+/* Copyright 2017 Baruch Even
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef LIBSCSICMD_REPORT_ZONES_H
+#define LIBSCSICMD_REPORT_ZONES_H
+
+#include "scsicmd_utils.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define REPORT_ZONES_MIN_LEN 64
+#define REPORT_ZONES_DESC_LEN 64
+
+typedef enum zone_type_e {
+	ZONE_TYPE_RESERVED = 0,
+	ZONE_TYPE_CONVENTIONAL = 1,
+	ZONE_TYPE_SEQ_WRITE_REQUIRED = 2,
+	ZONE_TYPE_SEQ_WRITE_PREFERRED = 3,
+	ZONE_TYPE_SEQ_OR_BEFORE_REQUIRED = 4,
+	ZONE_TYPE_NUM,
+} zone_type_e;
+
+typedef enum zone_cond_e {
+	ZONE_COND_NOT_WP = 0x0,
+	ZONE_COND_EMPTY = 0x1,
+	ZONE_COND_IMPLICIT_OPEN = 0x2,
+	ZONE_COND_EXPLICIT_OPEN = 0x3,
+	ZONE_COND_CLOSED = 0x4,
+	ZONE_COND_READ_ONLY = 0xD,
+	ZONE_COND_FULL = 0xE,
+	ZONE_COND_OFFLINE = 0xF,
+} zone_cond_e;
+
+static inline uint32_t report_zones_list_len(uint8_t *data)
+{
+	return get_uint32(data, 0);
+}
+
+static inline uint8_t report_zones_same(uint8_t *data)
+{
+	return data[4] & 0x0F;
+}
+
+static inline uint64_t report_zones_max_lba(uint8_t *data)
+{
+	return get_uint64(data, 8);
+}
+
+static inline bool report_zones_is_valid(uint8_t *data, unsigned data_len)
+{
+	if (data_len < REPORT_ZONES_MIN_LEN)
+		return false;
+	if (report_zones_list_len(data) % REPORT_ZONES_DESC_LEN != 0)
+		return false;
+	return true;
+}
+
+static inline unsigned report_zones_num_descs(uint8_t *data, unsigned data_len)
+{
+	unsigned len = report_zones_list_len(data);
+	if (len > data_len - REPORT_ZONES_MIN_LEN)
+		len = data_len - REPORT_ZONES_MIN_LEN;
+	return len / REPORT_ZONES_DESC_LEN;
+}
+
+static inline uint8_t *report_zones_desc(uint8_t *data, unsigned idx)
+{
+	return data + REPORT_ZONES_MIN_LEN + idx * REPORT_ZONES_DESC_LEN;
+}
+
+static inline zone_type_e report_zones_desc_type(uint8_t *desc)
+{
+	return desc[0] & 0x0F;
+}
+
+static inline zone_cond_e report_zones_desc_cond(uint8_t *desc)
+{
+	return desc[1] >> 4;
+}
+
+static inline bool report_zones_desc_non_seq(uint8_t *desc)
+{
+	return desc[1] & 0x02;
+}
+
+static inline bool report_zones_desc_reset(uint8_t *desc)
+{
+	return desc[1] & 0x01;
+}
+
+static inline uint64_t report_zones_desc_len(uint8_t *desc)
+{
+	return get_uint64(desc, 8);
+}
+
+static inline uint64_t report_zones_desc_start_lba(uint8_t *desc)
+{
+	return get_uint64(desc, 16);
+}
+
+static inline uint64_t report_zones_desc_wp_lba(uint8_t *desc)
+{
+	return get_uint64(desc, 24);
+}
+
+#endif
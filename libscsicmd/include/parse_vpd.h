@@ -0,0 +1,176 @@
+/* Copyright 2017 Baruch Even
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef LIBSCSICMD_VPD_H
+#define LIBSCSICMD_VPD_H
+
+#include "scsicmd_utils.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include "parse_extended_inquiry.h"
+
+/* All of the accessors below take the full EVPD data, including the page header */
+
+/* Logical Block Provisioning VPD page */
+
+#define VPD_PAGE_LOGICAL_BLOCK_PROVISIONING 0xB2
+#define VPD_LBP_MIN_LEN 8
+
+typedef enum vpd_provisioning_type_e {
+	VPD_PROVISIONING_NOT_REPORTED = 0,
+	VPD_PROVISIONING_RESOURCE = 1,
+	VPD_PROVISIONING_THIN = 2,
+} vpd_provisioning_type_e;
+
+static inline bool vpd_lbp_is_valid(uint8_t *data, unsigned data_len)
+{
+	if (!evpd_is_valid(data, data_len))
+		return false;
+	if (evpd_page_code(data) != VPD_PAGE_LOGICAL_BLOCK_PROVISIONING)
+		return false;
+	if (data_len < VPD_LBP_MIN_LEN)
+		return false;
+	return true;
+}
+
+static inline uint8_t vpd_lbp_threshold_exponent(uint8_t *data)
+{
+	return data[4];
+}
+
+static inline bool vpd_lbp_lbpu(uint8_t *data)
+{
+	return data[5] & 0x80;
+}
+
+static inline bool vpd_lbp_lbpws(uint8_t *data)
+{
+	return data[5] & 0x40;
+}
+
+static inline bool vpd_lbp_lbpws10(uint8_t *data)
+{
+	return data[5] & 0x20;
+}
+
+static inline uint8_t vpd_lbp_lbprz(uint8_t *data)
+{
+	return (data[5] >> 2) & 0x07;
+}
+
+static inline bool vpd_lbp_anc_sup(uint8_t *data)
+{
+	return data[5] & 0x02;
+}
+
+static inline bool vpd_lbp_dp(uint8_t *data)
+{
+	return data[5] & 0x01;
+}
+
+static inline vpd_provisioning_type_e vpd_lbp_provisioning_type(uint8_t *data)
+{
+	return data[6] & 0x07;
+}
+
+/* Block Device Characteristics VPD page */
+
+#define VPD_PAGE_BLOCK_DEVICE_CHARACTERISTICS 0xB1
+#define VPD_BDC_MIN_LEN 9
+
+/* Peripheral device type of a host managed zoned block device */
+#define SCSI_DEV_TYPE_ZBC 0x14
+
+typedef enum vpd_zoned_e {
+	VPD_ZONED_NOT_REPORTED = 0,
+	VPD_ZONED_HOST_AWARE = 1,
+	VPD_ZONED_DEVICE_MANAGED = 2,
+} vpd_zoned_e;
+
+static inline bool vpd_bdc_is_valid(uint8_t *data, unsigned data_len)
+{
+	if (!evpd_is_valid(data, data_len))
+		return false;
+	if (evpd_page_code(data) != VPD_PAGE_BLOCK_DEVICE_CHARACTERISTICS)
+		return false;
+	if (data_len < VPD_BDC_MIN_LEN)
+		return false;
+	return true;
+}
+
+static inline uint16_t vpd_bdc_medium_rotation_rate(uint8_t *data)
+{
+	return get_uint16(data, 4);
+}
+
+static inline vpd_zoned_e vpd_bdc_zoned(uint8_t *data)
+{
+	return (data[8] >> 4) & 0x03;
+}
+
+/* Concurrent Positioning Ranges VPD page */
+
+#define VPD_PAGE_CONCURRENT_POSITIONING_RANGES 0xB9
+#define VPD_CPR_HDR_LEN 64
+#define VPD_CPR_DESC_LEN 32
+
+static inline bool vpd_cpr_is_valid(uint8_t *data, unsigned data_len)
+{
+	if (!evpd_is_valid(data, data_len))
+		return false;
+	if (evpd_page_code(data) != VPD_PAGE_CONCURRENT_POSITIONING_RANGES)
+		return false;
+	if (data_len < VPD_CPR_HDR_LEN)
+		return false;
+	return true;
+}
+
+static inline unsigned vpd_cpr_num_descs(uint8_t *data, unsigned data_len)
+{
+	unsigned len = evpd_page_len(data) + EVPD_MIN_LEN;
+	if (len > data_len)
+		len = data_len;
+	if (len < VPD_CPR_HDR_LEN)
+		return 0;
+	return (len - VPD_CPR_HDR_LEN) / VPD_CPR_DESC_LEN;
+}
+
+static inline uint8_t *vpd_cpr_desc(uint8_t *data, unsigned idx)
+{
+	return data + VPD_CPR_HDR_LEN + idx * VPD_CPR_DESC_LEN;
+}
+
+static inline uint8_t vpd_cpr_desc_range_number(uint8_t *desc)
+{
+	return desc[0];
+}
+
+static inline uint8_t vpd_cpr_desc_num_storage_elements(uint8_t *desc)
+{
+	return desc[1];
+}
+
+static inline uint64_t vpd_cpr_desc_start_lba(uint8_t *desc)
+{
+	return get_uint64(desc, 8);
+}
+
+static inline uint64_t vpd_cpr_desc_num_lbas(uint8_t *desc)
+{
+	return get_uint64(desc, 16);
+}
+
+#endif
@@ -41,10 +41,26 @@ enum sense_key_e {
 #undef SENSE_KEY_MAP
 
 const char *sense_key_to_name(enum sense_key_e sense_key);
+
+/** Longest description asc_num_to_str() can write, including the terminating null. */
+#define ASC_NUM_STR_LEN 64
+
+/** Describe an ASC/ASCQ pair, safe to call concurrently from multiple threads.
+ * Fixed descriptions are returned directly, codes that carry a value in the ASCQ and unknown codes are formatted
+ * into the caller provided buffer which is returned.
+ */
+const char *asc_num_to_str(uint8_t asc, uint8_t ascq, char *buf, unsigned buf_len);
+
+/** Same as asc_num_to_str() with a thread local buffer, the result is valid until the next call in the same thread. */
 const char *asc_num_to_name(uint8_t asc, uint8_t ascq);
 
 int cdb_tur(unsigned char *cdb);
 
+/** Build a REQUEST SENSE CDB, the sense data is returned as the data of the command.
+ * When the device is in a low power condition the sense data will report it with ASC 0x5E.
+ */
+int cdb_request_sense(unsigned char *cdb, bool desc, uint8_t alloc_len);
+
 #define SCSI_DEVICE_TYPE_LIST \
 	X(BLOCK) \
     X(SEQ) \
@@ -203,6 +219,25 @@ int cdb_write_10(unsigned char *cdb, bool fua, uint64_t lba, uint16_t transfer_l
 int cdb_read_16(unsigned char *cdb, bool fua, bool fua_nv, bool dpo, uint64_t lba, uint32_t transfer_length_blocks);
 int cdb_write_16(unsigned char *cdb, bool dpo, bool fua, bool fua_nv, uint64_t lba, uint32_t transfer_length_blocks);
 
+/* logical block provisioning */
+int cdb_get_lba_status(unsigned char *cdb, uint64_t lba, uint32_t alloc_len);
+
+/* zoned block commands */
+typedef enum {
+	REPORT_ZONES_ALL = 0x00,
+	REPORT_ZONES_EMPTY = 0x01,
+	REPORT_ZONES_IMPLICIT_OPEN = 0x02,
+	REPORT_ZONES_EXPLICIT_OPEN = 0x03,
+	REPORT_ZONES_CLOSED = 0x04,
+	REPORT_ZONES_FULL = 0x05,
+	REPORT_ZONES_READ_ONLY = 0x06,
+	REPORT_ZONES_OFFLINE = 0x07,
+	REPORT_ZONES_RWP_RECOMMENDED = 0x10,
+	REPORT_ZONES_NON_SEQ = 0x11,
+	REPORT_ZONES_NOT_WP = 0x3F,
+} report_zones_option_e;
+int cdb_report_zones(unsigned char *cdb, uint64_t zone_start_lba, uint32_t alloc_len, report_zones_option_e option, bool partial);
+
 /* log sense */
 int cdb_log_sense(unsigned char *cdb, uint8_t page_code, uint8_t subpage_code, uint16_t alloc_len);
 
@@ -51,6 +51,18 @@ int cdb_tur(unsigned char *cdb)
 	return TUR_LEN;
 }
 
+int cdb_request_sense(unsigned char *cdb, bool desc, uint8_t alloc_len)
+{
+	const int LEN = 6;
+	cdb[0] = 0x03;
+	cdb[1] = desc ? 1 : 0;
+	cdb[2] = 0;
+	cdb[3] = 0;
+	cdb[4] = alloc_len;
+	cdb[5] = 0;
+	return LEN;
+}
+
 int cdb_inquiry(unsigned char *cdb, bool evpd, char page_code, uint16_t alloc_len)
 {
 	const int INQUIRY_LEN = 6;
@@ -130,6 +142,30 @@ int cdb_write_16(unsigned char *cdb, bool dpo, bool fua, bool fua_nv, uint64_t l
 	return LEN;
 }
 
+int cdb_get_lba_status(unsigned char *cdb, uint64_t lba, uint32_t alloc_len)
+{
+	const int LEN = 16;
+	cdb[0] = 0x9E;
+	cdb[1] = 0x12; // Service action GET LBA STATUS
+	set_uint64(cdb, 2, lba);
+	set_uint32(cdb, 10, alloc_len);
+	cdb[14] = 0;
+	cdb[15] = 0;
+	return LEN;
+}
+
+int cdb_report_zones(unsigned char *cdb, uint64_t zone_start_lba, uint32_t alloc_len, report_zones_option_e option, bool partial)
+{
+	const int LEN = 16;
+	cdb[0] = 0x95;
+	cdb[1] = 0x00; // Service action REPORT ZONES
+	set_uint64(cdb, 2, zone_start_lba);
+	set_uint32(cdb, 10, alloc_len);
+	cdb[14] = (partial ? 0x80 : 0) | (option & 0x3F);
+	cdb[15] = 0;
+	return LEN;
+}
+
 int cdb_log_sense(unsigned char *cdb, uint8_t page_code, uint8_t subpage_code, uint16_t alloc_len)
 {
 	const int LEN = 10;
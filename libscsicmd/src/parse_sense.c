@@ -136,20 +136,22 @@ static bool parse_sense_descriptor(unsigned char *sense, unsigned sense_len, sen
                                         info->ata_status_valid = true;
                                         info->ata_status.extend = sense[idx+2] & 1;
                                         info->ata_status.error = sense[idx+3];
+                                        info->ata_status.device = sense[idx+12];
+                                        // SAT puts the high order byte of each register before its low byte, COUNT is bytes 4-5, LBA low/mid/high 6-11
                                         if (info->ata_status.extend) {
                                                 info->ata_status.sector_count = (sense[idx+4] << 8) | sense[idx+5];
                                                 info->ata_status.lba =
-													((uint64_t)sense[idx+7]) | 
-													((uint64_t)sense[idx+6]<<8) |
-													((uint64_t)sense[idx+9]<<16) |
-													((uint64_t)sense[idx+8]<<24) |
-													((uint64_t)sense[idx+11]<<32) |
+													((uint64_t)sense[idx+7]) |
+													((uint64_t)sense[idx+9]<<8) |
+													((uint64_t)sense[idx+11]<<16) |
+													((uint64_t)sense[idx+6]<<24) |
+													((uint64_t)sense[idx+8]<<32) |
 													((uint64_t)sense[idx+10]<<40);
                                         } else {
-                                                info->ata_status.sector_count = sense[idx+4];
-                                                info->ata_status.lba = sense[idx+7] | (sense[idx+9]<<8) | (sense[idx+11]<<16);
+                                                info->ata_status.sector_count = sense[idx+5];
+                                                info->ata_status.lba = sense[idx+7] | (sense[idx+9]<<8) | (sense[idx+11]<<16) |
+													((uint64_t)(sense[idx+12] & 0x0F)<<24);
                                         }
-                                        info->ata_status.device = sense[idx+12];
                                         info->ata_status.status = sense[idx+13];
                                 }
                                 break;
@@ -16,26 +16,76 @@ const char *sense_key_to_name(enum sense_key_e sense_key)
 	return "Unknown sense key";
 }
 
-const char *asc_num_to_name(uint8_t asc, uint8_t ascq)
-{
-	static char msg[64];
+struct asc_num_entry {
+	uint16_t asc_full;
+	const char *msg;
+};
 
-	uint16_t asc_full = asc<<8 | ascq;
+struct asc_keyed_entry {
+	uint8_t asc;
+	const char *fmt;
+};
 
-	switch (asc_full) {
+/* The list is generated from the T10 listing which is sorted by ASC/ASCQ, this keeps the table sorted for the binary search */
+static const struct asc_num_entry asc_num_table[] = {
 #define SENSE_CODE_KEYED(_asc_, _fmt_)
-#define SENSE_CODE(_asc_, _ascq_, _msg_) case _asc_<<8 | _ascq_: return _msg_;
+#define SENSE_CODE(_asc_, _ascq_, _msg_) { _asc_<<8 | _ascq_, _msg_ },
 	ASC_NUM_LIST
 #undef SENSE_CODE
 #undef SENSE_CODE_KEYED
-	}
+};
 
-#define SENSE_CODE_KEYED(_asc_, _fmt_) if (asc == _asc_) { snprintf(msg, sizeof(msg), _fmt_, ascq); return msg; }
+/* Codes where the ASCQ is a value, they cover all the ASCQs of the ASC that have no specific entry */
+static const struct asc_keyed_entry asc_keyed_table[] = {
+#define SENSE_CODE_KEYED(_asc_, _fmt_) { _asc_, _fmt_ },
 #define SENSE_CODE(_asc_, _ascq_, _msg_)
 	ASC_NUM_LIST
 #undef SENSE_CODE
 #undef SENSE_CODE_KEYED
+};
+
+static const char *asc_num_find(uint16_t asc_full)
+{
+	unsigned low = 0;
+	unsigned high = sizeof(asc_num_table) / sizeof(asc_num_table[0]);
+
+	while (low < high) {
+		const unsigned mid = low + (high - low) / 2;
+
+		if (asc_num_table[mid].asc_full == asc_full)
+			return asc_num_table[mid].msg;
+		else if (asc_num_table[mid].asc_full < asc_full)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
+const char *asc_num_to_str(uint8_t asc, uint8_t ascq, char *buf, unsigned buf_len)
+{
+	const char *msg;
+	unsigned i;
+
+	msg = asc_num_find(asc<<8 | ascq);
+	if (msg)
+		return msg;
+
+	for (i = 0; i < sizeof(asc_keyed_table) / sizeof(asc_keyed_table[0]); i++) {
+		if (asc_keyed_table[i].asc == asc) {
+			snprintf(buf, buf_len, asc_keyed_table[i].fmt, ascq);
+			return buf;
+		}
+	}
+
+	snprintf(buf, buf_len, "UNKNOWN ASC/ASCQ (%02Xh/%02Xh)", asc, ascq);
+	return buf;
+}
+
+const char *asc_num_to_name(uint8_t asc, uint8_t ascq)
+{
+	static __thread char msg[ASC_NUM_STR_LEN];
 
-	snprintf(msg, sizeof(msg), "UNKNOWN ASC/ASCQ (%02Xh/%02Xh)", asc, ascq);
-	return msg;
+	return asc_num_to_str(asc, ascq, msg, sizeof(msg));
 }
@@ -0,0 +1,90 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "scsicmd.h"
+
+#include <stdio.h>
+#include <string.h>
+
+struct asc_num_test_entry {
+	uint8_t asc;
+	uint8_t ascq;
+	const char *msg;
+};
+
+/* The same list str_map.c builds its table from */
+static const struct asc_num_test_entry entries[] = {
+#define SENSE_CODE_KEYED(_asc_, _fmt_)
+#define SENSE_CODE(_asc_, _ascq_, _msg_) { _asc_, _ascq_, _msg_ },
+	ASC_NUM_LIST
+#undef SENSE_CODE
+#undef SENSE_CODE_KEYED
+};
+
+#define NUM_ENTRIES (sizeof(entries) / sizeof(entries[0]))
+
+/* asc_num_to_str() does a binary search, an entry out of order or repeated may not be found */
+static int test_sorted(void)
+{
+	unsigned i;
+
+	for (i = 1; i < NUM_ENTRIES; i++) {
+		const unsigned prev = entries[i-1].asc << 8 | entries[i-1].ascq;
+		const unsigned cur = entries[i].asc << 8 | entries[i].ascq;
+
+		if (prev >= cur) {
+			printf("FAIL: ASC %02Xh/%02Xh comes after %02Xh/%02Xh\n", entries[i].asc, entries[i].ascq,
+					entries[i-1].asc, entries[i-1].ascq);
+			return 1;
+		}
+	}
+
+	printf("OK: %u codes are sorted\n", (unsigned)NUM_ENTRIES);
+	return 0;
+}
+
+static int test_found(void)
+{
+	char buf[ASC_NUM_STR_LEN];
+	unsigned i;
+
+	for (i = 0; i < NUM_ENTRIES; i++) {
+		const char *msg = asc_num_to_str(entries[i].asc, entries[i].ascq, buf, sizeof(buf));
+
+		if (strcmp(msg, entries[i].msg) != 0) {
+			printf("FAIL: ASC %02Xh/%02Xh is \"%s\" and not \"%s\"\n", entries[i].asc, entries[i].ascq, msg,
+					entries[i].msg);
+			return 1;
+		}
+	}
+
+	printf("OK: all the codes are found\n");
+	return 0;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= test_sorted();
+	ret |= test_found();
+	return ret;
+}
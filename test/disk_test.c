@@ -0,0 +1,157 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "disk.h"
+#include "fake_dev.h"
+#include "parse_vpd.h"
+#include "parse_report_zones.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define MAX_RANGES 8
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Parse a page with a descriptor per range in desc, cut to page_len - truncate bytes. expected is sorted, an
+ * expected_num of -1 is a rejection.
+ */
+static int check_ranges(const char *name, const lba_range_t *desc, unsigned num_desc, unsigned truncate,
+		const lba_range_t *expected, int expected_num)
+{
+	unsigned char page[1024];
+	lba_range_t ranges[MAX_RANGES];
+	const unsigned page_len = fake_dev_cpr_page(page, desc, num_desc);
+	const int num_ranges = disk_concurrent_ranges_parse(page, page_len - truncate, ranges, MAX_RANGES);
+	int i;
+
+	if (num_ranges != expected_num) {
+		printf("FAIL: %s: parsed %d ranges and not %d\n", name, num_ranges, expected_num);
+		return 1;
+	}
+	for (i = 0; i < num_ranges; i++) {
+		if (ranges[i].start_lba != expected[i].start_lba || ranges[i].num_blocks != expected[i].num_blocks) {
+			printf("FAIL: %s: range %d is %"PRIu64"+%"PRIu64" and not %"PRIu64"+%"PRIu64"\n", name, i,
+					ranges[i].start_lba, ranges[i].num_blocks, expected[i].start_lba, expected[i].num_blocks);
+			return 1;
+		}
+	}
+
+	printf("OK: %s\n", name);
+	return 0;
+}
+
+static int test_concurrent_ranges(void)
+{
+	const lba_range_t two[] = { {0, 1000}, {1000, 1000} };
+	const lba_range_t unsorted[] = { {2000, 1000}, {0, 1000}, {1000, 1000} };
+	const lba_range_t sorted[] = { {0, 1000}, {1000, 1000}, {2000, 1000} };
+	const lba_range_t overlapping[] = { {0, 1200}, {1000, 1000} };
+	const lba_range_t gap[] = { {0, 900}, {1000, 1000} };
+	const lba_range_t empty[] = { {0, 1000}, {5000, 0}, {1000, 1000} };
+	const lba_range_t too_many[MAX_RANGES + 1] = { {0, 1}, {1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 1}, {6, 1}, {7, 1}, {8, 1} };
+	int ret = 0;
+
+	ret |= check_ranges("two contiguous ranges", two, ARRAY_LEN(two), 0, two, 2);
+	ret |= check_ranges("unsorted ranges", unsorted, ARRAY_LEN(unsorted), 0, sorted, 3);
+	ret |= check_ranges("overlapping ranges", overlapping, ARRAY_LEN(overlapping), 0, NULL, -1);
+	// The parser keeps ranges with a gap between them, disk_open() scans such a disk as a whole
+	ret |= check_ranges("ranges with a gap", gap, ARRAY_LEN(gap), 0, gap, 2);
+	ret |= check_ranges("a range of no blocks", empty, ARRAY_LEN(empty), 0, two, 2);
+	ret |= check_ranges("more ranges than fit", too_many, ARRAY_LEN(too_many), 0, NULL, -1);
+	ret |= check_ranges("a page cut in a descriptor", two, ARRAY_LEN(two), VPD_CPR_DESC_LEN / 2, NULL, -1);
+	ret |= check_ranges("a page cut before its last bytes", two, ARRAY_LEN(two), 2, NULL, -1);
+	ret |= check_ranges("a page cut in its header", two, ARRAY_LEN(two), 2 * VPD_CPR_DESC_LEN + 8, NULL, -1);
+	return ret;
+}
+
+/* Parse an answer with a descriptor per zone in desc, cut to len - truncate bytes. An expected_num of -1 is a
+ * rejection.
+ */
+static int check_zones(const char *name, const zone_t *desc, unsigned num_desc, unsigned truncate, int max_zones,
+		const zone_t *expected, int expected_num)
+{
+	unsigned char buf[REPORT_ZONES_MIN_LEN + 16 * REPORT_ZONES_DESC_LEN];
+	zone_t zones[16];
+	const unsigned len = fake_dev_zones_page(buf, desc, num_desc);
+	const int num_zones = disk_report_zones_parse(buf, len - truncate, zones, max_zones);
+	int i;
+
+	if (num_zones != expected_num) {
+		printf("FAIL: %s: parsed %d zones and not %d\n", name, num_zones, expected_num);
+		return 1;
+	}
+	for (i = 0; i < num_zones; i++) {
+		const zone_t *z = &zones[i];
+		const zone_t *e = &expected[i];
+
+		if (z->start_lba != e->start_lba || z->num_blocks != e->num_blocks || z->wp_offset != e->wp_offset ||
+				z->type != e->type || z->cond != e->cond) {
+			printf("FAIL: %s: zone %d is %"PRIu64"+%u written %u type %u cond %u\n", name, i,
+					z->start_lba, z->num_blocks, z->wp_offset, z->type, z->cond);
+			return 1;
+		}
+	}
+
+	printf("OK: %s\n", name);
+	return 0;
+}
+
+static int test_report_zones(void)
+{
+	const zone_t zones[] = {
+		{ .start_lba = 0, .num_blocks = 4096, .wp_offset = 4096, .type = ZONE_TYPE_CONVENTIONAL, .cond = ZONE_COND_NOT_WP },
+		{ .start_lba = 4096, .num_blocks = 4096, .wp_offset = 0, .type = ZONE_TYPE_SEQ_WRITE_REQUIRED, .cond = ZONE_COND_EMPTY },
+		{ .start_lba = 8192, .num_blocks = 4096, .wp_offset = 1000, .type = ZONE_TYPE_SEQ_WRITE_REQUIRED, .cond = ZONE_COND_CLOSED },
+		{ .start_lba = 12288, .num_blocks = 4096, .wp_offset = 4096, .type = ZONE_TYPE_SEQ_WRITE_REQUIRED, .cond = ZONE_COND_FULL },
+	};
+	const zone_t with_empty[] = { zones[0], { .start_lba = 4096, .num_blocks = 0 }, zones[1] };
+	unsigned char bad[REPORT_ZONES_MIN_LEN + REPORT_ZONES_DESC_LEN];
+	int ret = 0;
+
+	ret |= check_zones("zones of each kind", zones, ARRAY_LEN(zones), 0, 16, zones, ARRAY_LEN(zones));
+	ret |= check_zones("more zones than asked for", zones, ARRAY_LEN(zones), 0, 2, zones, 2);
+	// The list is cut to the allocation length, the zones after it are asked for from the next lba
+	ret |= check_zones("a list cut short", zones, ARRAY_LEN(zones), REPORT_ZONES_DESC_LEN + 8, 16, zones, 2);
+	ret |= check_zones("a zone of no blocks", with_empty, ARRAY_LEN(with_empty), 0, 16, zones, 2);
+	ret |= check_zones("a list cut in its header", zones, ARRAY_LEN(zones), ARRAY_LEN(zones) * REPORT_ZONES_DESC_LEN + 8,
+			16, NULL, -1);
+
+	// The list length must be in whole descriptors
+	fake_dev_zones_page(bad, zones, 1);
+	bad[3] += 8;
+	zone_t parsed[1];
+	if (disk_report_zones_parse(bad, sizeof(bad), parsed, 1) != -1) {
+		printf("FAIL: a list of a partial descriptor is accepted\n");
+		ret = 1;
+	} else {
+		printf("OK: a list of a partial descriptor\n");
+	}
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= test_concurrent_ranges();
+	ret |= test_report_zones();
+	return ret;
+}
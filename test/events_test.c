@@ -0,0 +1,112 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "events.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+/* The linger time of a subscription is 100 msec, leave room for a loaded test machine */
+#define DELIVERY_LIMIT_MSEC 500
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static unsigned num_received;
+
+static void on_events(void *ctx, const scan_event_t *events, unsigned num_events)
+{
+	(void)ctx;
+	(void)events;
+
+	pthread_mutex_lock(&lock);
+	num_received += num_events;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static uint64_t now_msec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* Publish fewer events than a batch after the subscription was idle and wait for them to be delivered */
+static int test_partial_batch(unsigned num_events)
+{
+	const scan_filter_t filter = { .types = SCAN_EVENT_MASK_ALL };
+	const scan_event_t event = { .type = SCAN_EVENT_PROGRESS };
+	scan_subscription_t *sub;
+	struct timespec idle = { .tv_sec = 0, .tv_nsec = 200 * 1000000L };
+	unsigned i;
+	int ret = 0;
+
+	sub = scan_subscription_new(&filter, 64, on_events, NULL);
+	if (sub == NULL) {
+		printf("FAIL: failed to create a subscription\n");
+		return 1;
+	}
+
+	// Let the thread of the subscription settle waiting on an empty ring
+	nanosleep(&idle, NULL);
+
+	pthread_mutex_lock(&lock);
+	num_received = 0;
+	pthread_mutex_unlock(&lock);
+
+	const uint64_t start = now_msec();
+	for (i = 0; i < num_events; i++)
+		scan_subscription_publish(sub, &event);
+
+	pthread_mutex_lock(&lock);
+	while (num_received < num_events && now_msec() - start < DELIVERY_LIMIT_MSEC) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += 10 * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&cond, &lock, &deadline);
+	}
+	const unsigned received = num_received;
+	pthread_mutex_unlock(&lock);
+
+	if (received != num_events) {
+		printf("FAIL: %u of %u events were delivered within %u msec\n", received, num_events, DELIVERY_LIMIT_MSEC);
+		ret = 1;
+	} else {
+		printf("OK: %u events delivered in %"PRIu64" msec\n", num_events, now_msec() - start);
+	}
+
+	scan_subscription_free(sub);
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= test_partial_batch(1);
+	ret |= test_partial_batch(3);
+	return ret;
+}
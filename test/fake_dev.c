@@ -0,0 +1,239 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "fake_dev.h"
+#include "arch.h"
+#include "parse_vpd.h"
+#include "parse_report_zones.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+fake_dev_t fake_dev;
+
+/* The ranges of a disk are read from their own threads */
+static pthread_mutex_t fake_dev_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void fake_dev_reset(uint64_t num_bytes, uint32_t sector_size)
+{
+	free(fake_dev.data);
+	memset(&fake_dev, 0, sizeof(fake_dev));
+	fake_dev.data = calloc(1, num_bytes);
+	fake_dev.num_bytes = num_bytes;
+	fake_dev.sector_size = sector_size;
+	fake_dev.timeout_offset = UINT64_MAX;
+}
+
+static void put_uint64(unsigned char *buf, uint64_t val)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, val >>= 8)
+		buf[i] = val & 0xFF;
+}
+
+unsigned fake_dev_cpr_page(unsigned char *buf, const lba_range_t *ranges, unsigned num_ranges)
+{
+	const unsigned len = VPD_CPR_HDR_LEN + num_ranges * VPD_CPR_DESC_LEN;
+	unsigned i;
+
+	memset(buf, 0, len);
+	buf[1] = VPD_PAGE_CONCURRENT_POSITIONING_RANGES;
+	buf[2] = (len - EVPD_MIN_LEN) >> 8;
+	buf[3] = (len - EVPD_MIN_LEN) & 0xFF;
+	for (i = 0; i < num_ranges; i++) {
+		unsigned char *desc = buf + VPD_CPR_HDR_LEN + i * VPD_CPR_DESC_LEN;
+
+		desc[0] = i;
+		desc[1] = 1;
+		put_uint64(desc + 8, ranges[i].start_lba);
+		put_uint64(desc + 16, ranges[i].num_blocks);
+	}
+	return len;
+}
+
+static void put_uint32(unsigned char *buf, uint32_t val)
+{
+	int i;
+
+	for (i = 3; i >= 0; i--, val >>= 8)
+		buf[i] = val & 0xFF;
+}
+
+unsigned fake_dev_zones_page(unsigned char *buf, const zone_t *zones, unsigned num_zones)
+{
+	const unsigned len = REPORT_ZONES_MIN_LEN + num_zones * REPORT_ZONES_DESC_LEN;
+	unsigned i;
+
+	memset(buf, 0, len);
+	put_uint32(buf, num_zones * REPORT_ZONES_DESC_LEN);
+	for (i = 0; i < num_zones; i++) {
+		unsigned char *desc = buf + REPORT_ZONES_MIN_LEN + i * REPORT_ZONES_DESC_LEN;
+		const zone_t *zone = &zones[i];
+
+		desc[0] = zone->type;
+		desc[1] = zone->cond << 4;
+		put_uint64(desc + 8, zone->num_blocks);
+		put_uint64(desc + 16, zone->start_lba);
+		put_uint64(desc + 24, zone->wp_offset < zone->num_blocks ? zone->start_lba + zone->wp_offset : UINT64_MAX);
+	}
+	return len;
+}
+
+disk_mount_e disk_dev_mount_state(const char *path)
+{
+	(void)path;
+	return DISK_NOT_MOUNTED;
+}
+
+bool disk_dev_open(disk_dev_t *dev, const char *path)
+{
+	(void)path;
+	dev->fd = -1;
+	dev->sector_size = fake_dev.sector_size;
+	return fake_dev.data != NULL;
+}
+
+void disk_dev_close(disk_dev_t *dev)
+{
+	(void)dev;
+}
+
+static void io_result_set(io_result_t *io_res, enum result_data_e data, enum result_transport_e transport)
+{
+	memset(io_res, 0, sizeof(*io_res));
+	io_res->data = data;
+	io_res->error = transport == TRANSPORT_OK ? ERROR_NONE : ERROR_NEED_RETRY;
+	io_res->transport = transport;
+}
+
+void disk_dev_cdb_out(disk_dev_t *dev, unsigned char *cdb, unsigned cdb_len, unsigned char *buf, unsigned buf_size, unsigned *buf_read,
+		unsigned char *sense, unsigned sense_size, unsigned *sense_read, io_result_t *io_res)
+{
+	(void)dev;
+	(void)cdb;
+	(void)cdb_len;
+	(void)buf;
+	(void)buf_size;
+	(void)sense;
+	(void)sense_size;
+
+	*buf_read = 0;
+	*sense_read = 0;
+	io_result_set(io_res, DATA_NONE, TRANSPORT_OK);
+}
+
+/* Only the pages a test set up are answered, any other command gets no data as from a device that does not know it */
+void disk_dev_cdb_in(disk_dev_t *dev, unsigned char *cdb, unsigned cdb_len, unsigned char *buf, unsigned buf_size, unsigned *buf_read,
+		unsigned char *sense, unsigned sense_size, unsigned *sense_read, io_result_t *io_res)
+{
+	(void)dev;
+	(void)sense;
+	(void)sense_size;
+
+	*buf_read = 0;
+	*sense_read = 0;
+	io_result_set(io_res, DATA_NONE, TRANSPORT_OK);
+
+	const bool is_evpd = cdb_len >= 3 && cdb[0] == 0x12 && (cdb[1] & 1);
+	if (is_evpd && cdb[2] == VPD_PAGE_CONCURRENT_POSITIONING_RANGES && fake_dev.vpd_cpr_len > 0) {
+		*buf_read = fake_dev.vpd_cpr_len < buf_size ? fake_dev.vpd_cpr_len : buf_size;
+		memcpy(buf, fake_dev.vpd_cpr, *buf_read);
+		io_res->data = DATA_FULL;
+	}
+}
+
+ssize_t disk_dev_read(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_bytes, void *buf, io_result_t *io_res)
+{
+	(void)dev;
+
+	pthread_mutex_lock(&fake_dev_lock);
+	fake_dev.num_reads++;
+	const bool timeout = fake_dev.num_timeouts > 0 &&
+		offset_bytes <= fake_dev.timeout_offset && fake_dev.timeout_offset < offset_bytes + len_bytes;
+	if (timeout)
+		fake_dev.num_timeouts--;
+	pthread_mutex_unlock(&fake_dev_lock);
+
+	if (timeout || offset_bytes + len_bytes > fake_dev.num_bytes) {
+		io_result_set(io_res, DATA_NONE, timeout ? TRANSPORT_TIMEOUT : TRANSPORT_OK);
+		if (!timeout)
+			io_res->error = ERROR_UNCORRECTED;
+		return -1;
+	}
+
+	memcpy(buf, fake_dev.data + offset_bytes, len_bytes);
+	io_result_set(io_res, DATA_FULL, TRANSPORT_OK);
+	return len_bytes;
+}
+
+ssize_t disk_dev_write(disk_dev_t *dev, uint64_t offset_bytes, uint32_t len_bytes, void *buf, io_result_t *io_res)
+{
+	(void)dev;
+
+	if (offset_bytes + len_bytes > fake_dev.num_bytes) {
+		io_result_set(io_res, DATA_NONE, TRANSPORT_OK);
+		io_res->error = ERROR_UNCORRECTED;
+		return -1;
+	}
+
+	memcpy(fake_dev.data + offset_bytes, buf, len_bytes);
+	io_result_set(io_res, DATA_FULL, TRANSPORT_OK);
+	return len_bytes;
+}
+
+int disk_dev_read_cap(disk_dev_t *dev, uint64_t *size_bytes, uint64_t *sector_size)
+{
+	(void)dev;
+	*size_bytes = fake_dev.num_bytes;
+	*sector_size = fake_dev.sector_size;
+	return 0;
+}
+
+int disk_dev_identify(disk_dev_t *dev, char *vendor, char *model, char *fw_rev, char *serial, bool *is_ata, unsigned char *ata_buf, unsigned *ata_buf_len)
+{
+	(void)dev;
+	strcpy(vendor, "FAKE");
+	strcpy(model, "MEMORY");
+	strcpy(fw_rev, "1");
+	strcpy(serial, "F1");
+	*is_ata = false;
+	*ata_buf_len = 0;
+	*ata_buf = 0;
+	return 0;
+}
+
+void mac_read(unsigned char *buf, int len)
+{
+	memset(buf, 0, len);
+}
+
+int disk_dev_numa_node(disk_dev_t *dev)
+{
+	(void)dev;
+	return -1;
+}
+
+bool numa_node_bind(int node)
+{
+	(void)node;
+	return false;
+}
@@ -0,0 +1,55 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DISKSCAN_TEST_FAKE_DEV_H
+#define DISKSCAN_TEST_FAKE_DEV_H
+
+#include "disk.h"
+
+#include <stdint.h>
+
+/* A disk in memory in place of the arch layer, a test sets it up before disk_open(). There is only one, the scans
+ * of its ranges all read from it.
+ */
+typedef struct fake_dev_t {
+	unsigned char *data;
+	uint64_t num_bytes;
+	uint32_t sector_size;
+
+	uint64_t timeout_offset; /* A read covering it times out, UINT64_MAX for none */
+	unsigned num_timeouts;   /* How many reads time out before the device answers again */
+	unsigned num_reads;
+
+	unsigned char vpd_cpr[1024]; /* Concurrent positioning ranges page, none if vpd_cpr_len is 0 */
+	unsigned vpd_cpr_len;
+} fake_dev_t;
+
+extern fake_dev_t fake_dev;
+
+/* Start over with a disk of num_bytes that holds zeros */
+void fake_dev_reset(uint64_t num_bytes, uint32_t sector_size);
+/* Build a concurrent positioning ranges page with a descriptor per range, in the given order. Returns its length. */
+unsigned fake_dev_cpr_page(unsigned char *buf, const lba_range_t *ranges, unsigned num_ranges);
+/* Build a REPORT ZONES answer with a descriptor per zone, a zone written to its end is reported without a write
+ * pointer as a full one is. Returns its length.
+ */
+unsigned fake_dev_zones_page(unsigned char *buf, const zone_t *zones, unsigned num_zones);
+
+#endif
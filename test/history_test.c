@@ -0,0 +1,135 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LATENCY_LEN 4
+
+static int check_conclusions(const char *name, const char *path, const char *expected)
+{
+	char *report = NULL;
+	size_t report_len = 0;
+	FILE *f = open_memstream(&report, &report_len);
+	int ret = 0;
+
+	if (f == NULL) {
+		printf("FAIL: %s: failed to allocate the report\n", name);
+		return 1;
+	}
+	history_compare(path, f);
+	fclose(f);
+
+	const char *line = strstr(report, "Conclusions: ");
+	if (line == NULL || strncmp(line + strlen("Conclusions: "), expected, strlen(expected)) != 0 ||
+			line[strlen("Conclusions: ") + strlen(expected)] != '\n') {
+		printf("FAIL: %s: conclusions are not \"%s\" in:\n%s", name, expected, report);
+		ret = 1;
+	} else {
+		printf("OK: %s\n", name);
+	}
+
+	free(report);
+	return ret;
+}
+
+/* The conclusions are kept by name and read back as they were */
+static int test_conclusion_names(const char *dir)
+{
+	static const enum conclusion conclusions[] = {
+		CONCLUSION_PASSED, CONCLUSION_FAILED_LATENCY_PERCENTILE, CONCLUSION_FAILED_SLOW_REGION,
+	};
+	latency_t latency[LATENCY_LEN];
+	char path[1024];
+	disk_t disk;
+	unsigned i;
+	int ret = 0;
+
+	memset(&disk, 0, sizeof(disk));
+	memset(latency, 0, sizeof(latency));
+	strcpy(disk.model, "HISTORY");
+	strcpy(disk.serial, "H1");
+	disk.sector_size = 512;
+	disk.num_bytes = LATENCY_LEN * 1024 * 512;
+	disk.latency_graph = latency;
+	disk.latency_graph_len = LATENCY_LEN;
+	for (i = 0; i < LATENCY_LEN; i++) {
+		latency[i].start_sector = i * 1024;
+		latency[i].end_sector = (i + 1) * 1024;
+	}
+
+	for (i = 0; i < sizeof(conclusions) / sizeof(conclusions[0]); i++) {
+		disk.conclusion = conclusions[i];
+		if (history_append(dir, &disk) != 0) {
+			printf("FAIL: failed to append to the history in %s\n", dir);
+			return 1;
+		}
+	}
+
+	history_path(dir, &disk, path, sizeof(path));
+	ret |= check_conclusions("conclusions by name", path,
+			"passed, failed to to a high latency in the 99.99%'ile, failed due to a slow region");
+	unlink(path);
+	return ret;
+}
+
+/* Runs of older versions kept the value of the enum, they and runs without a known name are a scan problem */
+static int test_conclusion_unknown(const char *dir)
+{
+	char path[1024];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/unknown.history", dir);
+	f = fopen(path, "w");
+	if (f == NULL) {
+		printf("FAIL: failed to write %s\n", path);
+		return 1;
+	}
+	fprintf(f, "run time=1 conclusion=3 errors=0 sectors=4096 latency=0:4096:1:1:1\n");
+	fprintf(f, "run time=2 errors=0 sectors=4096 latency=0:4096:1:1:1\n");
+	fprintf(f, "run time=3 conclusion=failed_due_to_gremlins errors=0 sectors=4096 latency=0:4096:1:1:1\n");
+	fclose(f);
+
+	ret = check_conclusions("unknown conclusions", path, "scan_problem, scan_problem, scan_problem");
+	unlink(path);
+	return ret;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/diskscan_history_test_XXXXXX";
+	int ret = 0;
+
+	if (mkdtemp(dir) == NULL) {
+		printf("FAIL: failed to create a directory for the history\n");
+		return 1;
+	}
+
+	ret |= test_conclusion_names(dir);
+	ret |= test_conclusion_unknown(dir);
+	rmdir(dir);
+	return ret;
+}
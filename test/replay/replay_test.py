@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+"""Replay raw logs through diskscan --replay and check the results.
+
+The replay runs the IOs of a raw log through the same accounting and
+conclusion as a live scan, so these cases exercise the scan analysis without
+a device or root. The logs are generated in the current raw log format for
+each case, the bundled logs pin the format of older diskscan versions.
+"""
+
+import argparse
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+SENSE_NONE = '{"SenseKey": 0, "Asc": 0, "Ascq": 0, "FruCode": 0, "VendorCode": 0, "Hex": ""}'
+SENSE_MEDIUM_ERROR = '{"SenseKey": 3, "Asc": 17, "Ascq": 0, "FruCode": 0, "VendorCode": 0, "Hex": "f0000300001234"}'
+SENSE_UNIT_ATTENTION = '{"SenseKey": 6, "Asc": 41, "Ascq": 0, "FruCode": 0, "VendorCode": 0, "Hex": "70000600000000"}'
+
+NUM_SECTORS = 128 * 1024
+IO_SECTORS = 128
+MSEC = 1000 * 1000
+
+
+class TestFailure(Exception):
+    pass
+
+
+def check(cond, msg):
+    if not cond:
+        raise TestFailure(msg)
+
+
+def io(lba, latency_nsec, device_nsec=None, data='data_full', error='error_none', sense=SENSE_NONE, retry=0):
+    """An IO as written by data_log_raw()"""
+    device_nsec = latency_nsec if device_nsec is None else device_nsec
+    line = ('{"LBA": %16d, "Len": %8d, "LatencyNSec": %8d, "Data": "%s", "Error": "%s", "Sense": %s, '
+            '"MonoNSec": %d, "WallNSec": %d, "DeviceNSec": %d' %
+            (lba, IO_SECTORS, latency_nsec, data, error, sense, lba * 1000, lba * 1000, device_nsec))
+    if retry:
+        line += ', "Retry": %d' % retry
+    return line + '}'
+
+
+def raw_log(ios, ranges=None):
+    ranges = ranges or [(0, NUM_SECTORS)]
+    lines = [
+        '{',
+        '    "Disk": {',
+        '        "Vendor": "TEST",',
+        '        "Model": "REPLAY",',
+        '        "FwRev": "1",',
+        '        "Serial": "R1",',
+        '        "NumSectors": %d,' % NUM_SECTORS,
+        '        "NumaNode": -1,',
+        '        "SectorSize": 512',
+        '    },',
+        '    "Ranges": [%s],' % ', '.join('{"StartSector": %d, "EndSector": %d}' % r for r in ranges),
+        '    "Raw": [',
+        ',\n'.join('        ' + line for line in ios),
+        '    ]',
+        '}',
+    ]
+    return '\n'.join(lines) + '\n'
+
+
+def steady(rng, lba):
+    return rng.randint(5 * MSEC, 7 * MSEC)
+
+
+def seq_ios(start, end, latency=steady, rng=None):
+    rng = rng or random.Random(1)
+    return [io(lba, latency(rng, lba)) for lba in range(start, end, IO_SECTORS)]
+
+
+def case_clean():
+    return raw_log(seq_ios(0, NUM_SECTORS)), {'conclusion': 'passed', 'num_ios': NUM_SECTORS // IO_SECTORS}
+
+
+def case_medium_error():
+    ios = seq_ios(0, NUM_SECTORS)
+    ios[100] = io(100 * IO_SECTORS, 900 * MSEC, data='data_none', error='error_uncorrected', sense=SENSE_MEDIUM_ERROR)
+    return raw_log(ios), {'conclusion': 'failed due to IO errors'}
+
+
+def case_retried():
+    """Failed attempts that were retried are not held against the disk"""
+    ios = seq_ios(0, NUM_SECTORS)
+    attempts = [io(100 * IO_SECTORS, 1 * MSEC, data='data_none', error='error_need_retry', sense=SENSE_UNIT_ATTENTION,
+                   retry=n) for n in (1, 2)]
+    ios[100:100] = attempts
+    return raw_log(ios), {'conclusion': 'passed', 'num_ios': NUM_SECTORS // IO_SECTORS}
+
+
+def case_long_io():
+    """An IO beyond the range of 32 bits of nanoseconds"""
+    ios = seq_ios(0, NUM_SECTORS)
+    ios[100] = io(100 * IO_SECTORS, 12000 * MSEC)
+    return raw_log(ios), {'conclusion': 'failed due to a high max latency'}
+
+
+def case_host_delay():
+    """The host was slow to complete an IO the device served quickly, the disk is not at fault"""
+    ios = seq_ios(0, NUM_SECTORS)
+    ios[100] = io(100 * IO_SECTORS, 12000 * MSEC, device_nsec=6 * MSEC)
+    return raw_log(ios), {'conclusion': 'passed'}
+
+
+def case_dual_range_slow():
+    """The ranges of a multi-actuator disk are interleaved in the log, only the second one has a slow region"""
+    half = NUM_SECTORS // 2
+    slow_start = half + half // 2
+    slow_end = slow_start + half // 8
+
+    def latency(rng, lba):
+        if slow_start <= lba < slow_end:
+            return rng.randint(40 * MSEC, 45 * MSEC)
+        return steady(rng, lba)
+
+    first = seq_ios(0, half, latency, random.Random(1))
+    second = seq_ios(half, NUM_SECTORS, latency, random.Random(2))
+    ios = [line for pair in zip(first, second) for line in pair]
+    return raw_log(ios, [(0, half), (half, NUM_SECTORS)]), {
+        'conclusion': 'failed due to a slow region',
+        'num_ranges': 2,
+        'slow_region_in': (half, NUM_SECTORS),
+    }
+
+
+def case_binary():
+    """There is only the json raw log, a binary file is rejected up front"""
+    return bytes(range(256)) * 16, {'error': 'is not a raw log of diskscan'}
+
+
+def case_legacy(source_dir):
+    """A raw log of diskscan 0.19, before the ranges, the 64 bit latency and the device latency were logged"""
+    with open(os.path.join(source_dir, 'legacy_0.19.json')) as f:
+        return f.read(), {'conclusion': 'passed', 'num_ios': 64}
+
+
+CASES = {
+    'clean': case_clean,
+    'medium_error': case_medium_error,
+    'retried': case_retried,
+    'long_io': case_long_io,
+    'host_delay': case_host_delay,
+    'dual_range_slow': case_dual_range_slow,
+    'binary': case_binary,
+    'legacy': case_legacy,
+}
+
+
+def verify(expected, output):
+    if 'error' in expected:
+        check(expected['error'] in output, 'no "%s" error in the output' % expected['error'])
+        return
+
+    m = re.search(r'^Conclusion: (.*)$', output, re.MULTILINE)
+    check(m is not None, 'no conclusion in the output')
+    check(m.group(1) == expected['conclusion'], 'conclusion is "%s" and not "%s"' % (m.group(1), expected['conclusion']))
+
+    m = re.search(r'Replayed (\d+) IOs of .* in (\d+) ranges', output)
+    check(m is not None, 'no replay summary in the output')
+    if 'num_ios' in expected:
+        check(int(m.group(1)) == expected['num_ios'], '%s IOs replayed and not %d' % (m.group(1), expected['num_ios']))
+    check(int(m.group(2)) == expected.get('num_ranges', 1), '%s ranges replayed' % m.group(2))
+
+    if 'slow_region_in' in expected:
+        low, high = expected['slow_region_in']
+        section = output.split('Slow regions (msec):', 1)
+        check(len(section) == 2, 'no slow regions reported')
+        regions = re.findall(r'^\s*(\d+)\s+(\d+)\s+[\d.]+\s+[\d.]+$', section[1], re.MULTILINE)
+        check(regions, 'no slow regions reported')
+        for start, end in regions:
+            check(low <= int(start) and int(end) <= high, 'slow region %s-%s is outside of %d-%d' % (start, end, low, high))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--diskscan', required=True, help='diskscan binary to test')
+    parser.add_argument('case', choices=sorted(CASES))
+    args = parser.parse_args()
+
+    source_dir = os.path.dirname(os.path.abspath(__file__))
+    case = CASES[args.case]
+    log, expected = case(source_dir) if args.case == 'legacy' else case()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        binary = isinstance(log, bytes)
+        path = os.path.join(tmp, args.case + ('.bin' if binary else '.json'))
+        with open(path, 'wb' if binary else 'w') as f:
+            f.write(log)
+        proc = subprocess.run([args.diskscan, '--replay', path], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              universal_newlines=True, check=False)
+
+    try:
+        if 'error' in expected:
+            check(proc.returncode != 0, 'diskscan exited with 0')
+        else:
+            check(proc.returncode == 0, 'diskscan exited with %d' % proc.returncode)
+        verify(expected, proc.stdout)
+    except TestFailure as e:
+        sys.stdout.write(proc.stdout)
+        print('%s: FAILED: %s' % (args.case, e))
+        return 1
+
+    print('%s: passed' % args.case)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,230 @@
+/*
+ *  Copyright 2013 Baruch Even <baruch@ev-en.org>
+ *
+ *  This file is part of DiskScan.
+ *
+ *  DiskScan is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *  DiskScan is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DiskScan.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "diskscan.h"
+#include "fake_dev.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+/* The scans run against the fake device, disk_open() only needs the path to exist */
+#define FAKE_PATH "/dev/null"
+#define FAKE_BYTES (16*1024*1024)
+#define SCAN_SIZE (64*1024)
+
+/* A read that times out is retried in halves, the rest of the part is read into the same buffer after the first half.
+ * All of the part must still reach the content map and only once.
+ */
+static int test_content_map_retry(void)
+{
+	disk_t disk;
+	uint64_t i;
+	uint32_t x = 1;
+	int ret = 0;
+
+	fake_dev_reset(FAKE_BYTES, 512);
+	// A pattern would not do as it repeats the same word
+	for (i = 0; i < FAKE_BYTES; i++) {
+		x = x * 1103515245 + 12345;
+		fake_dev.data[i] = x >> 16;
+	}
+	fake_dev.timeout_offset = FAKE_BYTES / 2 + SCAN_SIZE + 4096;
+	fake_dev.num_timeouts = 1;
+
+	if (disk_open(&disk, FAKE_PATH, 0, 70, DISK_NOT_MOUNTED)) {
+		printf("FAIL: failed to open the fake disk\n");
+		return 1;
+	}
+	disk.content_map.enabled = true;
+	if (disk_scan(&disk, SCAN_MODE_SEQ, SCAN_SIZE)) {
+		printf("FAIL: the scan failed\n");
+		disk_close(&disk);
+		return 1;
+	}
+
+	const content_map_t *map = &disk.content_map;
+	if (fake_dev.num_timeouts != 0) {
+		printf("FAIL: the read at offset %"PRIu64" did not time out\n", fake_dev.timeout_offset);
+		ret = 1;
+	} else if (map->bytes[CONTENT_DATA] != FAKE_BYTES) {
+		printf("FAIL: classified %"PRIu64" zero %"PRIu64" data %"PRIu64" pattern %"PRIu64" unread bytes of %u\n",
+				map->bytes[CONTENT_ZERO], map->bytes[CONTENT_DATA], map->bytes[CONTENT_PATTERN],
+				map->bytes[CONTENT_UNREAD], FAKE_BYTES);
+		ret = 1;
+	} else {
+		for (i = 0; i < map->num_granules; i++) {
+			if (content_map_get(map, i) != CONTENT_DATA) {
+				printf("FAIL: granule %"PRIu64" is %s\n", i, content_type_to_str(content_map_get(map, i)));
+				ret = 1;
+				break;
+			}
+		}
+	}
+	if (ret == 0)
+		printf("OK: content map complete after a retry in halves\n");
+
+	disk_close(&disk);
+	return ret;
+}
+
+/* Count the ranges in the data log, it lists them only for a disk of more than one */
+static int data_log_num_ranges(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	char line[1024];
+	bool in_ranges = false;
+	int num_ranges = 0;
+
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (strstr(line, "\"Ranges\": [")) {
+			in_ranges = true;
+		} else if (in_ranges && strstr(line, "]")) {
+			break;
+		} else if (in_ranges && strstr(line, "\"StartSector\"")) {
+			num_ranges++;
+		}
+	}
+	fclose(f);
+	return num_ranges;
+}
+
+/* The disk reports its concurrent positioning ranges, each one valid range is scanned and reported on its own */
+static int test_ranges(const char *name, const lba_range_t *ranges, unsigned num_desc, unsigned expected_num)
+{
+	char log_name[] = "/tmp/diskscan_scan_test_XXXXXX";
+	disk_t disk;
+	int ret = 0;
+
+	fake_dev_reset(FAKE_BYTES, 512);
+	fake_dev.vpd_cpr_len = fake_dev_cpr_page(fake_dev.vpd_cpr, ranges, num_desc);
+
+	const int fd = mkstemp(log_name);
+	if (fd < 0) {
+		printf("FAIL: %s: failed to create the data log\n", name);
+		return 1;
+	}
+	close(fd);
+
+	if (disk_open(&disk, FAKE_PATH, 0, 70, DISK_NOT_MOUNTED)) {
+		printf("FAIL: %s: failed to open the fake disk\n", name);
+		unlink(log_name);
+		return 1;
+	}
+	data_log_start(&disk.data_log, log_name, &disk);
+	const int scan_ret = disk_scan(&disk, SCAN_MODE_SEQ, SCAN_SIZE);
+	data_log_end(&disk.data_log, &disk);
+
+	const int num_logged = data_log_num_ranges(log_name);
+	if (scan_ret != 0) {
+		printf("FAIL: %s: the scan failed\n", name);
+		ret = 1;
+	} else if (disk.num_ranges != expected_num) {
+		printf("FAIL: %s: scanned in %u ranges and not %u\n", name, disk.num_ranges, expected_num);
+		ret = 1;
+	} else if (num_logged != (expected_num > 1 ? (int)expected_num : 0)) {
+		printf("FAIL: %s: %d ranges in the data log for %u\n", name, num_logged, expected_num);
+		ret = 1;
+	} else if (disk.conclusion != CONCLUSION_PASSED) {
+		printf("FAIL: %s: conclusion is %s\n", name, conclusion_to_str(disk.conclusion));
+		ret = 1;
+	} else {
+		printf("OK: %s scanned in %u ranges\n", name, expected_num);
+	}
+
+	disk_close(&disk);
+	unlink(log_name);
+	return ret;
+}
+
+/* Every bucket of the heatmap is recorded once scanned, a sequential scan records them as it goes and a random one with
+ * the stride
+ */
+static int test_heatmap(enum scan_mode mode)
+{
+	char path[] = "/tmp/diskscan_scan_test_XXXXXX";
+	const uint64_t bucket_bytes = 1024 * 1024;
+	const char *mode_name = mode == SCAN_MODE_SEQ ? "sequential" : "random";
+	disk_t disk;
+	uint64_t i;
+	int ret = 0;
+
+	fake_dev_reset(FAKE_BYTES, 512);
+	const int fd = mkstemp(path);
+	if (fd < 0) {
+		printf("FAIL: %s heatmap: failed to create the file\n", mode_name);
+		return 1;
+	}
+	close(fd);
+
+	if (disk_open(&disk, FAKE_PATH, 0, 70, DISK_NOT_MOUNTED)) {
+		printf("FAIL: %s heatmap: failed to open the fake disk\n", mode_name);
+		unlink(path);
+		return 1;
+	}
+	if (!heatmap_create(&disk.heatmap, path, bucket_bytes, disk.num_bytes, disk.sector_size, disk.vendor, disk.model,
+				disk.serial)) {
+		printf("FAIL: %s heatmap: failed to create it\n", mode_name);
+		disk_close(&disk);
+		unlink(path);
+		return 1;
+	}
+
+	if (disk_scan(&disk, mode, SCAN_SIZE)) {
+		printf("FAIL: %s heatmap: the scan failed\n", mode_name);
+		ret = 1;
+	}
+	for (i = 0; ret == 0 && i < disk.heatmap.header->num_buckets; i++) {
+		const heatmap_record_t *record = &disk.heatmap.records[i];
+
+		// An IO split by a stride end counts twice
+		if (!(record->flags & HEATMAP_RECORD_DONE) || record->num_ios < bucket_bytes / SCAN_SIZE ||
+				record->num_errors != 0 || record->min_usec > record->max_usec) {
+			printf("FAIL: %s heatmap: bucket %"PRIu64" flags %u with %u IOs\n", mode_name, i, record->flags,
+					record->num_ios);
+			ret = 1;
+		}
+	}
+	if (ret == 0)
+		printf("OK: %s heatmap has all of its %"PRIu64" buckets\n", mode_name, disk.heatmap.header->num_buckets);
+
+	disk_close(&disk);
+	unlink(path);
+	return ret;
+}
+
+int main(void)
+{
+	const lba_range_t two[] = { {0, FAKE_BYTES / 512 / 2}, {FAKE_BYTES / 512 / 2, FAKE_BYTES / 512 / 2} };
+	const lba_range_t gap[] = { {0, FAKE_BYTES / 512 / 4}, {FAKE_BYTES / 512 / 2, FAKE_BYTES / 512 / 2} };
+	int ret = 0;
+
+	ret |= test_content_map_retry();
+	ret |= test_ranges("two ranges", two, 2, 2);
+	// Ranges that do not cover the disk are not trusted
+	ret |= test_ranges("two ranges with a gap", gap, 2, 1);
+	ret |= test_heatmap(SCAN_MODE_SEQ);
+	ret |= test_heatmap(SCAN_MODE_RANDOM);
+	return ret;
+}
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+"""Run diskscan end to end against scsi_debug devices.
+
+Each scenario loads the scsi_debug module with its own parameters, scans the
+device it creates through the Linux SG path and checks the conclusion, the
+reported errors and the latency. Scenarios that measure the engine append
+their throughput to a results file and fail when it regresses against the
+previous runs.
+
+Needs root and the scsi_debug module, exits with 77 (skipped) otherwise. The
+probes_listed scenario only reads the USDT probes of the binary and needs
+neither.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import time
+
+SKIP = 77
+
+# Medium errors of scsi_debug start at this LBA unless medium_error_start is given
+MEDIUM_ERROR_LBA = 0x1234
+
+# The USDT probes of the scan and SCSI paths, see include/probes.h
+PROBES = ['io__submit', 'io__complete', 'bucket__finish', 'sg__ioctl__entry', 'sg__ioctl__exit', 'sense__decode',
+          'smart__poll', 'fix__rewrite', 'fix__zero']
+
+SCENARIOS = {
+    # Clean devices measure the engine itself, scsi_debug completes the reads from memory
+    'clean': {
+        'module': {'dev_size_mb': 1024, 'sector_size': 512},
+        'conclusion': 'passed',
+        'max_latency_msec': 100,
+        'perf': True,
+    },
+    'clean_4k': {
+        'module': {'dev_size_mb': 1024, 'sector_size': 4096},
+        'conclusion': 'passed',
+        'max_latency_msec': 100,
+        'perf': True,
+    },
+    'slow': {
+        'module': {'dev_size_mb': 64, 'sector_size': 512, 'ndelay': 20 * 1000 * 1000},
+        'conclusion': 'passed',
+        'median_latency_msec': (20, 60),
+    },
+    'medium_error': {
+        'module': {'dev_size_mb': 64, 'sector_size': 512, 'opts': 0x2},
+        'conclusion': 'failed due to IO errors',
+        'error_lbas': [MEDIUM_ERROR_LBA],
+    },
+    # Every 500th command is dropped and times out, the scan must not pass the disk
+    'timeout': {
+        'module': {'dev_size_mb': 64, 'sector_size': 512, 'opts': 0x4, 'every_nth': 500},
+        'conclusion_not': 'passed',
+    },
+    'pi': {
+        'module': {'dev_size_mb': 256, 'sector_size': 512, 'dif': 1, 'dix': 1, 'guard': 0},
+        'conclusion': 'passed',
+    },
+    # A thin provisioned device with only its start written, the rest is skipped as unmapped
+    'lbp': {
+        'module': {'dev_size_mb': 256, 'sector_size': 512, 'lbpu': 1, 'lbpws': 1},
+        'write_mb': 16,
+        'conclusion': 'passed',
+        'mapped_mb': 16,
+    },
+    # A host-managed zoned device of 16 zones, the conventional one and half of the first sequential one written.
+    # Only the written blocks are read, the rest is reported as unwritten.
+    'zbc': {
+        'module': {'dev_size_mb': 256, 'sector_size': 512, 'zbc': 'host-managed', 'zone_size_mb': 16, 'zone_nr_conv': 1},
+        'write_mb': 24,
+        'conclusion': 'passed',
+        'zones': {
+            'num_zones': 16,
+            'unwritten_mb': 256 - 24,
+            'types': ['Conventional', 'SequentialWriteRequired'],
+        },
+    },
+    # The probes are in the binary when it was built with sys/sdt.h, no device is needed to list them
+    'probes_listed': {
+        'static': True,
+    },
+    # Every read fires the IO probes once and every column of the latency graph the bucket probe
+    'probes': {
+        'module': {'dev_size_mb': 64, 'sector_size': 512},
+        'conclusion': 'passed',
+        'probes': True,
+    },
+}
+
+
+class TestFailure(Exception):
+    pass
+
+
+def check(cond, msg):
+    if not cond:
+        raise TestFailure(msg)
+
+
+def scsi_debug_load(params):
+    args = ['modprobe', 'scsi_debug'] + ['%s=%s' % (k, v) for k, v in params.items()]
+    subprocess.run(args, check=True)
+    subprocess.run(['udevadm', 'settle'], check=False)
+
+    for _ in range(100):
+        blocks = glob.glob('/sys/bus/pseudo/drivers/scsi_debug/adapter*/host*/target*/*:*:*:*/block/*')
+        if blocks and os.path.exists('/dev/' + os.path.basename(blocks[0])):
+            return '/dev/' + os.path.basename(blocks[0])
+        time.sleep(0.1)
+
+    raise TestFailure('scsi_debug did not create a block device')
+
+
+def scsi_debug_unload():
+    for _ in range(50):
+        if subprocess.run(['modprobe', '-r', 'scsi_debug'], check=False).returncode == 0:
+            return
+        time.sleep(0.2)
+
+
+def probes_listed(diskscan):
+    proc = subprocess.run(['readelf', '-n', diskscan], stdout=subprocess.PIPE, universal_newlines=True, check=True)
+    probes = set()
+    provider = None
+    for line in proc.stdout.splitlines():
+        line = line.strip()
+        if line.startswith('Provider: '):
+            provider = line[len('Provider: '):]
+        elif line.startswith('Name: ') and provider == 'diskscan':
+            probes.add(line[len('Name: '):])
+    return probes
+
+
+def probes_check(diskscan):
+    missing = sorted(set(PROBES) - probes_listed(diskscan))
+    check(not missing, 'probes missing from %s: %s' % (diskscan, ', '.join(missing)))
+
+
+def run_diskscan_traced(diskscan, dev, out):
+    """Scan under bpftrace and count how often the IO and bucket probes fired"""
+    script = ''.join('usdt:%s:diskscan:%s { @%s = count(); }' % (diskscan, probe, probe)
+                     for probe in ('io__submit', 'io__complete', 'bucket__finish'))
+    proc = subprocess.run(['bpftrace', '-e', script, '-c', '%s -o %s %s' % (diskscan, out, dev)],
+                          stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True, check=False)
+    counts = {probe: int(count) for probe, count in re.findall(r'^@(\w+): (\d+)$', proc.stdout, re.MULTILINE)}
+    check(proc.returncode == 0, 'bpftrace exited with %d:\n%s' % (proc.returncode, proc.stdout))
+    with open(out) as f:
+        return json.load(f), counts
+
+
+def verify_probes(log, counts):
+    num_ios = log['Scan']['Cost']['NumIOs']
+    for probe in ('io__submit', 'io__complete'):
+        check(counts.get(probe, 0) == num_ios, '%s fired %d times for %d IOs' % (probe, counts.get(probe, 0), num_ios))
+    num_buckets = len(log['Scan']['Latencies'])
+    check(0 < counts.get('bucket__finish', 0) <= num_buckets,
+          'bucket__finish fired %d times for %d buckets' % (counts.get('bucket__finish', 0), num_buckets))
+
+
+def run_diskscan(diskscan, dev, out):
+    proc = subprocess.run([diskscan, '-o', out, dev], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                          universal_newlines=True, check=False)
+    if proc.returncode != 0:
+        sys.stdout.write(proc.stdout)
+    with open(out) as f:
+        return json.load(f)
+
+
+def verify(scenario, log):
+    scan = log['Scan']
+
+    if 'conclusion' in scenario:
+        check(scan['Conclusion'] == scenario['conclusion'],
+              'conclusion is "%s" and not "%s"' % (scan['Conclusion'], scenario['conclusion']))
+    if 'conclusion_not' in scenario:
+        check(scan['Conclusion'] != scenario['conclusion_not'], 'conclusion is "%s"' % scan['Conclusion'])
+
+    errors = [e for e in scan['Events'] if 'LBA' in e and e['Error'] != 'error_none']
+    for lba in scenario.get('error_lbas', []):
+        check(any(e['LBA'] <= lba < e['LBA'] + e['Len'] for e in errors), 'no error reported for lba %d' % lba)
+    if 'error_lbas' not in scenario and 'conclusion_not' not in scenario:
+        check(not errors, '%d unexpected errors, first at lba %d' % (len(errors), errors[0]['LBA']) if errors else '')
+
+    latencies = scan['Latencies']
+    if 'max_latency_msec' in scenario:
+        worst = max(l['LatencyMaxMsec'] for l in latencies)
+        check(worst <= scenario['max_latency_msec'], 'max latency %d msec' % worst)
+    if 'median_latency_msec' in scenario:
+        low, high = scenario['median_latency_msec']
+        median = statistics.median(l['LatencyMedianMsec'] for l in latencies)
+        check(low <= median <= high, 'median latency %s msec not in [%d, %d]' % (median, low, high))
+
+    if 'mapped_mb' in scenario:
+        prov = scan['Provisioning']
+        check(prov['Supported'], 'logical block provisioning not detected')
+        check(prov['MappedBytes'] >= scenario['mapped_mb'] * 1024 * 1024,
+              'only %d bytes reported mapped' % prov['MappedBytes'])
+        check(prov['UnmappedBytes'] > 0, 'no unmapped bytes reported')
+
+    if 'zones' in scenario:
+        expected = scenario['zones']
+        check('Zones' in scan, 'no zones reported')
+        zones = scan['Zones']
+        check(zones['NumZones'] == expected['num_zones'],
+              '%d zones reported and not %d' % (zones['NumZones'], expected['num_zones']))
+        check(zones['UnwrittenBytes'] == expected['unwritten_mb'] * 1024 * 1024,
+              '%d bytes reported unwritten and not %d MB' % (zones['UnwrittenBytes'], expected['unwritten_mb']))
+        missing = sorted(set(expected['types']) - set(zones['Histograms']))
+        check(not missing, 'no latency histogram for the %s zones' % ', '.join(missing))
+
+
+def perf_record(name, scenario, log, results_dir, tolerance):
+    """Append the throughput of the run to the results and compare it to the median of the previous runs."""
+    cost = log['Scan']['Cost']
+    num_bytes = scenario['module']['dev_size_mb'] * 1024 * 1024
+    result = {
+        'Time': int(time.time()),
+        'MBPerSec': num_bytes / (1024 * 1024) / (cost['WallNSec'] / 1e9),
+        'CpuNSecPerIO': cost['CpuNSec'] / max(cost['NumIOs'], 1),
+    }
+
+    path = os.path.join(results_dir, name + '.jsonl')
+    history = []
+    if os.path.exists(path):
+        with open(path) as f:
+            history = [json.loads(line) for line in f if line.strip()]
+
+    os.makedirs(results_dir, exist_ok=True)
+    with open(path, 'a') as f:
+        f.write(json.dumps(result) + '\n')
+
+    print('%s: %.1f MB/s, %.0f CPU nsec per IO' % (name, result['MBPerSec'], result['CpuNSecPerIO']))
+    if not history:
+        return
+
+    recent = history[-5:]
+    base_mbps = statistics.median(r['MBPerSec'] for r in recent)
+    base_cpu = statistics.median(r['CpuNSecPerIO'] for r in recent)
+    check(result['MBPerSec'] >= base_mbps * (1 - tolerance),
+          'throughput regressed to %.1f MB/s from %.1f MB/s' % (result['MBPerSec'], base_mbps))
+    check(result['CpuNSecPerIO'] <= base_cpu * (1 + tolerance),
+          'CPU per IO regressed to %.0f nsec from %.0f nsec' % (result['CpuNSecPerIO'], base_cpu))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--diskscan', required=True, help='diskscan binary to test')
+    parser.add_argument('--results', required=True, help='directory the performance results are kept in')
+    parser.add_argument('--tolerance', type=float, default=0.2, help='allowed performance regression (default 0.2)')
+    parser.add_argument('scenario', choices=sorted(SCENARIOS))
+    args = parser.parse_args()
+    scenario = SCENARIOS[args.scenario]
+
+    if shutil.which('readelf') is None and (scenario.get('static') or scenario.get('probes')):
+        print('readelf is not available, skipping')
+        return SKIP
+    if (scenario.get('static') or scenario.get('probes')) and not probes_listed(args.diskscan):
+        print('%s was built without USDT probes, skipping' % args.diskscan)
+        return SKIP
+    if scenario.get('static'):
+        try:
+            probes_check(args.diskscan)
+        except TestFailure as e:
+            print('%s: FAILED: %s' % (args.scenario, e))
+            return 1
+        print('%s: passed' % args.scenario)
+        return 0
+    if scenario.get('probes') and shutil.which('bpftrace') is None:
+        print('bpftrace is not available, skipping')
+        return SKIP
+
+    if os.geteuid() != 0:
+        print('scsi_debug tests need root, skipping')
+        return SKIP
+    if shutil.which('modprobe') is None or shutil.which('modinfo') is None:
+        print('kmod tools are not available, skipping')
+        return SKIP
+    if subprocess.run(['modinfo', 'scsi_debug'], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL,
+                      check=False).returncode != 0:
+        print('scsi_debug module is not available, skipping')
+        return SKIP
+    if 'zbc' in scenario['module']:
+        params = subprocess.run(['modinfo', '-p', 'scsi_debug'], stdout=subprocess.PIPE, universal_newlines=True,
+                                check=False).stdout
+        if not re.search(r'^zbc:', params, re.MULTILINE):
+            print('scsi_debug cannot emulate a zoned device, skipping')
+            return SKIP
+    if os.path.exists('/sys/module/scsi_debug'):
+        print('scsi_debug is already loaded, not touching it')
+        return SKIP
+
+    out = os.path.join(args.results, args.scenario + '.last.json')
+    os.makedirs(args.results, exist_ok=True)
+    try:
+        dev = scsi_debug_load(scenario['module'])
+        if 'write_mb' in scenario:
+            subprocess.run(['dd', 'if=/dev/urandom', 'of=' + dev, 'bs=1M', 'count=%d' % scenario['write_mb'],
+                            'oflag=direct'], check=True, stderr=subprocess.DEVNULL)
+        if scenario.get('probes'):
+            log, counts = run_diskscan_traced(args.diskscan, dev, out)
+            verify_probes(log, counts)
+        else:
+            log = run_diskscan(args.diskscan, dev, out)
+        verify(scenario, log)
+        if scenario.get('perf'):
+            perf_record(args.scenario, scenario, log, args.results, args.tolerance)
+    except TestFailure as e:
+        print('%s: FAILED: %s' % (args.scenario, e))
+        return 1
+    finally:
+        scsi_debug_unload()
+
+    print('%s: passed' % args.scenario)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())